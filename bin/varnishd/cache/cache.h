@@ -122,6 +122,7 @@ struct objhead;
 struct pool;
 struct req_step;
 struct sess;
+struct tag_ref;
 struct transport;
 struct vcf;
 struct VSC_lck;
@@ -210,6 +211,7 @@ struct pool_task {
 	VTAILQ_ENTRY(pool_task)		list;
 	task_func_t			*func;
 	void				*priv;
+	vtim_mono			queued;
 };
 
 /*
@@ -354,12 +356,15 @@ struct objcore {
 	uint16_t		oa_present;
 
 	unsigned		timer_idx;	// XXX 4Gobj limit
+	uint8_t			lru_ref;	// set without lock
+	uint8_t			lru_size;	// length <= 1 << lru_size
 	vtim_real		last_lru;
 	VTAILQ_ENTRY(objcore)	hsh_list;
 	VTAILQ_ENTRY(objcore)	lru_list;
 	VTAILQ_ENTRY(objcore)	ban_list;
 	VSTAILQ_ENTRY(objcore)	exp_list;
 	struct ban		*ban;
+	struct tag_ref		*tags;
 };
 
 /* Busy Object structure ---------------------------------------------
@@ -787,6 +792,7 @@ void VSLbs(struct vsl_log *, enum VSL_tag_e tag, const struct strands *s);
 void VSLb_ts(struct vsl_log *, const char *event, vtim_real first,
     vtim_real *pprev, vtim_real now);
 void VSLb_bin(struct vsl_log *, enum VSL_tag_e, ssize_t, const void*);
+void VSLb_uint(struct vsl_log *, enum VSL_tag_e, unsigned n, ...);
 int VSL_tag_is_masked(enum VSL_tag_e tag);
 
 static inline void
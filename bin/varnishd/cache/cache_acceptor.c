@@ -458,6 +458,17 @@ vca_make_session(struct worker *wrk, void *arg)
 	vca_pace_good();
 	wrk->stats->sess_conn++;
 
+	switch (NUMA_Local(sp->fd, wrk->pool->numa_node)) {
+	case 0:
+		wrk->stats->sess_numa_remote++;
+		break;
+	case 1:
+		wrk->stats->sess_numa_local++;
+		break;
+	default:
+		break;
+	}
+
 	if (wa->acceptlsock->test_heritage) {
 		vca_sock_opt_test(wa->acceptlsock, sp);
 		wa->acceptlsock->test_heritage = 0;
@@ -596,34 +607,73 @@ vca_accept_task(struct worker *wrk, void *arg)
 /*--------------------------------------------------------------------
  * Called when a worker and attached thread pool is created, to
  * allocate the tasks which will listen to sockets for that pool.
+ *
+ * With listen_reuseport, each pool only listens to its own socket of
+ * every address.
  */
 
+static struct poolsock *
+vca_poolsock(struct pool *pp, struct listen_sock *ls)
+{
+	struct poolsock *ps;
+
+	ALLOC_OBJ(ps, POOLSOCK_MAGIC);
+	AN(ps);
+	ps->lsock = ls;
+	ps->task->func = vca_accept_task;
+	ps->task->priv = ps;
+	ps->pool = pp;
+	VTAILQ_INSERT_TAIL(&pp->poolsocks, ps, list);
+	AZ(Pool_Task(pp, ps->task, TASK_QUEUE_VCA));
+	return (ps);
+}
+
 void
-VCA_NewPool(struct pool *pp)
+VCA_NewPool(struct pool *pp, unsigned pool_no)
 {
 	struct listen_sock *ls;
 	struct poolsock *ps;
 
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
-		ALLOC_OBJ(ps, POOLSOCK_MAGIC);
-		AN(ps);
-		ps->lsock = ls;
-		ps->task->func = vca_accept_task;
-		ps->task->priv = ps;
-		ps->pool = pp;
-		VTAILQ_INSERT_TAIL(&pp->poolsocks, ps, list);
-		AZ(Pool_Task(pp, ps->task, TASK_QUEUE_VCA));
+		if (ls->primary != NULL)
+			continue;
+		if (ls->nreuse > 1) {
+			ps = vca_poolsock(pp, ls->reuse[pool_no % ls->nreuse]);
+			if (!ls->uds && pool_no < ls->nreuse)
+				NUMA_Steer(ps->lsock->sock, pp->numa_node,
+				    pool_no);
+		} else
+			(void)vca_poolsock(pp, ls);
 	}
 }
 
+/*
+ * The heir takes over the sockets of a dying pool which it does not
+ * listen to yet, so no listen_reuseport socket is left without anybody
+ * to accept its connections.
+ *
+ * This must happen before pp->die is set: from then on the accept tasks
+ * of the dying pool free their poolsock as soon as accept() returns.
+ */
+
 void
-VCA_DestroyPool(struct pool *pp)
+VCA_DestroyPool(struct pool *pp, struct pool *heir)
 {
-	struct poolsock *ps;
+	struct poolsock *ps, *ps2;
 
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	AZ(pp->die);
+	CHECK_OBJ_ORNULL(heir, POOL_MAGIC);
 	while (!VTAILQ_EMPTY(&pp->poolsocks)) {
 		ps = VTAILQ_FIRST(&pp->poolsocks);
 		VTAILQ_REMOVE(&pp->poolsocks, ps, list);
+		if (heir == NULL)
+			continue;
+		VTAILQ_FOREACH(ps2, &heir->poolsocks, list)
+			if (ps2->lsock == ps->lsock)
+				break;
+		if (ps2 == NULL)
+			(void)vca_poolsock(heir, ps->lsock);
 	}
 }
 
@@ -739,6 +789,8 @@ ccf_listen_address(struct cli *cli, const char * const *av, void *priv)
 
 	PTOK(pthread_mutex_lock(&shut_mtx));
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		if (ls->primary != NULL)
+			continue;
 		if (!ls->uds) {
 			VTCP_myname(ls->sock, h, sizeof h, p, sizeof p);
 			VCLI_Out(cli, "%s %s %s\n", ls->name, h, p);
@@ -57,15 +57,6 @@ static int ban_holds;
 uint64_t bans_persisted_bytes;
 uint64_t bans_persisted_fragmentation;
 
-struct ban_test {
-	uint8_t			oper;
-	uint8_t			arg1;
-	const char		*arg1_spec;
-	const char		*arg2;
-	double			arg2_double;
-	const void		*arg2_spec;
-};
-
 static const char * const arg_name[BAN_ARGARRSZ + 1] = {
 #define PVAR(a, b, c) [BAN_ARGIDX(c)] = (a),
 #include "tbl/ban_vars.h"
@@ -97,6 +88,7 @@ BAN_Free(struct ban *b)
 
 	if (b->spec != NULL)
 		free(b->spec);
+	free(b->test);
 	FREE_OBJ(b);
 }
 
@@ -242,6 +234,38 @@ ban_iter(const uint8_t **bs, struct ban_test *bt)
 		bt->arg2_spec = ban_get_lump(bs);
 }
 
+/*--------------------------------------------------------------------
+ * Parse the tests of a ban once, so evaluation does not have to walk
+ * the spec for every object.  If we run out of memory, ban_match()
+ * falls back to the spec.
+ */
+
+void
+ban_compile(struct ban *b)
+{
+	struct ban_test bt;
+	const uint8_t *bs, *be;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	AN(b->spec);
+	AZ(b->test);
+
+	be = b->spec + ban_len(b->spec);
+	bs = b->spec + BANS_HEAD_LEN;
+	for (n = 0; bs < be; n++)
+		ban_iter(&bs, &bt);
+	if (n == 0)
+		return;
+	b->test = calloc(n, sizeof *b->test);
+	if (b->test == NULL)
+		return;
+	bs = b->spec + BANS_HEAD_LEN;
+	for (b->ntest = 0; b->ntest < n; b->ntest++)
+		ban_iter(&bs, &b->test[b->ntest]);
+	assert(bs == be);
+}
+
 /*--------------------------------------------------------------------
  * A new object is created, grab a reference to the newest ban
  */
@@ -416,6 +440,7 @@ ban_reload(const uint8_t *ban, unsigned len)
 	b2->spec = malloc(len);
 	AN(b2->spec);
 	memcpy(b2->spec, ban, len);
+	ban_compile(b2);
 	if (ban[BANS_FLAGS] & BANS_FLAG_REQ) {
 		VSC_C_main->bans_req++;
 		b2->flags |= BANS_FLAG_REQ;
@@ -483,16 +508,41 @@ BAN_Time(const struct ban *b)
 }
 
 /*--------------------------------------------------------------------
- * Evaluate ban-spec
+ * Fetch the string a ban test compares against
  */
 
-int
-ban_evaluate(struct worker *wrk, const uint8_t *bsarg, struct objcore *oc,
-    const struct http *reqhttp, unsigned *tests)
+const char *
+ban_field(struct worker *wrk, uint8_t arg1, const char *arg1_spec,
+    struct objcore *oc, const struct http *reqhttp)
 {
-	struct ban_test bt;
-	const uint8_t *bs, *be;
 	const char *p;
+
+	switch (arg1) {
+	case BANS_ARG_URL:
+		AN(reqhttp);
+		return (reqhttp->hd[HTTP_HDR_URL].b);
+	case BANS_ARG_REQHTTP:
+		AN(reqhttp);
+		(void)http_GetHdr(reqhttp, arg1_spec, &p);
+		return (p);
+	case BANS_ARG_OBJHTTP:
+		return (HTTP_GetHdrPack(wrk, oc, arg1_spec));
+	case BANS_ARG_OBJSTATUS:
+		return (HTTP_GetHdrPack(wrk, oc, H__Status));
+	default:
+		WRONG("Wrong BAN_ARG code");
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------
+ * Evaluate a single ban test
+ */
+
+static int
+ban_test_evaluate(struct worker *wrk, const struct ban_test *bt,
+    vtim_real t_ban, struct objcore *oc, const struct http *reqhttp)
+{
 	const char *arg1;
 	double darg1, darg2;
 	int rv;
@@ -506,114 +556,158 @@ ban_evaluate(struct worker *wrk, const uint8_t *bsarg, struct objcore *oc,
 	 * fix a point in time (such as "obj.ttl > 5h && obj.keep > 3h")
 	 */
 
+	arg1 = NULL;
+	darg1 = darg2 = nan("");
+	switch (bt->arg1) {
+	case BANS_ARG_URL:
+	case BANS_ARG_REQHTTP:
+	case BANS_ARG_OBJHTTP:
+	case BANS_ARG_OBJSTATUS:
+		arg1 = ban_field(wrk, bt->arg1, bt->arg1_spec, oc, reqhttp);
+		break;
+	case BANS_ARG_OBJTTL:
+		darg1 = oc->ttl + oc->t_origin;
+		darg2 = bt->arg2_double + t_ban;
+		break;
+	case BANS_ARG_OBJAGE:
+		darg1 = 0.0 - oc->t_origin;
+		darg2 = 0.0 - (t_ban - bt->arg2_double);
+		break;
+	case BANS_ARG_OBJGRACE:
+		darg1 = oc->grace;
+		darg2 = bt->arg2_double;
+		break;
+	case BANS_ARG_OBJKEEP:
+		darg1 = oc->keep;
+		darg2 = bt->arg2_double;
+		break;
+	default:
+		WRONG("Wrong BAN_ARG code");
+	}
+
+	switch (bt->oper) {
+	case BANS_OPER_EQ:
+		if (arg1 == NULL) {
+			if (isnan(darg1) || darg1 != darg2)
+				return (0);
+		} else if (strcmp(arg1, bt->arg2)) {
+			return (0);
+		}
+		break;
+	case BANS_OPER_NEQ:
+		if (arg1 == NULL) {
+			if (! isnan(darg1) && darg1 == darg2)
+				return (0);
+		} else if (!strcmp(arg1, bt->arg2)) {
+			return (0);
+		}
+		break;
+	case BANS_OPER_MATCH:
+		if (arg1 == NULL)
+			return (0);
+		rv = VRE_match(bt->arg2_spec, arg1, 0, 0, NULL);
+		xxxassert(rv >= -1);
+		if (rv < 0)
+			return (0);
+		break;
+	case BANS_OPER_NMATCH:
+		if (arg1 == NULL)
+			return (0);
+		rv = VRE_match(bt->arg2_spec, arg1, 0, 0, NULL);
+		xxxassert(rv >= -1);
+		if (rv >= 0)
+			return (0);
+		break;
+	case BANS_OPER_GT:
+		AZ(arg1);
+		assert(! isnan(darg1));
+		if (!(darg1 > darg2))
+			return (0);
+		break;
+	case BANS_OPER_GTE:
+		AZ(arg1);
+		assert(! isnan(darg1));
+		if (!(darg1 >= darg2))
+			return (0);
+		break;
+	case BANS_OPER_LT:
+		AZ(arg1);
+		assert(! isnan(darg1));
+		if (!(darg1 < darg2))
+			return (0);
+		break;
+	case BANS_OPER_LTE:
+		AZ(arg1);
+		assert(! isnan(darg1));
+		if (!(darg1 <= darg2))
+			return (0);
+		break;
+	default:
+		WRONG("Wrong BAN_OPER code");
+	}
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Evaluate ban-spec
+ */
+
+int
+ban_evaluate(struct worker *wrk, const uint8_t *bsarg, struct objcore *oc,
+    const struct http *reqhttp, unsigned *tests)
+{
+	struct ban_test bt;
+	const uint8_t *bs, *be;
+
 	bs = bsarg;
 	be = bs + ban_len(bs);
 	bs += BANS_HEAD_LEN;
 	while (bs < be) {
 		(*tests)++;
 		ban_iter(&bs, &bt);
-		arg1 = NULL;
-		darg1 = darg2 = nan("");
-		switch (bt.arg1) {
-		case BANS_ARG_URL:
-			AN(reqhttp);
-			arg1 = reqhttp->hd[HTTP_HDR_URL].b;
-			break;
-		case BANS_ARG_REQHTTP:
-			AN(reqhttp);
-			(void)http_GetHdr(reqhttp, bt.arg1_spec, &p);
-			arg1 = p;
-			break;
-		case BANS_ARG_OBJHTTP:
-			arg1 = HTTP_GetHdrPack(wrk, oc, bt.arg1_spec);
-			break;
-		case BANS_ARG_OBJSTATUS:
-			arg1 = HTTP_GetHdrPack(wrk, oc, H__Status);
-			break;
-		case BANS_ARG_OBJTTL:
-			darg1 = oc->ttl + oc->t_origin;
-			darg2 = bt.arg2_double + ban_time(bsarg);
-			break;
-		case BANS_ARG_OBJAGE:
-			darg1 = 0.0 - oc->t_origin;
-			darg2 = 0.0 - (ban_time(bsarg) - bt.arg2_double);
-			break;
-		case BANS_ARG_OBJGRACE:
-			darg1 = oc->grace;
-			darg2 = bt.arg2_double;
-			break;
-		case BANS_ARG_OBJKEEP:
-			darg1 = oc->keep;
-			darg2 = bt.arg2_double;
-			break;
-		default:
-			WRONG("Wrong BAN_ARG code");
-		}
+		if (!ban_test_evaluate(wrk, &bt, ban_time(bsarg), oc, reqhttp))
+			return (0);
+	}
+	return (1);
+}
 
-		switch (bt.oper) {
-		case BANS_OPER_EQ:
-			if (arg1 == NULL) {
-				if (isnan(darg1) || darg1 != darg2)
-					return (0);
-			} else if (strcmp(arg1, bt.arg2)) {
-				return (0);
-			}
-			break;
-		case BANS_OPER_NEQ:
-			if (arg1 == NULL) {
-				if (! isnan(darg1) && darg1 == darg2)
-					return (0);
-			} else if (!strcmp(arg1, bt.arg2)) {
-				return (0);
-			}
-			break;
-		case BANS_OPER_MATCH:
-			if (arg1 == NULL)
-				return (0);
-			rv = VRE_match(bt.arg2_spec, arg1, 0, 0, NULL);
-			xxxassert(rv >= -1);
-			if (rv < 0)
-				return (0);
-			break;
-		case BANS_OPER_NMATCH:
-			if (arg1 == NULL)
-				return (0);
-			rv = VRE_match(bt.arg2_spec, arg1, 0, 0, NULL);
-			xxxassert(rv >= -1);
-			if (rv >= 0)
-				return (0);
-			break;
-		case BANS_OPER_GT:
-			AZ(arg1);
-			assert(! isnan(darg1));
-			if (!(darg1 > darg2))
-				return (0);
-			break;
-		case BANS_OPER_GTE:
-			AZ(arg1);
-			assert(! isnan(darg1));
-			if (!(darg1 >= darg2))
-				return (0);
-			break;
-		case BANS_OPER_LT:
-			AZ(arg1);
-			assert(! isnan(darg1));
-			if (!(darg1 < darg2))
-				return (0);
-			break;
-		case BANS_OPER_LTE:
-			AZ(arg1);
-			assert(! isnan(darg1));
-			if (!(darg1 <= darg2))
-				return (0);
-			break;
-		default:
-			WRONG("Wrong BAN_OPER code");
-		}
+/*--------------------------------------------------------------------
+ * Evaluate a ban using its compiled tests
+ */
+
+int
+ban_match(struct worker *wrk, const struct ban *b, struct objcore *oc,
+    const struct http *reqhttp, unsigned *tests)
+{
+	vtim_real t_ban;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	if (b->test == NULL)
+		return (ban_evaluate(wrk, b->spec, oc, reqhttp, tests));
+	t_ban = ban_time(b->spec);
+	for (u = 0; u < b->ntest; u++) {
+		(*tests)++;
+		if (!ban_test_evaluate(wrk, &b->test[u], t_ban, oc, reqhttp))
+			return (0);
 	}
 	return (1);
 }
 
+/*--------------------------------------------------------------------
+ * Optimistic unlocked check if an object has already been tested
+ * against all bans.  Used where the caller can fall back to
+ * BAN_CheckObject() with the objhead locked.
+ */
+
+int
+BAN_Current(const struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	return (oc->ban != NULL && oc->ban == ban_start);
+}
+
 /*--------------------------------------------------------------------
  * Check an object against all applicable bans
  *
@@ -675,7 +769,7 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 		CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
 		if (b->flags & BANS_FLAG_COMPLETED)
 			continue;
-		if (ban_evaluate(wrk, b->spec, oc, req->http, &tests))
+		if (ban_match(wrk, b, oc, req->http, &tests))
 			break;
 	}
 
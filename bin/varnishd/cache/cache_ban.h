@@ -120,6 +120,15 @@
 
 /*--------------------------------------------------------------------*/
 
+struct ban_test {
+	uint8_t			oper;
+	uint8_t			arg1;
+	const char		*arg1_spec;
+	const char		*arg2;
+	double			arg2_double;
+	const void		*arg2_spec;
+};
+
 struct ban {
 	unsigned		magic;
 #define BAN_MAGIC		0x700b08ea
@@ -130,6 +139,10 @@ struct ban {
 
 	VTAILQ_HEAD(,objcore)	objcore;
 	uint8_t			*spec;
+
+	/* The tests of spec, parsed once, pointing into it */
+	struct ban_test		*test;
+	unsigned		ntest;
 };
 
 VTAILQ_HEAD(banhead_s,ban);
@@ -149,9 +162,25 @@ unsigned ban_len(const uint8_t *banspec);
 void ban_info_new(const uint8_t *ban, unsigned len);
 void ban_info_drop(const uint8_t *ban, unsigned len);
 
+void ban_compile(struct ban *b);
+const char *ban_field(struct worker *wrk, uint8_t arg1, const char *arg1_spec,
+    struct objcore *oc, const struct http *reqhttp);
 int ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
     const struct http *reqhttp, unsigned *tests);
+int ban_match(struct worker *wrk, const struct ban *b, struct objcore *oc,
+    const struct http *reqhttp, unsigned *tests);
 vtim_real ban_time(const uint8_t *banspec);
 int ban_equal(const uint8_t *bs1, const uint8_t *bs2);
 void BAN_Free(struct ban *b);
 void ban_kick_lurker(void);
+
+/* cache_ban_index.c */
+struct ban_idx;
+struct ban_idx *ban_idx_new(void);
+void ban_idx_add(struct ban_idx *bi, struct ban *b);
+unsigned ban_idx_len(const struct ban_idx *bi);
+void ban_idx_ready(struct ban_idx *bi);
+int ban_idx_match(struct worker *wrk, const struct ban_idx *bi,
+    struct objcore *oc, const struct http *reqhttp, unsigned *tested,
+    unsigned *tests);
+void ban_idx_destroy(struct ban_idx **bip);
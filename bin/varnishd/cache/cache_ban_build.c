@@ -356,6 +356,7 @@ BAN_Commit(struct ban_proto *bp)
 	memcpy(b->spec + BANS_HEAD_LEN, VSB_data(bp->vsb), ln);
 	ln += BANS_HEAD_LEN;
 	vbe32enc(b->spec + BANS_LENGTH, ln);
+	ban_compile(b);
 
 	Lck_Lock(&ban_mtx);
 	if (ban_shutdown) {
@@ -0,0 +1,437 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Ban index
+ *
+ * Testing an object against many bans one by one costs a header lookup
+ * and a string compare or regex match per ban.  The index groups bans
+ * by the field (url, req.http.*, obj.http.*, obj.status) of one of
+ * their tests, so each field is fetched once per object and:
+ *
+ *	- "==" tests are looked up in a tree of the compared values
+ *	- "~" tests are combined into alternations of up to BAN_IDX_CHUNK
+ *	  patterns, one match tells if any of them can apply
+ *
+ * Only bans found this way are then evaluated in full, bans without an
+ * indexable test are always evaluated.
+ *
+ * An index is built by the lurker, which owns it but not the bans.
+ * After ban_idx_ready() it is immutable and the lurker helpers use it
+ * read-only through ban_walk.bi and ban_idx_match(), so no per-call
+ * scratch state must be kept in it.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache_varnishd.h"
+#include "cache_ban.h"
+
+#include "vct.h"
+#include "vsb.h"
+#include "vtree.h"
+
+#define BAN_IDX_CHUNK		32
+
+struct ban_idx_list {
+	unsigned		n;
+	unsigned		l;
+	struct ban		**ban;
+};
+
+struct ban_idx_val {
+	unsigned		magic;
+#define BAN_IDX_VAL_MAGIC	0x1c0b7e4d
+	VRBT_ENTRY(ban_idx_val)	entry;
+	const char		*val;
+	struct ban_idx_list	bans;
+};
+
+VRBT_HEAD(ban_idx_vals, ban_idx_val);
+
+struct ban_idx_chunk {
+	unsigned		magic;
+#define BAN_IDX_CHUNK_MAGIC	0x5d3e4a21
+	VTAILQ_ENTRY(ban_idx_chunk)	list;
+	unsigned		dirty;
+	vre_t			*re;
+	unsigned		n;
+	struct ban		*ban[BAN_IDX_CHUNK];
+	const char		*pat[BAN_IDX_CHUNK];
+};
+
+struct ban_idx_field {
+	unsigned		magic;
+#define BAN_IDX_FIELD_MAGIC	0x2e6f0a93
+	VTAILQ_ENTRY(ban_idx_field)	list;
+	uint8_t			arg1;
+	const char		*arg1_spec;
+	struct ban_idx_vals	eq;
+	VTAILQ_HEAD(ban_idx_chunks, ban_idx_chunk)	match;
+};
+
+struct ban_idx {
+	unsigned		magic;
+#define BAN_IDX_MAGIC		0x4b8f13d6
+	unsigned		nban;
+	VTAILQ_HEAD(, ban_idx_field)	fields;
+	struct ban_idx_list	other;
+};
+
+static inline int
+ban_idx_valcmp(const struct ban_idx_val *a, const struct ban_idx_val *b)
+{
+
+	return (strcmp(a->val, b->val));
+}
+
+VRBT_GENERATE_INSERT_COLOR(ban_idx_vals, ban_idx_val, entry, static)
+VRBT_GENERATE_FIND(ban_idx_vals, ban_idx_val, entry, ban_idx_valcmp, static)
+VRBT_GENERATE_INSERT_FINISH(ban_idx_vals, ban_idx_val, entry, static)
+VRBT_GENERATE_INSERT(ban_idx_vals, ban_idx_val, entry, ban_idx_valcmp, static)
+VRBT_GENERATE_REMOVE_COLOR(ban_idx_vals, ban_idx_val, entry, static)
+VRBT_GENERATE_REMOVE(ban_idx_vals, ban_idx_val, entry, static)
+VRBT_GENERATE_MINMAX(ban_idx_vals, ban_idx_val, entry, static)
+VRBT_GENERATE_NEXT(ban_idx_vals, ban_idx_val, entry, static)
+
+/*--------------------------------------------------------------------*/
+
+static void
+ban_idx_push(struct ban_idx_list *bl, struct ban *b)
+{
+	struct ban **p;
+
+	if (bl->n == bl->l) {
+		bl->l = bl->l ? bl->l * 2 : 4;
+		p = realloc(bl->ban, bl->l * sizeof *p);
+		AN(p);
+		bl->ban = p;
+	}
+	bl->ban[bl->n++] = b;
+}
+
+/*--------------------------------------------------------------------
+ * Can this pattern be one branch of an alternation without changing
+ * its meaning?  Back references and group numbers would point into the
+ * other branches, and verbs only work at the start of a pattern.
+ */
+
+static int
+ban_idx_combinable(const char *re)
+{
+	const char *p;
+
+	for (p = re; *p != '\0'; p++) {
+		if (*p == '\\') {
+			p++;
+			if (*p == '\0' || vct_isdigit(*p) ||
+			    *p == 'g' || *p == 'k')
+				return (0);
+			continue;
+		}
+		if (*p != '(')
+			continue;
+		if (p[1] == '*')
+			return (0);
+		if (p[1] != '?')
+			continue;
+		switch (p[2]) {
+		case ':': case '=': case '!': case '>':
+		case 'i': case 'm': case 'n': case 's': case 'x': case '-':
+			break;
+		case '<':
+			if (p[3] != '=' && p[3] != '!')
+				return (0);
+			break;
+		default:
+			return (0);
+		}
+	}
+	return (1);
+}
+
+/*--------------------------------------------------------------------*/
+
+struct ban_idx *
+ban_idx_new(void)
+{
+	struct ban_idx *bi;
+
+	ALLOC_OBJ(bi, BAN_IDX_MAGIC);
+	AN(bi);
+	VTAILQ_INIT(&bi->fields);
+	return (bi);
+}
+
+static struct ban_idx_field *
+ban_idx_field(struct ban_idx *bi, const struct ban_test *bt)
+{
+	struct ban_idx_field *bf;
+
+	VTAILQ_FOREACH(bf, &bi->fields, list) {
+		if (bf->arg1 != bt->arg1)
+			continue;
+		if (bf->arg1_spec == NULL ||
+		    !strcmp(bf->arg1_spec, bt->arg1_spec))
+			return (bf);
+	}
+	ALLOC_OBJ(bf, BAN_IDX_FIELD_MAGIC);
+	AN(bf);
+	bf->arg1 = bt->arg1;
+	bf->arg1_spec = bt->arg1_spec;
+	VRBT_INIT(&bf->eq);
+	VTAILQ_INIT(&bf->match);
+	VTAILQ_INSERT_TAIL(&bi->fields, bf, list);
+	return (bf);
+}
+
+static void
+ban_idx_add_eq(struct ban_idx_field *bf, struct ban *b, const char *val)
+{
+	struct ban_idx_val *bv, needle;
+
+	INIT_OBJ(&needle, BAN_IDX_VAL_MAGIC);
+	needle.val = val;
+	bv = VRBT_FIND(ban_idx_vals, &bf->eq, &needle);
+	if (bv == NULL) {
+		ALLOC_OBJ(bv, BAN_IDX_VAL_MAGIC);
+		AN(bv);
+		bv->val = val;
+		AZ(VRBT_INSERT(ban_idx_vals, &bf->eq, bv));
+	}
+	ban_idx_push(&bv->bans, b);
+}
+
+static void
+ban_idx_add_match(struct ban_idx_field *bf, struct ban *b, const char *pat)
+{
+	struct ban_idx_chunk *bc;
+
+	bc = VTAILQ_LAST(&bf->match, ban_idx_chunks);
+	if (bc == NULL || bc->n == BAN_IDX_CHUNK) {
+		ALLOC_OBJ(bc, BAN_IDX_CHUNK_MAGIC);
+		AN(bc);
+		VTAILQ_INSERT_TAIL(&bf->match, bc, list);
+	}
+	bc->ban[bc->n] = b;
+	bc->pat[bc->n] = pat;
+	bc->n++;
+	bc->dirty = 1;
+}
+
+/*--------------------------------------------------------------------
+ * Add a ban, indexed on its first "==" test on a string field, or
+ * else on its first combinable "~" test.
+ */
+
+void
+ban_idx_add(struct ban_idx *bi, struct ban *b)
+{
+	const struct ban_test *bt, *eq = NULL, *match = NULL;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(bi, BAN_IDX_MAGIC);
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+
+	bi->nban++;
+	for (u = 0; u < b->ntest && eq == NULL; u++) {
+		bt = &b->test[u];
+		switch (bt->arg1) {
+		case BANS_ARG_URL:
+		case BANS_ARG_REQHTTP:
+		case BANS_ARG_OBJHTTP:
+		case BANS_ARG_OBJSTATUS:
+			break;
+		default:
+			continue;
+		}
+		if (bt->oper == BANS_OPER_EQ)
+			eq = bt;
+		else if (bt->oper == BANS_OPER_MATCH && match == NULL &&
+		    ban_idx_combinable(bt->arg2))
+			match = bt;
+	}
+	if (eq != NULL)
+		ban_idx_add_eq(ban_idx_field(bi, eq), b, eq->arg2);
+	else if (match != NULL)
+		ban_idx_add_match(ban_idx_field(bi, match), b, match->arg2);
+	else
+		ban_idx_push(&bi->other, b);
+}
+
+unsigned
+ban_idx_len(const struct ban_idx *bi)
+{
+
+	CHECK_OBJ_NOTNULL(bi, BAN_IDX_MAGIC);
+	return (bi->nban);
+}
+
+/*--------------------------------------------------------------------
+ * (Re)compile the alternations of chunks which got new patterns.  A
+ * chunk which does not compile is evaluated ban by ban.
+ */
+
+void
+ban_idx_ready(struct ban_idx *bi)
+{
+	struct ban_idx_field *bf;
+	struct ban_idx_chunk *bc;
+	struct vsb *vsb;
+	int err, erroff;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(bi, BAN_IDX_MAGIC);
+	vsb = NULL;
+	VTAILQ_FOREACH(bf, &bi->fields, list) {
+		VTAILQ_FOREACH(bc, &bf->match, list) {
+			if (!bc->dirty)
+				continue;
+			bc->dirty = 0;
+			if (bc->re != NULL)
+				VRE_free(&bc->re);
+			if (vsb == NULL) {
+				vsb = VSB_new_auto();
+				AN(vsb);
+			}
+			VSB_clear(vsb);
+			for (u = 0; u < bc->n; u++)
+				VSB_printf(vsb, "%s(?:%s)",
+				    u ? "|" : "", bc->pat[u]);
+			AZ(VSB_finish(vsb));
+			bc->re = VRE_compile(VSB_data(vsb), 0, &err, &erroff, 1);
+		}
+	}
+	if (vsb != NULL)
+		VSB_destroy(&vsb);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int
+ban_idx_eval(struct worker *wrk, const struct ban_idx_list *bl,
+    struct objcore *oc, const struct http *reqhttp, unsigned *tested,
+    unsigned *tests)
+{
+	unsigned u;
+
+	for (u = 0; u < bl->n; u++) {
+		if (bl->ban[u]->flags & BANS_FLAG_COMPLETED)
+			continue;
+		(*tested)++;
+		if (ban_match(wrk, bl->ban[u], oc, reqhttp, tests))
+			return (1);
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Does any ban in the index match the object?  Every lookup and every
+ * alternation matched is counted as a ban and a test tested.  Tests on
+ * the request need reqhttp.
+ */
+
+int
+ban_idx_match(struct worker *wrk, const struct ban_idx *bi,
+    struct objcore *oc, const struct http *reqhttp, unsigned *tested,
+    unsigned *tests)
+{
+	struct ban_idx_field *bf;
+	struct ban_idx_chunk *bc;
+	struct ban_idx_val *bv, needle;
+	struct ban_idx_list bl;
+	const char *s;
+	int rv;
+
+	CHECK_OBJ_NOTNULL(bi, BAN_IDX_MAGIC);
+	AN(tested);
+	AN(tests);
+
+	INIT_OBJ(&needle, BAN_IDX_VAL_MAGIC);
+	VTAILQ_FOREACH(bf, &bi->fields, list) {
+		s = ban_field(wrk, bf->arg1, bf->arg1_spec, oc, reqhttp);
+		/* Neither "==" nor "~" on a missing field can match */
+		if (s == NULL)
+			continue;
+		if (!VRBT_EMPTY(&bf->eq)) {
+			(*tested)++;
+			(*tests)++;
+			needle.val = s;
+			bv = VRBT_FIND(ban_idx_vals, &bf->eq, &needle);
+			if (bv != NULL && ban_idx_eval(wrk, &bv->bans, oc,
+			    reqhttp, tested, tests))
+				return (1);
+		}
+		VTAILQ_FOREACH(bc, &bf->match, list) {
+			AZ(bc->dirty);
+			if (bc->re != NULL) {
+				(*tested)++;
+				(*tests)++;
+				rv = VRE_match(bc->re, s, 0, 0, NULL);
+				if (rv == VRE_ERROR_NOMATCH)
+					continue;
+			}
+			bl.n = bl.l = bc->n;
+			bl.ban = bc->ban;
+			if (ban_idx_eval(wrk, &bl, oc, reqhttp, tested, tests))
+				return (1);
+		}
+	}
+	return (ban_idx_eval(wrk, &bi->other, oc, reqhttp, tested, tests));
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+ban_idx_destroy(struct ban_idx **bip)
+{
+	struct ban_idx *bi;
+	struct ban_idx_field *bf, *bf2;
+	struct ban_idx_chunk *bc, *bc2;
+	struct ban_idx_val *bv, *bv2;
+
+	TAKE_OBJ_NOTNULL(bi, bip, BAN_IDX_MAGIC);
+	VTAILQ_FOREACH_SAFE(bf, &bi->fields, list, bf2) {
+		CHECK_OBJ(bf, BAN_IDX_FIELD_MAGIC);
+		VRBT_FOREACH_SAFE(bv, ban_idx_vals, &bf->eq, bv2) {
+			CHECK_OBJ(bv, BAN_IDX_VAL_MAGIC);
+			VRBT_REMOVE(ban_idx_vals, &bf->eq, bv);
+			free(bv->bans.ban);
+			FREE_OBJ(bv);
+		}
+		VTAILQ_FOREACH_SAFE(bc, &bf->match, list, bc2) {
+			CHECK_OBJ(bc, BAN_IDX_CHUNK_MAGIC);
+			if (bc->re != NULL)
+				VRE_free(&bc->re);
+			FREE_OBJ(bc);
+		}
+		FREE_OBJ(bf);
+	}
+	free(bi->other.ban);
+	FREE_OBJ(bi);
+}
@@ -32,6 +32,8 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "cache_varnishd.h"
 
 #include "cache_ban.h"
@@ -39,11 +41,46 @@
 
 #include "vtim.h"
 
+#include "VSC_lurker.h"
+
+/*
+ * With ban_lurker_threads > 1, the ban lurker thread has helpers, and
+ * they share the walk of each ban's list of objects: every thread takes
+ * objects off the head of the list until it is exhausted.  The ban
+ * lurker thread sets up each walk, and the markers, while the helpers
+ * wait, and completes bans once they are done.
+ */
+
+struct ban_lurker_priv {
+	unsigned		magic;
+#define BAN_LURKER_PRIV_MAGIC	0x3c1e5a97
+	unsigned		batch;
+	pthread_t		thread;
+	struct VSC_lurker	*stats;
+	struct vsc_seg		*vsc_seg;
+};
+
+struct ban_walk {
+	unsigned		gen;
+	unsigned		busy;	/* helpers still walking */
+	int			done;
+	struct ban		*bt;
+	struct ban		*bd;
+	struct banhead_s	*obans;
+	const struct ban_idx	*bi;
+	int			kill;
+};
+
 static struct objcore oc_mark_cnt = { .magic = OBJCORE_MAGIC, };
 static struct objcore oc_mark_end = { .magic = OBJCORE_MAGIC, };
-static unsigned ban_batch;
 static unsigned ban_generation;
 
+static struct ban_lurker_priv *lurkers;
+static unsigned n_lurkers;
+static struct ban_walk ban_walk;
+static pthread_cond_t ban_walk_cond;
+static pthread_cond_t ban_walk_done_cond;
+
 pthread_cond_t	ban_lurker_cond;
 
 void
@@ -137,25 +174,31 @@ ban_cleantail(struct banhead_s *obans)
  */
 
 static struct objcore *
-ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
+ban_lurker_getfirst(struct ban_lurker_priv *lw, struct vsl_log *vsl,
+    struct ban *bt)
 {
 	struct objhead *oh;
 	struct objcore *oc, *noc;
 	int move_oc = 1;
 
+	CHECK_OBJ_NOTNULL(lw, BAN_LURKER_PRIV_MAGIC);
 	Lck_Lock(&ban_mtx);
 
 	oc = VTAILQ_FIRST(&bt->objcore);
 	while (1) {
+		if (ban_shutdown)
+			ban_walk.done = 1;
+		if (ban_walk.done) {
+			/* Another thread found the list exhausted */
+			oc = NULL;
+			break;
+		}
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
 		if (oc == &oc_mark_cnt) {
 			if (VTAILQ_NEXT(oc, ban_list) == &oc_mark_end) {
 				/* done with this ban's oc list */
-				VTAILQ_REMOVE(&bt->objcore, &oc_mark_cnt,
-				    ban_list);
-				VTAILQ_REMOVE(&bt->objcore, &oc_mark_end,
-				    ban_list);
+				ban_walk.done = 1;
 				oc = NULL;
 				break;
 			}
@@ -167,6 +210,7 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 
 			/* hold off to give lookup a chance and reiterate */
 			VSC_C_main->bans_lurker_contention++;
+			lw->stats->contention++;
 			Lck_Unlock(&ban_mtx);
 			VSL_Flush(vsl, 0);
 			VTIM_sleep(cache_param->ban_lurker_holdoff);
@@ -206,7 +250,7 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 				 * dismantled under our feet - grab a ref
 				 */
 				AZ(oc->flags & OC_F_BUSY);
-				oc->refcnt += 1;
+				OC_REFCNT_INC(oc);
 				VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
 				VTAILQ_INSERT_TAIL(&bt->objcore, oc, ban_list);
 				Lck_Unlock(&oh->mtx);
@@ -228,37 +272,38 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 	return (oc);
 }
 
+/*--------------------------------------------------------------------
+ * Test the objects of the walk, in any number of threads at once
+ */
+
 static void
-ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
-    struct banhead_s *obans, struct ban *bd, int kill)
+ban_lurker_walk(struct worker *wrk, struct vsl_log *vsl,
+    struct ban_lurker_priv *lw)
 {
-	struct ban *bl, *bln;
+	struct ban *bl, *bt, *bd;
+	struct banhead_s *obans;
+	const struct ban_idx *bi;
 	struct objcore *oc;
-	unsigned tests;
-	int i;
-	uint64_t tested = 0, tested_tests = 0, lok = 0, lokc = 0;
+	unsigned tests, u;
+	int i, kill;
+	uint64_t objects = 0, tested = 0, tested_tests = 0;
+	uint64_t lok = 0, lokc = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(lw, BAN_LURKER_PRIV_MAGIC);
 
-	/*
-	 * First see if there is anything to do, and if so, insert markers
-	 */
-	Lck_Lock(&ban_mtx);
-	oc = VTAILQ_FIRST(&bt->objcore);
-	if (oc != NULL) {
-		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_cnt, ban_list);
-		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_end, ban_list);
-	}
-	Lck_Unlock(&ban_mtx);
-	if (oc == NULL)
-		return;
+	bt = ban_walk.bt;
+	bd = ban_walk.bd;
+	obans = ban_walk.obans;
+	bi = ban_walk.bi;
+	kill = ban_walk.kill;
 
 	while (1) {
-		if (++ban_batch > cache_param->ban_lurker_batch) {
+		if (++lw->batch > cache_param->ban_lurker_batch) {
 			VTIM_sleep(cache_param->ban_lurker_sleep);
-			ban_batch = 0;
+			lw->batch = 0;
 		}
-		oc = ban_lurker_getfirst(vsl, bt);
+		oc = ban_lurker_getfirst(lw, vsl, bt);
 		if (oc == NULL) {
 			if (tested == 0 && lokc == 0) {
 				AZ(tested_tests);
@@ -271,10 +316,32 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			VSC_C_main->bans_lurker_obj_killed += lok;
 			VSC_C_main->bans_lurker_obj_killed_cutoff += lokc;
 			Lck_Unlock(&ban_mtx);
+			lw->stats->objects += objects;
+			lw->stats->tested += tested;
+			lw->stats->tests_tested += tested_tests;
+			lw->stats->obj_killed += lok;
+			lw->stats->obj_killed_cutoff += lokc;
 			return;
 		}
+		objects++;
 		i = 0;
-		VTAILQ_FOREACH_REVERSE_SAFE(bl, obans, banhead_s, l_list, bln) {
+		if (bi != NULL && oc->ban == bt) {
+			u = tests = 0;
+			i = ban_idx_match(wrk, bi, oc, NULL, &u, &tests);
+			tested += u;
+			tested_tests += tests;
+			if (i) {
+				VSLb(vsl, SLT_ExpBan, "%ju banned by lurker",
+				    VXID(ObjGetXID(wrk, oc)));
+				lok++;
+				HSH_Kill(oc);
+			}
+		}
+		VTAILQ_FOREACH_REVERSE(bl, obans, banhead_s, l_list) {
+			if (bi != NULL) {
+				/* Tested against the index above */
+				break;
+			}
 			if (oc->ban != bt) {
 				/*
 				 * HSH_Lookup() grabbed this oc, killed
@@ -284,7 +351,6 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			}
 			if (bl->flags & BANS_FLAG_COMPLETED) {
 				/* Ban was overtaken by new (dup) ban */
-				VTAILQ_REMOVE(obans, bl, l_list);
 				continue;
 			}
 			if (kill == 1)
@@ -292,8 +358,7 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			else {
 				AZ(bl->flags & BANS_FLAG_REQ);
 				tests = 0;
-				i = ban_evaluate(wrk, bl->spec, oc, NULL,
-				    &tests);
+				i = ban_match(wrk, bl, oc, NULL, &tests);
 				tested++;
 				tested_tests += tests;
 			}
@@ -319,7 +384,12 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			VSC_C_main->bans_lurker_tests_tested += tested_tests;
 			VSC_C_main->bans_lurker_obj_killed += lok;
 			VSC_C_main->bans_lurker_obj_killed_cutoff += lokc;
-			tested = tested_tests = lok = lokc = 0;
+			lw->stats->objects += objects;
+			lw->stats->tested += tested;
+			lw->stats->tests_tested += tested_tests;
+			lw->stats->obj_killed += lok;
+			lw->stats->obj_killed_cutoff += lokc;
+			objects = tested = tested_tests = lok = lokc = 0;
 			if (oc->ban == bt && bt != bd) {
 				bt->refcount--;
 				VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
@@ -336,6 +406,69 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 	}
 }
 
+static void
+ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
+    struct banhead_s *obans, struct ban_idx *bi, struct ban *bd, int kill)
+{
+	struct ban *bl, *bln;
+	struct objcore *oc;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+
+	/*
+	 * First see if there is anything to do, and if so, insert markers
+	 */
+	Lck_Lock(&ban_mtx);
+	oc = VTAILQ_FIRST(&bt->objcore);
+	if (oc != NULL) {
+		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_cnt, ban_list);
+		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_end, ban_list);
+	}
+	Lck_Unlock(&ban_mtx);
+	if (oc == NULL)
+		return;
+
+	/* Bans overtaken by new (dup) bans need no testing */
+	VTAILQ_FOREACH_SAFE(bl, obans, l_list, bln)
+		if (bl->flags & BANS_FLAG_COMPLETED)
+			VTAILQ_REMOVE(obans, bl, l_list);
+
+	/* Few bans are cheaper to test one by one */
+	if (kill || cache_param->ban_lurker_index == 0 ||
+	    ban_idx_len(bi) < cache_param->ban_lurker_index)
+		bi = NULL;
+	else
+		ban_idx_ready(bi);
+
+	Lck_Lock(&ban_mtx);
+	ban_walk.bt = bt;
+	ban_walk.bd = bd;
+	ban_walk.obans = obans;
+	ban_walk.bi = bi;
+	ban_walk.kill = kill;
+	ban_walk.done = 0;
+	ban_walk.busy = n_lurkers - 1;
+	ban_walk.gen++;
+	if (ban_walk.busy > 0)
+		PTOK(pthread_cond_broadcast(&ban_walk_cond));
+	Lck_Unlock(&ban_mtx);
+
+	ban_lurker_walk(wrk, vsl, &lurkers[0]);
+
+	Lck_Lock(&ban_mtx);
+	while (ban_walk.busy > 0) {
+		if (ban_shutdown) {
+			/* Helpers stop at their next object */
+			ban_walk.done = 1;
+		}
+		(void)Lck_CondWait(&ban_walk_done_cond, &ban_mtx);
+	}
+	AN(ban_walk.done);
+	VTAILQ_REMOVE(&bt->objcore, &oc_mark_cnt, ban_list);
+	VTAILQ_REMOVE(&bt->objcore, &oc_mark_end, ban_list);
+	Lck_Unlock(&ban_mtx);
+}
+
 /*--------------------------------------------------------------------
  * Ban lurker thread:
  *
@@ -351,6 +484,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 {
 	struct ban *b, *bd;
 	struct banhead_s obans;
+	struct ban_idx *bi;
 	vtim_real d;
 	vtim_dur dt, n;
 	unsigned count = 0, cutoff = UINT_MAX;
@@ -371,9 +505,10 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 	d = VTIM_real() - cache_param->ban_lurker_age;
 	bd = NULL;
 	VTAILQ_INIT(&obans);
+	bi = ban_idx_new();
 	for (; b != NULL; b = VTAILQ_NEXT(b, list), count++) {
 		if (bd != NULL)
-			ban_lurker_test_ban(wrk, vsl, b, &obans, bd,
+			ban_lurker_test_ban(wrk, vsl, b, &obans, bi, bd,
 			    count > cutoff ? 1 : 0);
 		if (b->flags & BANS_FLAG_COMPLETED)
 			continue;
@@ -385,6 +520,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 		n = ban_time(b->spec) - d;
 		if (n < 0) {
 			VTAILQ_INSERT_TAIL(&obans, b, l_list);
+			ban_idx_add(bi, b);
 			if (bd == NULL)
 				bd = b;
 		} else if (n < dt) {
@@ -397,6 +533,11 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 	 * If any bans to be completed remain after the tail is cut,
 	 * mark them completed
 	 */
+	ban_idx_destroy(&bi);
+	if (ban_shutdown) {
+		/* Walks were cut short, so nothing was completed */
+		return (dt);
+	}
 	ban_cleantail(&obans);
 
 	if (VTAILQ_FIRST(&obans) == NULL)
@@ -409,17 +550,103 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 	return (dt);
 }
 
+/*--------------------------------------------------------------------
+ * Helper threads join the walks the ban lurker thread sets up
+ */
+
+static void * v_matchproto_(bgthread_t)
+ban_lurker_helper(struct worker *wrk, void *priv)
+{
+	struct ban_lurker_priv *lw;
+	struct vsl_log vsl;
+	unsigned gen = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(lw, priv, BAN_LURKER_PRIV_MAGIC);
+
+	VSL_Setup(&vsl, NULL, 0);
+
+	Lck_Lock(&ban_mtx);
+	while (1) {
+		/*
+		 * The lurker counted us in for a walk it started, so even
+		 * when shutting down we have to join it, which ends right
+		 * away, to let it go on.
+		 */
+		if (gen == ban_walk.gen) {
+			if (ban_shutdown)
+				break;
+			(void)Lck_CondWait(&ban_walk_cond, &ban_mtx);
+			continue;
+		}
+		gen = ban_walk.gen;
+		Lck_Unlock(&ban_mtx);
+		ban_lurker_walk(wrk, &vsl, lw);
+		Pool_Sumstat(wrk);
+		Lck_Lock(&ban_mtx);
+		AN(ban_walk.busy);
+		if (--ban_walk.busy == 0)
+			PTOK(pthread_cond_signal(&ban_walk_done_cond));
+	}
+	Lck_Unlock(&ban_mtx);
+	pthread_exit(0);
+	NEEDLESS(return (NULL));
+}
+
+static void
+ban_lurker_init(void)
+{
+	struct ban_lurker_priv *lw;
+	unsigned u;
+
+	PTOK(pthread_cond_init(&ban_walk_cond, NULL));
+	PTOK(pthread_cond_init(&ban_walk_done_cond, NULL));
+
+	n_lurkers = cache_param->ban_lurker_threads;
+	assert(n_lurkers > 0);
+	lurkers = calloc(n_lurkers, sizeof *lurkers);
+	AN(lurkers);
+
+	for (u = 0; u < n_lurkers; u++) {
+		lw = &lurkers[u];
+		INIT_OBJ(lw, BAN_LURKER_PRIV_MAGIC);
+		lw->stats = VSC_lurker_New(NULL, &lw->vsc_seg, "%u", u);
+		AN(lw->stats);
+		if (u > 0)
+			WRK_BgThread(&lw->thread, "ban-lurker", ban_lurker_helper,
+			    lw);
+	}
+}
+
+static void
+ban_lurker_fini(void)
+{
+	void *status;
+	unsigned u;
+
+	Lck_Lock(&ban_mtx);
+	AN(ban_shutdown);
+	PTOK(pthread_cond_broadcast(&ban_walk_cond));
+	Lck_Unlock(&ban_mtx);
+
+	for (u = 1; u < n_lurkers; u++) {
+		PTOK(pthread_join(lurkers[u].thread, &status));
+		AZ(status);
+	}
+}
+
 void * v_matchproto_(bgthread_t)
 ban_lurker(struct worker *wrk, void *priv)
 {
 	struct vsl_log vsl;
 	vtim_dur dt;
-	unsigned gen = ban_generation + 1;
+	unsigned u, gen = ban_generation + 1;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AZ(priv);
 
 	VSL_Setup(&vsl, NULL, 0);
+	ban_lurker_init();
 
 	while (!ban_shutdown) {
 		dt = ban_lurker_work(wrk, &vsl);
@@ -430,11 +657,13 @@ ban_lurker(struct worker *wrk, void *priv)
 			Pool_Sumstat(wrk);
 			(void)Lck_CondWaitTimeout(
 			    &ban_lurker_cond, &ban_mtx, dt);
-			ban_batch = 0;
+			for (u = 0; u < n_lurkers; u++)
+				lurkers[u].batch = 0;
 		}
 		gen = ban_generation;
 		Lck_Unlock(&ban_mtx);
 	}
+	ban_lurker_fini();
 	pthread_exit(0);
 	NEEDLESS(return (NULL));
 }
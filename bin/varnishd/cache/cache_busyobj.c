@@ -163,7 +163,7 @@ VBO_ReleaseBusyObj(struct worker *wrk, struct busyobj **pbo)
 	AZ(bo->htc);
 	AZ(bo->stale_oc);
 
-	VSLb(bo->vsl, SLT_BereqAcct, "%ju %ju %ju %ju %ju %ju",
+	VSLb_uint(bo->vsl, SLT_BereqAcct, 6,
 	    (uintmax_t)bo->acct.bereq_hdrbytes,
 	    (uintmax_t)bo->acct.bereq_bodybytes,
 	    (uintmax_t)(bo->acct.bereq_hdrbytes + bo->acct.bereq_bodybytes),
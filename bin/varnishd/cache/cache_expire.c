@@ -30,10 +30,17 @@
  *
  * LRU and object timer handling.
  *
+ * Objects are partitioned over expiry_threads instances, each with its
+ * own inbox, binary heap and thread.  The partition is chosen by the
+ * address of the objcore, so an objcore always stays with the same one.
+ *
+ * With expiry_wheel set, a hierarchical timing wheel of that resolution
+ * replaces the binary heap.
  */
 
 #include "config.h"
 
+#include <math.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
@@ -41,6 +48,9 @@
 
 #include "vbh.h"
 #include "vtim.h"
+#include "vtw.h"
+
+#include "VSC_exp.h"
 
 struct exp_priv {
 	unsigned			magic;
@@ -49,17 +59,35 @@ struct exp_priv {
 	struct lock			mtx;
 	VSTAILQ_HEAD(,objcore)		inbox;
 	pthread_cond_t			condvar;
+	struct VSC_exp			*stats;
+	struct vsc_seg			*vsc_seg;
 
 	/* owned by exp thread */
 	struct worker			*wrk;
 	struct vsl_log			vsl;
 	struct vbh			*heap;
+	struct vtw			*wheel;
 	pthread_t			thread;
 };
 
 static struct exp_priv *exphdl;
+static unsigned exp_nhdl;
 static int exp_shutdown = 0;
 
+static struct exp_priv *
+exp_hdl(const struct objcore *oc)
+{
+	uint64_t u;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(exphdl);
+	if (exp_nhdl == 1)
+		return (exphdl);
+	u = (uintptr_t)oc;
+	u *= 0x9e3779b97f4a7c15ULL;
+	return (&exphdl[(u >> 32) % exp_nhdl]);
+}
+
 /*--------------------------------------------------------------------
  * Calculate an object's effective ttl time, taking req.ttl into account
  * if it is available.
@@ -101,26 +129,28 @@ EXP_Ttl_grace(const struct req *req, const struct objcore *oc)
  */
 
 static void
-exp_mail_it(struct objcore *oc, uint8_t cmds)
+exp_mail_it(struct exp_priv *ep, struct objcore *oc, uint8_t cmds)
 {
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
 	AZ(cmds & OC_EF_REFD);
 
-	Lck_AssertHeld(&exphdl->mtx);
+	Lck_AssertHeld(&ep->mtx);
 
 	if (oc->exp_flags & OC_EF_REFD) {
 		if (!(oc->exp_flags & OC_EF_POSTED)) {
 			if (cmds & OC_EF_REMOVE)
-				VSTAILQ_INSERT_HEAD(&exphdl->inbox,
+				VSTAILQ_INSERT_HEAD(&ep->inbox,
 				    oc, exp_list);
 			else
-				VSTAILQ_INSERT_TAIL(&exphdl->inbox,
+				VSTAILQ_INSERT_TAIL(&ep->inbox,
 				    oc, exp_list);
 			VSC_C_main->exp_mailed++;
+			ep->stats->mailed++;
 		}
 		oc->exp_flags |= cmds | OC_EF_POSTED;
-		PTOK(pthread_cond_signal(&exphdl->condvar));
+		PTOK(pthread_cond_signal(&ep->condvar));
 	}
 }
 
@@ -138,7 +168,7 @@ EXP_RefNewObjcore(struct objcore *oc)
 
 	AZ(oc->exp_flags);
 	assert(oc->refcnt >= 1);
-	oc->refcnt++;
+	OC_REFCNT_INC(oc);
 	oc->exp_flags |= OC_EF_REFD | OC_EF_NEW;
 }
 
@@ -151,12 +181,14 @@ EXP_RefNewObjcore(struct objcore *oc)
 void
 EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 {
+	struct exp_priv *ep;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_ORNULL(new_oc, OBJCORE_MAGIC);
 
 	if (oc->exp_flags & OC_EF_REFD) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_hdl(oc);
+		Lck_Lock(&ep->mtx);
 		if (new_oc != NULL)
 			VSC_C_main->n_superseded++;
 		if (oc->exp_flags & OC_EF_NEW) {
@@ -166,8 +198,8 @@ EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 			AZ(oc->exp_flags & OC_EF_POSTED);
 			oc->exp_flags |= OC_EF_REMOVE;
 		} else
-			exp_mail_it(oc, OC_EF_REMOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_REMOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
@@ -181,6 +213,7 @@ void
 EXP_Insert(struct worker *wrk, struct objcore *oc)
 {
 	unsigned remove_race = 0;
+	struct exp_priv *ep;
 	struct objcore *tmpoc;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -197,7 +230,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 
 	ObjSendEvent(wrk, oc, OEV_INSERT);
 
-	Lck_Lock(&exphdl->mtx);
+	ep = exp_hdl(oc);
+	Lck_Lock(&ep->mtx);
 	AN(oc->exp_flags & OC_EF_NEW);
 	oc->exp_flags &= ~OC_EF_NEW;
 	AZ(oc->exp_flags & (OC_EF_INSERT | OC_EF_MOVE | OC_EF_POSTED));
@@ -206,8 +240,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 		remove_race = 1;
 		oc->exp_flags &= ~(OC_EF_REFD | OC_EF_REMOVE);
 	} else
-		exp_mail_it(oc, OC_EF_INSERT | OC_EF_MOVE);
-	Lck_Unlock(&exphdl->mtx);
+		exp_mail_it(ep, oc, OC_EF_INSERT | OC_EF_MOVE);
+	Lck_Unlock(&ep->mtx);
 
 	if (remove_race) {
 		ObjSendEvent(wrk, oc, OEV_EXPIRE);
@@ -250,6 +284,7 @@ void
 EXP_Rearm(struct objcore *oc, vtim_real now,
     vtim_dur ttl, vtim_dur grace, vtim_dur keep)
 {
+	struct exp_priv *ep;
 	vtim_real when;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -271,17 +306,35 @@ EXP_Rearm(struct objcore *oc, vtim_real now,
 	    oc->timer_when, when, oc->flags);
 
 	if (when < oc->t_origin || when < oc->timer_when) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_hdl(oc);
+		Lck_Lock(&ep->mtx);
 		if (oc->exp_flags & OC_EF_NEW) {
 			/* EXP_Insert has not been called yet, do nothing
 			 * as the initial insert will execute the move
 			 * operation. */
 		} else
-			exp_mail_it(oc, OC_EF_MOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_MOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Remove an objcore from the heap or wheel
+ */
+
+static void
+exp_delete(struct exp_priv *ep, struct objcore *oc)
+{
+
+	assert(oc->timer_idx != VBH_NOIDX);
+	if (ep->wheel != NULL)
+		VTW_delete(ep->wheel, oc->timer_idx);
+	else
+		VBH_delete(ep->heap, oc->timer_idx);
+	assert(oc->timer_idx == VBH_NOIDX);
+	ep->stats->g_objects--;
+}
+
 /*--------------------------------------------------------------------
  * Handle stuff in the inbox
  */
@@ -299,8 +352,7 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 
 	if (flags & OC_EF_REMOVE) {
 		if (!(flags & OC_EF_INSERT)) {
-			assert(oc->timer_idx != VBH_NOIDX);
-			VBH_delete(ep->heap, oc->timer_idx);
+			exp_delete(ep, oc);
 		}
 		assert(oc->timer_idx == VBH_NOIDX);
 		assert(oc->refcnt > 0);
@@ -329,11 +381,18 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 
 	if (flags & OC_EF_INSERT) {
 		assert(oc->timer_idx == VBH_NOIDX);
-		VBH_insert(exphdl->heap, oc);
+		if (ep->wheel != NULL)
+			VTW_insert(ep->wheel, oc, oc->timer_when);
+		else
+			VBH_insert(ep->heap, oc);
 		assert(oc->timer_idx != VBH_NOIDX);
+		ep->stats->g_objects++;
 	} else if (flags & OC_EF_MOVE) {
 		assert(oc->timer_idx != VBH_NOIDX);
-		VBH_reorder(exphdl->heap, oc->timer_idx);
+		if (ep->wheel != NULL)
+			VTW_reorder(ep->wheel, oc->timer_idx, oc->timer_when);
+		else
+			VBH_reorder(ep->heap, oc->timer_idx);
 		assert(oc->timer_idx != VBH_NOIDX);
 	} else {
 		WRONG("Objcore state wrong in inbox");
@@ -341,19 +400,28 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 }
 
 /*--------------------------------------------------------------------
- * Expire stuff from the binheap
+ * Expire stuff from the binheap or wheel
  */
 
 static vtim_real
 exp_expire(struct exp_priv *ep, vtim_real now)
 {
 	struct objcore *oc;
+	vtim_real t;
 
 	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 
-	oc = VBH_root(ep->heap);
-	if (oc == NULL)
-		return (now + 355. / 113.);
+	if (ep->wheel != NULL) {
+		oc = VTW_due(ep->wheel, now);
+		if (oc == NULL) {
+			t = VTW_next(ep->wheel);
+			return (isnan(t) ? now + 355. / 113. : t);
+		}
+	} else {
+		oc = VBH_root(ep->heap);
+		if (oc == NULL)
+			return (now + 355. / 113.);
+	}
 	VSLb(&ep->vsl, SLT_ExpKill, "EXP_Inspect p=%p e=%.6f f=0x%x", oc,
 	    oc->timer_when - now, oc->flags);
 
@@ -366,6 +434,7 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 	VSC_C_main->n_expired++;
 
 	Lck_Lock(&ep->mtx);
+	ep->stats->expired++;
 	if (oc->exp_flags & OC_EF_POSTED) {
 		oc->exp_flags |= OC_EF_REMOVE;
 		oc = NULL;
@@ -377,10 +446,8 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 		if (!(oc->flags & OC_F_DYING))
 			HSH_Kill(oc);
 
-		/* Remove from binheap */
-		assert(oc->timer_idx != VBH_NOIDX);
-		VBH_delete(ep->heap, oc->timer_idx);
-		assert(oc->timer_idx == VBH_NOIDX);
+		/* Remove from binheap or wheel */
+		exp_delete(ep, oc);
 
 		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 		VSLb(&ep->vsl, SLT_ExpKill, "EXP_Expired x=%ju t=%.0f h=%jd",
@@ -429,8 +496,14 @@ exp_thread(struct worker *wrk, void *priv)
 	CAST_OBJ_NOTNULL(ep, priv, EXP_PRIV_MAGIC);
 	ep->wrk = wrk;
 	VSL_Setup(&ep->vsl, NULL, 0);
-	ep->heap = VBH_new(NULL, object_cmp, object_update);
-	AN(ep->heap);
+	if (cache_param->expiry_wheel > 0.) {
+		ep->wheel = VTW_new(NULL, object_update,
+		    cache_param->expiry_wheel, VTIM_real());
+		AN(ep->wheel);
+	} else {
+		ep->heap = VBH_new(NULL, object_cmp, object_update);
+		AN(ep->heap);
+	}
 	while (exp_shutdown == 0) {
 
 		Lck_Lock(&ep->mtx);
@@ -440,6 +513,7 @@ exp_thread(struct worker *wrk, void *priv)
 			assert(oc->refcnt >= 1);
 			VSTAILQ_REMOVE(&ep->inbox, oc, objcore, exp_list);
 			VSC_C_main->exp_received++;
+			ep->stats->received++;
 			tnext = 0;
 			flags = oc->exp_flags;
 			if (flags & OC_EF_REMOVE)
@@ -455,10 +529,16 @@ exp_thread(struct worker *wrk, void *priv)
 
 		t = VTIM_real();
 
-		if (oc != NULL)
+		if (oc != NULL) {
 			exp_inbox(ep, oc, flags, t);
-		else
+		} else {
 			tnext = exp_expire(ep, t);
+			if (ep == exphdl) {
+				/* Check on the admission filters every second */
+				STV_AgeLRU();
+				tnext = vmin_t(vtim_real, tnext, t + 1.);
+			}
+		}
 	}
 	return (NULL);
 }
@@ -470,33 +550,49 @@ EXP_Init(void)
 {
 	struct exp_priv *ep;
 	pthread_t pt;
-
-	ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
-	AN(ep);
-
-	Lck_New(&ep->mtx, lck_exp);
-	PTOK(pthread_cond_init(&ep->condvar, NULL));
-	VSTAILQ_INIT(&ep->inbox);
-	WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
-	ep->thread = pt;
-	exphdl = ep;
+	unsigned u;
+
+	AZ(exphdl);
+	exp_nhdl = cache_param->expiry_threads;
+	assert(exp_nhdl > 0);
+	exphdl = calloc(exp_nhdl, sizeof *exphdl);
+	AN(exphdl);
+
+	for (u = 0; u < exp_nhdl; u++) {
+		ep = &exphdl[u];
+		INIT_OBJ(ep, EXP_PRIV_MAGIC);
+		Lck_New(&ep->mtx, lck_exp);
+		PTOK(pthread_cond_init(&ep->condvar, NULL));
+		VSTAILQ_INIT(&ep->inbox);
+		ep->stats = VSC_exp_New(NULL, &ep->vsc_seg, "%u", u);
+		AN(ep->stats);
+		WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
+		ep->thread = pt;
+	}
 }
 
 void
 EXP_Shutdown(void)
 {
-	struct exp_priv *ep = exphdl;
+	struct exp_priv *ep;
 	void *status;
+	unsigned u;
 
-	Lck_Lock(&ep->mtx);
-	exp_shutdown = 1;
-	PTOK(pthread_cond_signal(&ep->condvar));
-	Lck_Unlock(&ep->mtx);
+	for (u = 0; u < exp_nhdl; u++) {
+		ep = &exphdl[u];
+		Lck_Lock(&ep->mtx);
+		exp_shutdown = 1;
+		PTOK(pthread_cond_signal(&ep->condvar));
+		Lck_Unlock(&ep->mtx);
+	}
 
-	AN(ep->thread);
-	PTOK(pthread_join(ep->thread, &status));
-	AZ(status);
-	memset(&ep->thread, 0, sizeof ep->thread);
+	for (u = 0; u < exp_nhdl; u++) {
+		ep = &exphdl[u];
+		AN(ep->thread);
+		PTOK(pthread_join(ep->thread, &status));
+		AZ(status);
+		memset(&ep->thread, 0, sizeof ep->thread);
+	}
 
 	/* XXX could cleanup more - not worth it for now */
 }
@@ -76,6 +76,7 @@ vbf_allocobj(struct busyobj *bo, unsigned l)
 	struct objcore *oc;
 	const struct stevedore *stv;
 	vtim_dur lifetime;
+	ssize_t len;
 
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	oc = bo->fetch_objcore;
@@ -99,11 +100,13 @@ vbf_allocobj(struct busyobj *bo, unsigned l)
 	if (stv == NULL)
 		return (0);
 
-	if (STV_NewObject(bo->wrk, oc, stv, l))
-		return (1);
-
 	if (stv == stv_transient)
-		return (0);
+		return (STV_NewObject(bo->wrk, oc, stv, l));
+
+	len = (bo->htc != NULL) ? bo->htc->content_length : -1;
+	if ((bo->force_admit || STV_Admit(bo->wrk, oc, stv, len)) &&
+	    STV_NewObject(bo->wrk, oc, stv, l))
+		return (1);
 
 	/*
 	 * Try to salvage the transaction by allocating a shortlived object
@@ -329,6 +332,7 @@ vbf_stp_retry(struct worker *wrk, struct busyobj *bo)
 	bo->storage = NULL;
 	bo->do_esi = 0;
 	bo->do_stream = 1;
+	bo->force_admit = 0;
 	bo->was_304 = 0;
 	bo->err_code = 0;
 	bo->err_reason = NULL;
@@ -1127,7 +1131,7 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 
 	if (oc->boc->state == BOS_FINISHED) {
 		AZ(oc->flags & OC_F_FAILED);
-		VSLb(bo->vsl, SLT_Length, "%ju",
+		VSLb_uint(bo->vsl, SLT_Length, 1,
 		    (uintmax_t)ObjGetLen(bo->wrk, oc));
 	}
 	// AZ(oc->boc);	// XXX
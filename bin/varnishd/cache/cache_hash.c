@@ -182,7 +182,9 @@ HSH_DeleteObjHead(const struct worker *wrk, struct objhead *oh)
 
 	AZ(oh->refcnt);
 	assert(VTAILQ_EMPTY(&oh->objcs));
+	AZ(oh->vidx);
 	assert(VTAILQ_EMPTY(&oh->waitinglist));
+	AZ(oh->nwaiting);
 	Lck_Delete(&oh->mtx);
 	wrk->stats->n_objecthead--;
 	FREE_OBJ(oh);
@@ -276,6 +278,466 @@ hsh_testmagic(void *result)
 	fprintf(stderr, ">\n");
 }
 
+/*---------------------------------------------------------------------
+ * Lockless hit path
+ *
+ * A plain hit on the first objcore of an objhead is remembered in
+ * oh->hot.  Later lookups find the objhead with the hash's peek method
+ * and try to gain a reference on oh->hot without oh->mtx, and only use
+ * it if it is still a fresh, unbanned and Vary matching hit.  Anything
+ * else goes through the locked lookup, which also maintains oh->hot.
+ *
+ * Until they hold a reference, readers are counted in
+ * oh->hot_readers[oh->hot_epoch & 1].  The last deref of an objcore
+ * flips the epoch with oh->mtx held, and before it frees the objcore
+ * hsh_hot_wait() waits, without the lock, for the readers which might
+ * have seen it leave.  The objhead itself is not freed before the
+ * reader calls the hash's unpeek method.
+ *
+ * Only oh->hot is changed under oh->mtx for the readers: whatever
+ * makes an objcore unfit for it, like setting OC_F_DYING, clears
+ * oh->hot first, and readers check that it is still there once they
+ * hold their reference, instead of looking at the objcore's flags.
+ */
+
+static void
+hsh_hot_set(struct objhead *oh, struct objcore *oc)
+{
+
+	Lck_AssertHeld(&oh->mtx);
+	if (oh->hot != oc)
+		__atomic_store_n(&oh->hot, oc, __ATOMIC_SEQ_CST);
+}
+
+static void
+hsh_hot_clear(struct objhead *oh, const struct objcore *oc)
+{
+
+	Lck_AssertHeld(&oh->mtx);
+	if (oh->hot != NULL && (oc == NULL || oh->hot == oc))
+		__atomic_store_n(&oh->hot, NULL, __ATOMIC_SEQ_CST);
+}
+
+static int
+hsh_hot_flip(struct objhead *oh)
+{
+
+	Lck_AssertHeld(&oh->mtx);
+	if (__atomic_load_n(&oh->hot_readers[0], __ATOMIC_SEQ_CST) == 0 &&
+	    __atomic_load_n(&oh->hot_readers[1], __ATOMIC_SEQ_CST) == 0)
+		return (-1);
+	return (__atomic_fetch_add(&oh->hot_epoch, 1, __ATOMIC_SEQ_CST) & 1);
+}
+
+static void
+hsh_hot_wait(struct objhead *oh, int e)
+{
+
+	if (e < 0)
+		return;
+	while (__atomic_load_n(&oh->hot_readers[e], __ATOMIC_SEQ_CST) != 0)
+		(void)usleep(10);
+}
+
+static struct objcore *
+hsh_lookup_lockless(struct worker *wrk, struct req *req)
+{
+	struct objhead *oh;
+	struct objcore *oc;
+	const uint8_t *vary;
+	unsigned e, token;
+	int r;
+
+	oh = hash->peek(wrk, req->digest, &token);
+	if (oh == NULL) {
+		hash->unpeek(token);
+		return (NULL);
+	}
+	CHECK_OBJ(oh, OBJHEAD_MAGIC);
+
+	while (1) {
+		e = __atomic_load_n(&oh->hot_epoch, __ATOMIC_SEQ_CST) & 1;
+		(void)__atomic_add_fetch(&oh->hot_readers[e], 1,
+		    __ATOMIC_SEQ_CST);
+		/* A stale epoch would not be waited for, try again */
+		if ((__atomic_load_n(&oh->hot_epoch, __ATOMIC_SEQ_CST) & 1) == e)
+			break;
+		(void)__atomic_sub_fetch(&oh->hot_readers[e], 1,
+		    __ATOMIC_SEQ_CST);
+	}
+	oc = __atomic_load_n(&oh->hot, __ATOMIC_SEQ_CST);
+	if (oc != NULL) {
+		r = __atomic_load_n(&oc->refcnt, __ATOMIC_SEQ_CST);
+		while (r > 0 && !__atomic_compare_exchange_n(&oc->refcnt,
+		    &r, r + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			continue;
+		if (r == 0)
+			oc = NULL;
+	}
+	(void)__atomic_sub_fetch(&oh->hot_readers[e], 1, __ATOMIC_SEQ_CST);
+	if (oc != NULL && __atomic_load_n(&oh->hot, __ATOMIC_SEQ_CST) != oc) {
+		/* Cleared while we got our reference, no longer fit */
+		hash->unpeek(token);
+		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		return (NULL);
+	}
+	hash->unpeek(token);
+	if (oc == NULL)
+		return (NULL);
+
+	/* We hold a reference now, see if it is still a hit for us */
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (oc->objhead != oh || !BAN_Current(oc) ||
+	    EXP_Ttl(req, oc) <= req->t_req) {
+		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		return (NULL);
+	}
+	if (!req->hash_ignore_vary && ObjHasAttr(wrk, oc, OA_VARY)) {
+		vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+		AN(vary);
+		if (!VRY_Match(req, vary)) {
+			(void)HSH_DerefObjCore(wrk, &oc, 0);
+			return (NULL);
+		}
+	}
+	return (oc);
+}
+
+/*---------------------------------------------------------------------
+ * Variant index
+ *
+ * Once a lookup had to look at vary_index_min objcores, the objhead
+ * gets an open addressing table of its non-busy objcores, keyed by
+ * VRY_Hash() of their OA_VARY.  For each list of headers ("shape") the
+ * objects vary on, VRY_Key() gives us the key under which matching
+ * objects must be, and HSH_Lookup() only examines those, followed by
+ * the busy objcores, which are always at the tail of oh->objcs.
+ *
+ * Objcores get a sequence number when indexed, and since they are
+ * indexed exactly when they move to the head of oh->objcs, sorting
+ * candidates by it keeps the order of the list.
+ *
+ * Everything here is protected by oh->mtx.
+ */
+
+#define HSH_VIDX_SHAPES		8
+#define HSH_VIDX_CANDS		32
+#define HSH_VIDX_MINSLOTS	16
+
+struct hsh_vidx_slot {
+	struct objcore		*oc;
+	unsigned		seq;
+	uint32_t		key;
+};
+
+struct hsh_vidx {
+	unsigned		magic;
+#define HSH_VIDX_MAGIC		0x6c0e59d3
+	unsigned		novary;
+	unsigned		nshape;
+	uint8_t			*shape[HSH_VIDX_SHAPES];
+	unsigned		seq;
+	unsigned		nused;
+	unsigned		nfill;
+	unsigned		mask;
+	struct hsh_vidx_slot	*slot;
+};
+
+struct hsh_iter {
+	struct objhead		*oh;
+	int			n;	/* -1: all of oh->objcs */
+	int			i;
+	struct objcore		*oc[HSH_VIDX_CANDS];
+};
+
+static struct objcore hsh_vidx_dead[1];
+
+static void
+hsh_vidx_free(struct hsh_vidx **pvi)
+{
+	struct hsh_vidx *vi;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(vi, pvi, HSH_VIDX_MAGIC);
+	for (u = 0; u < vi->nshape; u++)
+		free(vi->shape[u]);
+	free(vi->slot);
+	FREE_OBJ(vi);
+}
+
+static void
+hsh_vidx_destroy(struct worker *wrk, struct objhead *oh)
+{
+
+	Lck_AssertHeld(&oh->mtx);
+	CHECK_OBJ_NOTNULL(oh->vidx, HSH_VIDX_MAGIC);
+	wrk->stats->n_vary_index--;
+	wrk->stats->n_vary_variant -= oh->vidx->nused;
+	hsh_vidx_free(&oh->vidx);
+}
+
+/* Make sure we know the shape of vary, zero if there are too many */
+static int
+hsh_vidx_shape(struct hsh_vidx *vi, const uint8_t *vary)
+{
+	unsigned u;
+
+	if (vary == NULL) {
+		vi->novary = 1;
+		return (1);
+	}
+	for (u = 0; u < vi->nshape; u++)
+		if (VRY_SameShape(vi->shape[u], vary))
+			return (1);
+	if (vi->nshape == HSH_VIDX_SHAPES)
+		return (0);
+	vi->shape[vi->nshape++] = VRY_Shape(vary);
+	return (1);
+}
+
+static void
+hsh_vidx_put(struct hsh_vidx *vi, struct objcore *oc, uint32_t key,
+    unsigned seq)
+{
+	struct hsh_vidx_slot *sl;
+	unsigned u;
+
+	for (u = key & vi->mask; ; u = (u + 1) & vi->mask) {
+		sl = &vi->slot[u];
+		if (sl->oc == NULL)
+			vi->nfill++;
+		else if (sl->oc != hsh_vidx_dead)
+			continue;
+		sl->oc = oc;
+		sl->seq = seq;
+		sl->key = key;
+		vi->nused++;
+		return;
+	}
+}
+
+/* Keep the table at most half full, counting deleted slots */
+static void
+hsh_vidx_resize(struct hsh_vidx *vi, unsigned n)
+{
+	struct hsh_vidx_slot *osl;
+	unsigned u, nslot;
+
+	if (vi->slot != NULL && (vi->nfill + n) * 2 <= vi->mask + 1)
+		return;
+	nslot = HSH_VIDX_MINSLOTS;
+	while (nslot < (vi->nused + n) * 4)
+		nslot <<= 1;
+	osl = vi->slot;
+	u = vi->slot == NULL ? 0 : vi->mask + 1;
+	vi->slot = calloc(nslot, sizeof *vi->slot);
+	AN(vi->slot);
+	vi->mask = nslot - 1;
+	vi->nused = 0;
+	vi->nfill = 0;
+	while (u-- > 0)
+		if (osl[u].oc != NULL && osl[u].oc != hsh_vidx_dead)
+			hsh_vidx_put(vi, osl[u].oc, osl[u].key,
+			    osl[u].seq);
+	free(osl);
+}
+
+static void
+hsh_vidx_build(struct worker *wrk, struct objhead *oh)
+{
+	struct hsh_vidx *vi;
+	struct objcore *oc;
+	const uint8_t *vary;
+	unsigned n = 0;
+
+	Lck_AssertHeld(&oh->mtx);
+	AZ(oh->vidx);
+	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list)
+		if (!(oc->flags & OC_F_BUSY))
+			n++;
+
+	ALLOC_OBJ(vi, HSH_VIDX_MAGIC);
+	AN(vi);
+	hsh_vidx_resize(vi, n);
+	vi->seq = n;
+	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
+		if (oc->flags & OC_F_BUSY)
+			break;
+		vary = NULL;
+		if (ObjHasAttr(wrk, oc, OA_VARY)) {
+			vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+			AN(vary);
+		}
+		if (!hsh_vidx_shape(vi, vary)) {
+			hsh_vidx_free(&vi);
+			return;
+		}
+		hsh_vidx_put(vi, oc, VRY_Hash(vary), n--);
+	}
+	oh->vidx = vi;
+	wrk->stats->n_vary_index++;
+	wrk->stats->n_vary_variant += vi->nused;
+}
+
+/* oc just moved to the head of oh->objcs */
+static void
+hsh_vidx_add(struct worker *wrk, struct objhead *oh, struct objcore *oc)
+{
+	struct hsh_vidx *vi;
+	const uint8_t *vary = NULL;
+
+	Lck_AssertHeld(&oh->mtx);
+	vi = oh->vidx;
+	if (vi == NULL)
+		return;
+	CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+	assert(oc == VTAILQ_FIRST(&oh->objcs));
+	if (ObjHasAttr(wrk, oc, OA_VARY)) {
+		vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+		AN(vary);
+	}
+	if (!hsh_vidx_shape(vi, vary)) {
+		hsh_vidx_destroy(wrk, oh);
+		return;
+	}
+	hsh_vidx_resize(vi, 1);
+	hsh_vidx_put(vi, oc, VRY_Hash(vary), ++vi->seq);
+	wrk->stats->n_vary_variant++;
+}
+
+/*
+ * oc is leaving oh->objcs.  Busy objcores were never indexed, and we do
+ * not keep the key in the objcore, so look at OA_VARY again while it is
+ * still there, or search the entire table if it is not.
+ */
+static void
+hsh_vidx_del(struct worker *wrk, struct objhead *oh,
+    struct objcore *oc)
+{
+	struct hsh_vidx *vi;
+	struct hsh_vidx_slot *sl;
+	const uint8_t *vary = NULL;
+	unsigned u, n, probe = 0;
+
+	Lck_AssertHeld(&oh->mtx);
+	vi = oh->vidx;
+	if (vi == NULL || (oc->flags & OC_F_BUSY))
+		return;
+	CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+	u = 0;
+	if (oc->stobj->stevedore != NULL) {
+		if (ObjHasAttr(wrk, oc, OA_VARY)) {
+			vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+			AN(vary);
+		}
+		u = VRY_Hash(vary) & vi->mask;
+		probe = 1;
+	}
+	for (n = vi->mask + 1; n > 0; n--, u = (u + 1) & vi->mask) {
+		sl = &vi->slot[u];
+		if (sl->oc == NULL && probe)
+			return;
+		if (sl->oc != oc)
+			continue;
+		sl->oc = hsh_vidx_dead;
+		vi->nused--;
+		wrk->stats->n_vary_variant--;
+		if (vi->nused == 0)
+			hsh_vidx_destroy(wrk, oh);
+		return;
+	}
+}
+
+/*
+ * Find the objcores HSH_Lookup() must examine for req, falling back to
+ * all of oh->objcs if there is no index or we cannot use it.
+ */
+static void
+hsh_vidx_lookup(struct worker *wrk, const struct req *req,
+    struct objhead *oh, struct hsh_iter *it)
+{
+	struct hsh_vidx *vi;
+	struct hsh_vidx_slot *sl;
+	struct objcore *oc, *oc2;
+	uint32_t key[HSH_VIDX_SHAPES + 1];
+	unsigned seq[HSH_VIDX_CANDS];
+	unsigned nkey = 0, nskip, u, v;
+	int n = 0, i;
+
+	Lck_AssertHeld(&oh->mtx);
+	it->oh = oh;
+	it->n = -1;
+	it->i = 0;
+	vi = oh->vidx;
+	if (vi == NULL || req->hash_ignore_vary)
+		return;
+	CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+
+	if (vi->novary)
+		key[nkey++] = VRY_Hash(NULL);
+	for (u = 0; u < vi->nshape; u++) {
+		if (!VRY_Key(req, vi->shape[u], &key[nkey]))
+			return;
+		for (v = 0; v < nkey; v++)
+			if (key[v] == key[nkey])
+				break;
+		if (v == nkey)
+			nkey++;
+	}
+
+	for (v = 0; v < nkey; v++) {
+		for (u = key[v] & vi->mask; ; u = (u + 1) & vi->mask) {
+			sl = &vi->slot[u];
+			if (sl->oc == NULL)
+				break;
+			if (sl->oc == hsh_vidx_dead || sl->key != key[v])
+				continue;
+			if (n == HSH_VIDX_CANDS)
+				return;
+			/* Insert in objcs order */
+			for (i = n++; i > 0 && seq[i - 1] < sl->seq; i--) {
+				it->oc[i] = it->oc[i - 1];
+				seq[i] = seq[i - 1];
+			}
+			it->oc[i] = sl->oc;
+			seq[i] = sl->seq;
+		}
+	}
+
+	/* Variants we skipped count as not matching, like in the scan */
+	nskip = vi->nused - n;
+
+	oc = VTAILQ_LAST(&oh->objcs, objcorehead_s);
+	if (oc != NULL && !(oc->flags & OC_F_BUSY))
+		oc = NULL;
+	while (oc != NULL && (oc2 = VTAILQ_PREV(oc, objcorehead_s,
+	    hsh_list)) != NULL && (oc2->flags & OC_F_BUSY))
+		oc = oc2;
+	for (; oc != NULL; oc = VTAILQ_NEXT(oc, hsh_list)) {
+		AN(oc->flags & OC_F_BUSY);
+		if (n == HSH_VIDX_CANDS)
+			return;
+		it->oc[n++] = oc;
+	}
+
+	it->n = n;
+	wrk->strangelove += nskip;
+	wrk->stats->vary_index_lookup++;
+	wrk->stats->vary_index_candidate += n;
+}
+
+static struct objcore *
+hsh_iter_next(struct hsh_iter *it, struct objcore *oc)
+{
+
+	if (it->n < 0)
+		return (oc == NULL ? VTAILQ_FIRST(&it->oh->objcs) :
+		    VTAILQ_NEXT(oc, hsh_list));
+	if (it->i < it->n)
+		return (it->oc[it->i++]);
+	return (NULL);
+}
+
 /*---------------------------------------------------------------------
  * Insert an object which magically appears out of nowhere or, more likely,
  * comes off some persistent storage device.
@@ -322,12 +784,15 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	Lck_Lock(&oh->mtx);
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	hsh_hot_clear(oh, NULL);
 	oc->flags &= ~OC_F_BUSY;
+	hsh_vidx_add(wrk, oh, oc);
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
 		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
 	Lck_Unlock(&oh->mtx);
 	hsh_rush2(wrk, &rush);
 
+	TAG_NewObjCore(wrk, oc);
 	EXP_Insert(wrk, oc);
 }
 
@@ -370,6 +835,8 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	int busy_found;
 	const uint8_t *vary;
 	intmax_t boc_progress;
+	struct hsh_iter it;
+	unsigned nscan = 0;
 	unsigned xid = 0;
 	float dttl = 0.0;
 
@@ -390,6 +857,19 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	if (DO_DEBUG(DBG_HASHEDGE))
 		hsh_testmagic(req->digest);
 
+	if (req->hash_objhead == NULL && !req->hash_always_miss &&
+	    req->vcf == NULL && hash->peek != NULL &&
+	    cache_param->lookup_lockless) {
+		oc = hsh_lookup_lockless(wrk, req);
+		if (oc != NULL) {
+			*ocp = oc;
+			OC_HITS_INC(oc);
+			wrk->stats->cache_hit_lockless++;
+			Req_LogHit(wrk, req, oc, -1);
+			return (HSH_HIT);
+		}
+	}
+
 	if (req->hash_objhead != NULL) {
 		/*
 		 * This req came off the waiting list, and brings an
@@ -420,12 +900,15 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	busy_found = 0;
 	exp_oc = NULL;
 	exp_t_origin = 0.0;
-	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
+	hsh_vidx_lookup(wrk, req, oh, &it);
+	for (oc = hsh_iter_next(&it, NULL); oc != NULL;
+	    oc = hsh_iter_next(&it, oc)) {
 		/* Must be at least our own ref + the objcore we examine */
 		assert(oh->refcnt > 1);
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 		assert(oc->objhead == oh);
 		assert(oc->refcnt > 0);
+		nscan++;
 
 		if (oc->flags & OC_F_DYING)
 			continue;
@@ -452,6 +935,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 			continue;
 
 		if (BAN_CheckObject(wrk, oc, req)) {
+			hsh_hot_clear(oh, oc);
 			oc->flags |= OC_F_DYING;
 			EXP_Remove(oc, NULL);
 			continue;
@@ -495,6 +979,13 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 		}
 	}
 
+	if (it.n < 0) {
+		wrk->stats->vary_scan_objcore += nscan;
+		if (oh->vidx == NULL && cache_param->vary_index_min > 0 &&
+		    nscan >= cache_param->vary_index_min)
+			hsh_vidx_build(wrk, oh);
+	}
+
 	if (req->vcf != NULL)
 		(void)req->vcf->func(req, &oc, &exp_oc, 1);
 
@@ -509,7 +1000,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 
 	if (oc != NULL) {
 		*ocp = oc;
-		oc->refcnt++;
+		OC_REFCNT_INC(oc);
 		if (oc->flags & OC_F_HFM) {
 			xid = VXID(ObjGetXID(wrk, oc));
 			dttl = EXP_Dttl(req, oc);
@@ -519,8 +1010,11 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 			VSLb(req->vsl, SLT_HitMiss, "%u %.6f", xid, dttl);
 			return (HSH_HITMISS);
 		}
-		oc->hits++;
+		OC_HITS_INC(oc);
 		boc_progress = oc->boc == NULL ? -1 : oc->boc->fetched_so_far;
+		if (req->vcf == NULL && oc == VTAILQ_FIRST(&oh->objcs) &&
+		    oc->boc == NULL && oc->flags == 0)
+			hsh_hot_set(oh, oc);
 		AN(hsh_deref_objhead_unlock(wrk, &oh, HSH_RUSH_POLICY));
 		Req_LogHit(wrk, req, oc, boc_progress);
 		return (HSH_HIT);
@@ -551,10 +1045,10 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 		*bocp = hsh_insert_busyobj(wrk, oh);
 
 		if (exp_oc != NULL) {
-			exp_oc->refcnt++;
+			OC_REFCNT_INC(exp_oc);
 			*ocp = exp_oc;
 			if (EXP_Ttl_grace(req, exp_oc) >= req->t_req) {
-				exp_oc->hits++;
+				OC_HITS_INC(exp_oc);
 				Lck_Unlock(&oh->mtx);
 				Req_LogHit(wrk, req, exp_oc, boc_progress);
 				return (HSH_GRACE);
@@ -567,9 +1061,9 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	AN(busy_found);
 	if (exp_oc != NULL && EXP_Ttl_grace(req, exp_oc) >= req->t_req) {
 		/* we do not wait on the busy object if in grace */
-		exp_oc->refcnt++;
+		OC_REFCNT_INC(exp_oc);
 		*ocp = exp_oc;
-		exp_oc->hits++;
+		OC_HITS_INC(exp_oc);
 		AN(hsh_deref_objhead_unlock(wrk, &oh, 0));
 		Req_LogHit(wrk, req, exp_oc, boc_progress);
 		return (HSH_GRACE);
@@ -577,6 +1071,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 
 	/* There are one or more busy objects, wait for them */
 	VTAILQ_INSERT_TAIL(&oh->waitinglist, req, w_list);
+	(void)__atomic_add_fetch(&oh->nwaiting, 1, __ATOMIC_RELEASE);
 
 	AZ(req->hash_ignore_busy);
 
@@ -627,6 +1122,7 @@ hsh_rush1(const struct worker *wrk, struct objhead *oh, struct rush *r, int max)
 		wrk->stats->busy_wakeup++;
 		AZ(req->wrk);
 		VTAILQ_REMOVE(&oh->waitinglist, req, w_list);
+		(void)__atomic_sub_fetch(&oh->nwaiting, 1, __ATOMIC_RELEASE);
 		VTAILQ_INSERT_TAIL(&r->reqs, req, w_list);
 		req->waitinglist = 0;
 	}
@@ -718,9 +1214,11 @@ HSH_Purge(struct worker *wrk, struct objhead *oh, vtim_real ttl_now,
 			}
 			if (oc->flags & OC_F_DYING)
 				continue;
-			if (is_purge)
+			if (is_purge) {
 				oc->flags |= OC_F_DYING;
-			oc->refcnt++;
+				hsh_hot_clear(oh, oc);
+			}
+			OC_REFCNT_INC(oc);
 			ocp[n++] = oc;
 		}
 
@@ -798,6 +1296,7 @@ HSH_Fail(struct objcore *oc)
 	assert((oc->flags & OC_F_BUSY) || (oc->stobj->stevedore != NULL));
 
 	Lck_Lock(&oh->mtx);
+	hsh_hot_clear(oh, oc);
 	oc->flags |= OC_F_FAILED;
 	Lck_Unlock(&oh->mtx);
 }
@@ -816,6 +1315,7 @@ hsh_cancel(struct objcore *oc)
 	CHECK_OBJ(oh, OBJHEAD_MAGIC);
 
 	Lck_Lock(&oh->mtx);
+	hsh_hot_clear(oh, oc);
 	oc->flags |= OC_F_CANCEL;
 	Lck_Unlock(&oh->mtx);
 }
@@ -894,12 +1394,16 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 	/* XXX: strictly speaking, we should sort in Date: order. */
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	hsh_hot_clear(oh, NULL);
 	oc->flags &= ~OC_F_BUSY;
+	if (!(oc->flags & OC_F_PRIVATE))
+		hsh_vidx_add(wrk, oh, oc);
 	if (!VTAILQ_EMPTY(&oh->waitinglist)) {
 		assert(oh->refcnt > 1);
 		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
 	}
 	Lck_Unlock(&oh->mtx);
+	TAG_NewObjCore(wrk, oc);
 	EXP_Insert(wrk, oc); /* Does nothing unless EXP_RefNewObjcore was
 			      * called */
 	hsh_rush2(wrk, &rush);
@@ -930,6 +1434,7 @@ HSH_Replace(struct objcore *oc, const struct objcore *new_oc)
 	}
 
 	Lck_Lock(&oc->objhead->mtx);
+	hsh_hot_clear(oc->objhead, oc);
 	oc->flags |= OC_F_DYING;
 	Lck_Unlock(&oc->objhead->mtx);
 	EXP_Remove(oc, new_oc);
@@ -944,7 +1449,7 @@ HSH_Replace(struct objcore *oc, const struct objcore *new_oc)
 int
 HSH_Snipe(const struct worker *wrk, struct objcore *oc)
 {
-	int retval = 0;
+	int retval = 0, r;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -952,9 +1457,20 @@ HSH_Snipe(const struct worker *wrk, struct objcore *oc)
 
 	if (oc->refcnt == 1 && !Lck_Trylock(&oc->objhead->mtx)) {
 		if (oc->refcnt == 1 && !(oc->flags & OC_F_DYING)) {
-			oc->flags |= OC_F_DYING;
-			oc->refcnt++;
-			retval = 1;
+			/*
+			 * The lockless hit path can gain a reference at
+			 * any time, so take the objcore off it before we
+			 * claim the only other reference.  A reader which
+			 * still wins the race finds oh->hot changed and
+			 * lets go of the object again.
+			 */
+			hsh_hot_clear(oc->objhead, oc);
+			r = 1;
+			if (__atomic_compare_exchange_n(&oc->refcnt, &r, 2, 0,
+			    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				oc->flags |= OC_F_DYING;
+				retval = 1;
+			}
 		}
 		Lck_Unlock(&oc->objhead->mtx);
 	}
@@ -976,10 +1492,8 @@ HSH_Ref(struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	oh = oc->objhead;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-	Lck_Lock(&oh->mtx);
 	assert(oc->refcnt > 0);
-	oc->refcnt++;
-	Lck_Unlock(&oh->mtx);
+	OC_REFCNT_INC(oc);
 }
 
 /*---------------------------------------------------------------------
@@ -1045,7 +1559,7 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	struct objcore *oc;
 	struct objhead *oh;
 	struct rush rush;
-	int r;
+	int r, e = -1;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	TAKE_OBJ_NOTNULL(oc, ocp, OBJCORE_MAGIC);
@@ -1055,11 +1569,24 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	oh = oc->objhead;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 
+	/* Unless this is the last reference or we need to rush, skip the lock */
+	r = __atomic_load_n(&oc->refcnt, __ATOMIC_SEQ_CST);
+	while (r > 1 && (rushmax == 0 ||
+	    __atomic_load_n(&oh->nwaiting, __ATOMIC_ACQUIRE) == 0)) {
+		if (__atomic_compare_exchange_n(&oc->refcnt, &r, r - 1, 0,
+		    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return (r - 1);
+	}
+
 	Lck_Lock(&oh->mtx);
 	assert(oh->refcnt > 0);
-	r = --oc->refcnt;
-	if (!r)
+	r = __atomic_sub_fetch(&oc->refcnt, 1, __ATOMIC_SEQ_CST);
+	if (!r) {
 		VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
+		hsh_vidx_del(wrk, oh, oc);
+		hsh_hot_clear(oh, oc);
+		e = hsh_hot_flip(oh);
+	}
 	if (!VTAILQ_EMPTY(&oh->waitinglist)) {
 		assert(oh->refcnt > 1);
 		hsh_rush1(wrk, oh, &rush, rushmax);
@@ -1069,11 +1596,17 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	if (r != 0)
 		return (r);
 
+	/* Our objhead ref keeps oh around while we wait for readers */
+	hsh_hot_wait(oh, e);
+
 	AZ(oc->exp_flags);
 
 	BAN_DestroyObj(oc);
 	AZ(oc->ban);
 
+	TAG_DestroyObj(oc);
+	AZ(oc->tags);
+
 	if (oc->stobj->stevedore != NULL)
 		ObjFreeObj(wrk, oc);
 	ObjDestroy(wrk, &oc);
@@ -64,6 +64,8 @@ struct mempool {
 	struct vsc_seg			*vsc_seg;
 	struct VSC_mempool		*vsc;
 	unsigned			n_pool;
+	unsigned			n_mag;
+	VTAILQ_HEAD(, mpl_mag)		mags;
 	pthread_t			thread;
 	vtim_real			t_now;	// XXX -> mono?
 	int				self_destruct;
@@ -89,6 +91,32 @@ mpl_alloc(const struct mempool *mpl)
 	return (mi);
 }
 
+/*---------------------------------------------------------------------
+ * Free items, including those held in worker magazines
+ */
+
+static inline unsigned
+mpl_nfree(const struct mempool *mpl)
+{
+
+	return (mpl->n_pool + mpl->n_mag);
+}
+
+/*
+ * The live count is kept with atomics, because magazines allocate and
+ * free without the lock.  The guard publishes it too, in case updates
+ * raced each other.
+ */
+
+static inline void
+mpl_live(struct mempool *mpl, int d)
+{
+
+	mpl->vsc->live = __atomic_add_fetch(&mpl->live, d, __ATOMIC_RELAXED);
+}
+
+static void mpl_mag_reclaim(struct mempool *);
+
 /*---------------------------------------------------------------------
  * Pool-guard
  *   Attempt to keep number of free items in pool inside bounds with
@@ -112,19 +140,21 @@ mpl_guard(void *priv)
 		VTIM_sleep(mpl_slp);
 		mpl_slp = 0.814;	// random
 		mpl->t_now = VTIM_real();
+		mpl_live(mpl, 0);
 
-		if (mi != NULL && (mpl->n_pool > mpl->param->max_pool ||
+		if (mi != NULL && (mpl_nfree(mpl) > mpl->param->max_pool ||
 		    mi->size < *mpl->cur_size)) {
 			CHECK_OBJ(mi, MEMITEM_MAGIC);
 			FREE_OBJ(mi);
 		}
 
-		if (mi == NULL && mpl->n_pool < mpl->param->min_pool)
+		if (mi == NULL && mpl_nfree(mpl) < mpl->param->min_pool)
 			mi = mpl_alloc(mpl);
 
-		if (mpl->n_pool < mpl->param->min_pool && mi != NULL) {
+		if (mpl_nfree(mpl) < mpl->param->min_pool && mi != NULL) {
 			/* can do */
-		} else if (mpl->n_pool > mpl->param->max_pool && mi == NULL) {
+		} else if (mpl_nfree(mpl) > mpl->param->max_pool &&
+		    mpl->n_pool > 0 && mi == NULL) {
 			/* can do */
 		} else if (!VTAILQ_EMPTY(&mpl->surplus)) {
 			/* can do */
@@ -142,7 +172,17 @@ mpl_guard(void *priv)
 			continue;
 
 		if (mpl->self_destruct) {
-			AZ(mpl->live);
+			mpl_mag_reclaim(mpl);
+			if (!VTAILQ_EMPTY(&mpl->mags)) {
+				/* A worker is using one, try again later */
+				Lck_Unlock(&mpl->mtx);
+				continue;
+			}
+		}
+
+		if (mpl->self_destruct) {
+			AZ(__atomic_load_n(&mpl->live, __ATOMIC_SEQ_CST));
+			AZ(mpl->n_mag);
 			while (1) {
 				if (mi == NULL) {
 					mi = VTAILQ_FIRST(&mpl->list);
@@ -170,7 +210,7 @@ mpl_guard(void *priv)
 			break;
 		}
 
-		if (mpl->n_pool < mpl->param->min_pool &&
+		if (mpl_nfree(mpl) < mpl->param->min_pool &&
 		    mi != NULL && mi->size >= *mpl->cur_size) {
 			CHECK_OBJ(mi, MEMITEM_MAGIC);
 			mpl->vsc->pool = ++mpl->n_pool;
@@ -180,7 +220,8 @@ mpl_guard(void *priv)
 			mpl_slp = .01;	// random
 
 		}
-		if (mpl->n_pool > mpl->param->max_pool && mi == NULL) {
+		if (mpl_nfree(mpl) > mpl->param->max_pool &&
+		    mpl->n_pool > 0 && mi == NULL) {
 			mi = VTAILQ_FIRST(&mpl->list);
 			CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
 			mpl->vsc->pool = --mpl->n_pool;
@@ -196,7 +237,8 @@ mpl_guard(void *priv)
 				mpl_slp = .01;	// random
 			}
 		}
-		if (mi == NULL && mpl->n_pool > mpl->param->min_pool) {
+		if (mi == NULL && mpl_nfree(mpl) > mpl->param->min_pool &&
+		    mpl->n_pool > 0) {
 			mi = VTAILQ_LAST(&mpl->list, memhead_s);
 			CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
 			if (mi->touched + mpl->param->max_age < mpl->t_now) {
@@ -208,7 +250,7 @@ mpl_guard(void *priv)
 				mi = NULL;
 				last = mpl->t_now;
 			}
-		} else if (mpl->n_pool <= mpl->param->min_pool) {
+		} else if (mpl_nfree(mpl) <= mpl->param->min_pool) {
 			last = mpl->t_now;
 		}
 
@@ -239,6 +281,7 @@ MPL_New(const char *name,
 	mpl->cur_size = cur_size;
 	VTAILQ_INIT(&mpl->list);
 	VTAILQ_INIT(&mpl->surplus);
+	VTAILQ_INIT(&mpl->mags);
 	Lck_New(&mpl->mtx, lck_mempool);
 	/* XXX: prealloc min_pool */
 	mpl->vsc = VSC_mempool_New(NULL, &mpl->vsc_seg, mpl->name + 4);
@@ -260,26 +303,280 @@ MPL_Destroy(struct mempool **mpp)
 
 	TAKE_OBJ_NOTNULL(mpl, mpp, MEMPOOL_MAGIC);
 	Lck_Lock(&mpl->mtx);
-	AZ(mpl->live);
+	AZ(__atomic_load_n(&mpl->live, __ATOMIC_SEQ_CST));
 	mpl->self_destruct = 1;
 	Lck_Unlock(&mpl->mtx);
 }
 
 /*---------------------------------------------------------------------
+ * Worker magazines
+ *
+ * Each worker has a few magazines, one per mempool it uses, holding free
+ * items.  MPL_Get() and MPL_Free() only take the mempool lock when the
+ * magazine runs empty or full, and then move half a magazine at a time.
+ * The statistics are kept in the magazine and added to the mempool
+ * under the same lock.
+ *
+ * Threads without a worker, like the waiters, always use the mempool
+ * directly.
+ *
+ * Workers can hold magazines of other pools' mempools, for tasks handed
+ * between pools, so a mempool keeps a list of the magazines it handed
+ * out.  When it is destroyed, its guard thread empties them and marks
+ * them MPL_MAG_GONE, for their workers to reset when they next look at
+ * them.  A worker marks its magazine MPL_MAG_BUSY while using it, and
+ * the guard skips busy magazines until its next round.
  */
 
-void *
-MPL_Get(struct mempool *mpl, unsigned *size)
+#define MPL_MAG_IDLE	0
+#define MPL_MAG_BUSY	1
+#define MPL_MAG_GONE	2
+
+static void mpl_mag_return(struct mempool *, struct mpl_mag *, unsigned);
+
+static void
+mpl_mag_reclaim(struct mempool *mpl)
 {
-	struct memitem *mi;
+	struct mpl_mag *mm, *mm2;
+	unsigned s;
+
+	Lck_AssertHeld(&mpl->mtx);
+	AN(mpl->self_destruct);
+	VTAILQ_FOREACH_SAFE(mm, &mpl->mags, list, mm2) {
+		assert(mm->mpl == mpl);
+		s = MPL_MAG_IDLE;
+		if (!__atomic_compare_exchange_n(&mm->state, &s, MPL_MAG_BUSY,
+		    0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+		mpl_mag_return(mpl, mm, 0);
+		VTAILQ_REMOVE(&mpl->mags, mm, list);
+		__atomic_store_n(&mm->state, MPL_MAG_GONE, __ATOMIC_RELEASE);
+	}
+}
 
+static void
+mpl_mag_release(struct mpl_mag *mm)
+{
+	struct mempool *mpl;
+	unsigned s;
+
+	while (1) {
+		s = MPL_MAG_IDLE;
+		if (__atomic_compare_exchange_n(&mm->state, &s, MPL_MAG_BUSY,
+		    0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+			break;
+		if (s == MPL_MAG_GONE) {
+			memset(mm, 0, sizeof *mm);
+			return;
+		}
+		/* The guard is emptying it right now */
+		(void)usleep(10);
+	}
+	mpl = mm->mpl;
 	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
-	AN(size);
+	Lck_Lock(&mpl->mtx);
+	mpl_mag_return(mpl, mm, 0);
+	VTAILQ_REMOVE(&mpl->mags, mm, list);
+	Lck_Unlock(&mpl->mtx);
+	memset(mm, 0, sizeof *mm);
+}
+
+static struct mpl_mag *
+mpl_mag(struct mempool *mpl)
+{
+	struct worker *wrk;
+	struct mpl_mag *mm, *mf = NULL;
+	unsigned u, s;
+
+	if (cache_param->mempool_magazine == 0)
+		return (NULL);
+	wrk = THR_GetWorker();
+	if (wrk == NULL)
+		return (NULL);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk->wpriv, WORKER_PRIV_MAGIC);
+	for (u = 0; u < MPL_MAGS; u++) {
+		mm = &wrk->wpriv->mpl_mag[u];
+		if (mm->mpl != NULL && __atomic_load_n(&mm->state,
+		    __ATOMIC_ACQUIRE) == MPL_MAG_GONE)
+			memset(mm, 0, sizeof *mm);
+		if (mm->mpl == mpl) {
+			s = MPL_MAG_IDLE;
+			if (__atomic_compare_exchange_n(&mm->state, &s,
+			    MPL_MAG_BUSY, 0, __ATOMIC_ACQUIRE,
+			    __ATOMIC_RELAXED))
+				return (mm);
+			return (NULL);
+		}
+		if (mm->mpl == NULL && mf == NULL)
+			mf = mm;
+	}
+	if (mf == NULL)
+		return (NULL);
+	Lck_Lock(&mpl->mtx);
+	if (mpl->self_destruct) {
+		mf = NULL;
+	} else {
+		mf->mpl = mpl;
+		mf->state = MPL_MAG_BUSY;
+		VTAILQ_INSERT_TAIL(&mpl->mags, mf, list);
+	}
+	Lck_Unlock(&mpl->mtx);
+	return (mf);
+}
+
+static inline void
+mpl_mag_put(struct mpl_mag *mm)
+{
+
+	assert(mm->state == MPL_MAG_BUSY);
+	__atomic_store_n(&mm->state, MPL_MAG_IDLE, __ATOMIC_RELEASE);
+}
+
+static unsigned
+mpl_mag_size(void)
+{
+
+	return (vmin_t(unsigned, cache_param->mempool_magazine, MPL_MAG_MAX));
+}
+
+static void
+mpl_mag_sync(struct mempool *mpl, struct mpl_mag *mm)
+{
+
+	Lck_AssertHeld(&mpl->mtx);
+	mpl->vsc->allocs += mm->allocs;
+	mpl->vsc->frees += mm->frees;
+	mpl->vsc->recycle += mm->hits;
+	mpl->vsc->magazine_hit += mm->hits;
+	mpl->vsc->toosmall += mm->toosmall;
+	mpl->n_mag += mm->n;
+	mpl->n_mag -= mm->nsync;
+	mpl->vsc->magazine = mpl->n_mag;
+	mpl->vsc->pool = mpl->n_pool;
+	mm->nsync = mm->n;
+	mm->allocs = 0;
+	mm->frees = 0;
+	mm->hits = 0;
+	mm->toosmall = 0;
+}
+
+static struct memitem *
+mpl_mag_get(struct mempool *mpl, struct mpl_mag *mm)
+{
+	struct memitem *mi;
+	unsigned want;
+
+	mm->allocs++;
+	mpl_live(mpl, 1);
+	while (mm->n > 0) {
+		mi = mm->item[--mm->n];
+		CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
+		if (mi->size >= *mpl->cur_size) {
+			mm->hits++;
+			return (mi);
+		}
+		mm->toosmall++;
+		FREE_OBJ(mi);
+	}
+
+	want = vmax_t(unsigned, mpl_mag_size() / 2, 1);
+	Lck_Lock(&mpl->mtx);
+	while (mm->n < want) {
+		mi = VTAILQ_FIRST(&mpl->list);
+		if (mi == NULL) {
+			if (mm->n == 0)
+				mpl->vsc->randry++;
+			break;
+		}
+		CHECK_OBJ(mi, MEMITEM_MAGIC);
+		VTAILQ_REMOVE(&mpl->list, mi, list);
+		mpl->n_pool--;
+		if (mi->size < *mpl->cur_size) {
+			mpl->vsc->toosmall++;
+			VTAILQ_INSERT_HEAD(&mpl->surplus, mi, list);
+		} else {
+			mm->item[mm->n++] = mi;
+		}
+	}
+	mi = NULL;
+	if (mm->n > 0) {
+		mi = mm->item[--mm->n];
+		mm->hits++;
+	}
+	mpl_mag_sync(mpl, mm);
+	Lck_Unlock(&mpl->mtx);
+	return (mi);
+}
+
+static void
+mpl_mag_return(struct mempool *mpl, struct mpl_mag *mm, unsigned keep)
+{
+	struct memitem *mi;
+
+	Lck_AssertHeld(&mpl->mtx);
+	while (mm->n > keep) {
+		mi = mm->item[--mm->n];
+		CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
+		mi->touched = mpl->t_now;
+		VTAILQ_INSERT_HEAD(&mpl->list, mi, list);
+		mpl->n_pool++;
+	}
+	mpl_mag_sync(mpl, mm);
+}
+
+static void
+mpl_mag_free(struct mempool *mpl, struct mpl_mag *mm, struct memitem *mi)
+{
+
+	mm->frees++;
+	mpl_live(mpl, -1);
+	if (mi->size < *mpl->cur_size) {
+		mm->toosmall++;
+		FREE_OBJ(mi);
+		return;
+	}
+	if (mm->n >= mpl_mag_size()) {
+		Lck_Lock(&mpl->mtx);
+		mpl_mag_return(mpl, mm, mpl_mag_size() / 2);
+		Lck_Unlock(&mpl->mtx);
+	}
+	assert(mm->n < MPL_MAG_MAX);
+	mm->item[mm->n++] = mi;
+}
+
+/*---------------------------------------------------------------------
+ * Return the contents of a worker's magazines to the mempools, before
+ * the worker goes away.
+ */
+
+void
+MPL_Cleanup(struct worker *wrk)
+{
+	struct mpl_mag *mm;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk->wpriv, WORKER_PRIV_MAGIC);
+	for (u = 0; u < MPL_MAGS; u++) {
+		mm = &wrk->wpriv->mpl_mag[u];
+		if (mm->mpl != NULL)
+			mpl_mag_release(mm);
+	}
+}
+
+/*---------------------------------------------------------------------
+ */
+
+static struct memitem *
+mpl_get(struct mempool *mpl)
+{
+	struct memitem *mi;
 
 	Lck_Lock(&mpl->mtx);
 
 	mpl->vsc->allocs++;
-	mpl->vsc->live = ++mpl->live;
+	mpl_live(mpl, 1);
 
 	do {
 		mi = VTAILQ_FIRST(&mpl->list);
@@ -300,6 +597,24 @@ MPL_Get(struct mempool *mpl, unsigned *size)
 	} while (mi == NULL);
 
 	Lck_Unlock(&mpl->mtx);
+	return (mi);
+}
+
+void *
+MPL_Get(struct mempool *mpl, unsigned *size)
+{
+	struct memitem *mi;
+	struct mpl_mag *mm;
+
+	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
+	AN(size);
+
+	mm = mpl_mag(mpl);
+	if (mm != NULL) {
+		mi = mpl_mag_get(mpl, mm);
+		mpl_mag_put(mm);
+	} else
+		mi = mpl_get(mpl);
 
 	if (mi == NULL)
 		mi = mpl_alloc(mpl);
@@ -314,6 +629,7 @@ void
 MPL_Free(struct mempool *mpl, void *item)
 {
 	struct memitem *mi;
+	struct mpl_mag *mm;
 
 	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
 	AN(item);
@@ -322,10 +638,17 @@ MPL_Free(struct mempool *mpl, void *item)
 	CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
 	memset(item, 0, mi->size - sizeof *mi);
 
+	mm = mpl_mag(mpl);
+	if (mm != NULL) {
+		mpl_mag_free(mpl, mm, mi);
+		mpl_mag_put(mm);
+		return;
+	}
+
 	Lck_Lock(&mpl->mtx);
 
 	mpl->vsc->frees++;
-	mpl->vsc->live = --mpl->live;
+	mpl_live(mpl, -1);
 
 	if (mi->size < *mpl->cur_size) {
 		mpl->vsc->toosmall++;
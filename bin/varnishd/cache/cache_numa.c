@@ -0,0 +1,301 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * NUMA placement of thread pools
+ *
+ * With thread_pool_numa, pool N is assigned to node N % nodes.  The
+ * thread creating the pool binds itself to the CPUs of that node and
+ * prefers its memory while the pool is set up, so the herder, the
+ * workers, the mempool guards and the waiter inherit the placement,
+ * and workspaces (on the worker stacks) and mempool items are faulted
+ * in on the local node.
+ *
+ * The topology is read from sysfs, no libnuma is required.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache_varnishd.h"
+#include "cache_pool.h"
+
+#ifdef HAVE_LINUX_MEMPOLICY_H
+
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define NUMA_MAX_NODES		64
+#define NUMA_MAX_CPUS		CPU_SETSIZE
+
+struct numa_node {
+	unsigned		id;
+	unsigned		ncpu;
+	cpu_set_t		cpus;
+};
+
+static struct numa_node		numa_node[NUMA_MAX_NODES];
+static unsigned			numa_nnode;
+static int16_t			numa_cpu2node[NUMA_MAX_CPUS];
+
+/*--------------------------------------------------------------------
+ * Parse a sysfs list like "0-3,8,10-11" and call func for each entry.
+ */
+
+static int
+numa_list(const char *fn, void (*func)(unsigned, void *), void *priv)
+{
+	char buf[4096], *p, *e;
+	unsigned long lo, hi;
+	FILE *fi;
+
+	fi = fopen(fn, "r");
+	if (fi == NULL)
+		return (-1);
+	p = fgets(buf, sizeof buf, fi);
+	(void)fclose(fi);
+	if (p == NULL)
+		return (-1);
+	while (*p != '\0' && *p != '\n') {
+		lo = strtoul(p, &e, 10);
+		if (e == p)
+			return (-1);
+		hi = lo;
+		if (*e == '-') {
+			p = e + 1;
+			hi = strtoul(p, &e, 10);
+			if (e == p || hi < lo)
+				return (-1);
+		}
+		for (; lo <= hi; lo++)
+			func(lo, priv);
+		p = e;
+		if (*p == ',')
+			p++;
+	}
+	return (0);
+}
+
+static void
+numa_add_cpu(unsigned cpu, void *priv)
+{
+	struct numa_node *nn;
+
+	nn = priv;
+	if (cpu >= NUMA_MAX_CPUS)
+		return;
+	CPU_SET(cpu, &nn->cpus);
+	nn->ncpu++;
+	numa_cpu2node[cpu] = (int16_t)(nn - numa_node);
+}
+
+static void
+numa_add_node(unsigned id, void *priv)
+{
+	struct numa_node *nn;
+	char fn[64];
+
+	(void)priv;
+	if (numa_nnode == NUMA_MAX_NODES)
+		return;
+	nn = &numa_node[numa_nnode];
+	memset(nn, 0, sizeof *nn);
+	nn->id = id;
+	CPU_ZERO(&nn->cpus);
+	bprintf(fn, "/sys/devices/system/node/node%u/cpulist", id);
+	/* Memory-only nodes have no threads to run */
+	if (!numa_list(fn, numa_add_cpu, nn) && nn->ncpu > 0)
+		numa_nnode++;
+}
+
+void
+NUMA_Init(void)
+{
+	unsigned u;
+
+	for (u = 0; u < NUMA_MAX_CPUS; u++)
+		numa_cpu2node[u] = -1;
+	if (numa_list("/sys/devices/system/node/online", numa_add_node, NULL))
+		numa_nnode = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Which node (index) a pool belongs on, -1 if not placed.
+ */
+
+int
+NUMA_PoolNode(unsigned pool_no)
+{
+
+	if (!cache_param->wthread_pool_numa || numa_nnode == 0)
+		return (-1);
+	return ((int)(pool_no % numa_nnode));
+}
+
+/*--------------------------------------------------------------------
+ * Bind the calling thread to a node, or undo it with node == -1.
+ */
+
+void
+NUMA_Bind(int node)
+{
+	static cpu_set_t all;		/* Only the pool herder binds */
+	static int have_all;
+	struct numa_node *nn;
+	unsigned long mask[(NUMA_MAX_NODES + 63) / 64];
+
+	if (!have_all) {
+		AZ(pthread_getaffinity_np(pthread_self(), sizeof all, &all));
+		have_all = 1;
+	}
+	if (node < 0) {
+		(void)pthread_setaffinity_np(pthread_self(), sizeof all, &all);
+		(void)syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+		return;
+	}
+	assert((unsigned)node < numa_nnode);
+	nn = &numa_node[node];
+	if (pthread_setaffinity_np(pthread_self(), sizeof nn->cpus, &nn->cpus))
+		VSL(SLT_Debug, NO_VXID, "NUMA node %u: affinity failed: %s",
+		    nn->id, VAS_errtxt(errno));
+	if (nn->id >= NUMA_MAX_NODES)
+		return;
+	memset(mask, 0, sizeof mask);
+	mask[nn->id / 64] |= 1UL << (nn->id % 64);
+	/* Preferred, not bound: running out of local memory is not fatal */
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+	    NUMA_MAX_NODES + 1))
+		VSL(SLT_Debug, NO_VXID, "NUMA node %u: mempolicy failed: %s",
+		    nn->id, VAS_errtxt(errno));
+}
+
+/*--------------------------------------------------------------------
+ * Ask the kernel to steer connections arriving on the node's CPUs
+ * to this pool's reuseport socket.  Pools sharing a node each get a
+ * different CPU of it.
+ */
+
+void
+NUMA_Steer(int sock, int node, unsigned pool_no)
+{
+#ifdef SO_INCOMING_CPU
+	struct numa_node *nn;
+	unsigned u, n;
+	int cpu;
+
+	if (node < 0)
+		return;
+	assert((unsigned)node < numa_nnode);
+	nn = &numa_node[node];
+	n = (pool_no / numa_nnode) % nn->ncpu;
+	for (u = 0, cpu = -1; u < NUMA_MAX_CPUS; u++) {
+		if (!CPU_ISSET(u, &nn->cpus))
+			continue;
+		if (n-- == 0) {
+			cpu = (int)u;
+			break;
+		}
+	}
+	assert(cpu >= 0);
+	(void)setsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof cpu);
+#else
+	(void)sock;
+	(void)node;
+	(void)pool_no;
+#endif
+}
+
+/*--------------------------------------------------------------------
+ * Did this connection arrive on the node of the pool which accepted
+ * it?  Returns -1 if unknown.
+ */
+
+int
+NUMA_Local(int fd, int node)
+{
+#ifdef SO_INCOMING_CPU
+	socklen_t l;
+	int cpu;
+
+	if (node < 0)
+		return (-1);
+	l = sizeof cpu;
+	if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &l) ||
+	    cpu < 0 || cpu >= NUMA_MAX_CPUS || numa_cpu2node[cpu] < 0)
+		return (-1);
+	return (numa_cpu2node[cpu] == node);
+#else
+	(void)fd;
+	(void)node;
+	return (-1);
+#endif
+}
+
+#else /* HAVE_LINUX_MEMPOLICY_H */
+
+void
+NUMA_Init(void)
+{
+}
+
+int
+NUMA_PoolNode(unsigned pool_no)
+{
+
+	(void)pool_no;
+	return (-1);
+}
+
+void
+NUMA_Bind(int node)
+{
+
+	(void)node;
+}
+
+void
+NUMA_Steer(int sock, int node, unsigned pool_no)
+{
+
+	(void)sock;
+	(void)node;
+	(void)pool_no;
+}
+
+int
+NUMA_Local(int fd, int node)
+{
+
+	(void)fd;
+	(void)node;
+	return (-1);
+}
+
+#endif /* HAVE_LINUX_MEMPOLICY_H */
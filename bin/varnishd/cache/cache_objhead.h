@@ -31,6 +31,7 @@
  */
 
 struct hash_slinger;
+struct hsh_vidx;
 
 struct objhead {
 	unsigned		magic;
@@ -38,9 +39,18 @@ struct objhead {
 
 	int			refcnt;
 	struct lock		mtx;
-	VTAILQ_HEAD(,objcore)	objcs;
+	VTAILQ_HEAD(objcorehead_s, objcore)	objcs;
 	uint8_t			digest[DIGEST_LEN];
 	VTAILQ_HEAD(, req)	waitinglist;
+	unsigned		nwaiting;	/* changed under mtx */
+
+	/* Lockless hit path, see HSH_Lookup() */
+	struct objcore		*hot;
+	unsigned		hot_epoch;
+	unsigned		hot_readers[2];
+
+	/* Variant index, see hsh_vidx_*() */
+	struct hsh_vidx		*vidx;
 
 	/*----------------------------------------------------
 	 * The fields below are for the sole private use of
@@ -56,6 +66,15 @@ struct objhead {
 #define hoh_head _u.n.u_n_hoh_head
 };
 
+/*
+ * The lockless hit path gains objcore references and counts hits
+ * without oh->mtx, so these must always be changed atomically.
+ */
+#define OC_REFCNT_INC(oc)						\
+	((void)__atomic_add_fetch(&(oc)->refcnt, 1, __ATOMIC_SEQ_CST))
+#define OC_HITS_INC(oc)							\
+	((void)__atomic_add_fetch(&(oc)->hits, 1, __ATOMIC_RELAXED))
+
 enum lookup_e {
 	HSH_MISS,
 	HSH_HITMISS,
@@ -42,11 +42,14 @@
 #include "cache_varnishd.h"
 #include "cache_pool.h"
 
+#include "vtim.h"
+
 static pthread_t		thr_pool_herder;
 
 static struct lock		wstat_mtx;
 struct lock			pool_mtx;
 static VTAILQ_HEAD(,pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
+unsigned			pool_nqueued;
 
 /*--------------------------------------------------------------------
  * Summing of stats into global stats counters
@@ -95,6 +98,85 @@ Pool_Task_Any(struct pool_task *task, enum task_prio prio)
 	return (Pool_Task(pp, task, prio));
 }
 
+/*--------------------------------------------------------------------
+ * Work stealing between pools
+ *
+ * When a pool queues a task and its queue is at least thread_pool_steal
+ * long, an idle worker in a sibling pool is woken up with a no-op task.
+ * Workers finding their own pool without queued tasks then take tasks
+ * from the head of a sibling queue which is at least that long.
+ *
+ * Acceptor and background tasks are never stolen, and a worker does not
+ * steal work of a priority its own pool would not run with the current
+ * number of idle threads.
+ */
+
+static void v_matchproto_(task_func_t)
+pool_steal_wakeup(struct worker *wrk, void *priv)
+{
+
+	(void)wrk;
+	(void)priv;
+}
+
+void
+Pool_Steal_Wakeup(const struct pool *pp)
+{
+	static struct pool_task task = { .func = pool_steal_wakeup };
+	struct pool *vp;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_Lock(&pool_mtx);
+	VTAILQ_FOREACH(vp, &pools, list) {
+		CHECK_OBJ_NOTNULL(vp, POOL_MAGIC);
+		if (vp == pp || vp->die || vp->lqueue > 0 || vp->nidle == 0)
+			continue;
+		/* BG tasks are never queued, only handed to idle threads */
+		if (!Pool_Task(vp, &task, TASK_QUEUE_BG))
+			break;
+	}
+	Lck_Unlock(&pool_mtx);
+}
+
+struct pool_task *
+Pool_Steal(struct pool *pp, unsigned maxprio)
+{
+	struct pool *vp;
+	struct pool_task *tp = NULL;
+	unsigned i, lim;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	lim = cache_param->wthread_steal;
+	if (lim == 0 || __atomic_load_n(&pool_nqueued, __ATOMIC_RELAXED) < lim)
+		return (NULL);
+	if (maxprio > TASK_QUEUE_VCA)
+		maxprio = TASK_QUEUE_VCA;
+
+	Lck_Lock(&pool_mtx);
+	VTAILQ_FOREACH(vp, &pools, list) {
+		CHECK_OBJ_NOTNULL(vp, POOL_MAGIC);
+		if (vp == pp || vp->die || vp->lqueue < lim)
+			continue;
+		Lck_Lock(&vp->mtx);
+		for (i = 0; i < maxprio && vp->lqueue >= lim; i++) {
+			tp = VTAILQ_FIRST(&vp->queues[i]);
+			if (tp == NULL)
+				continue;
+			VTAILQ_REMOVE(&vp->queues[i], tp, list);
+			Pool_Dequeued(vp, tp, VTIM_mono());
+			vp->lqueue--;
+			vp->ndequeued--;
+			__atomic_sub_fetch(&pool_nqueued, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		Lck_Unlock(&vp->mtx);
+		if (tp != NULL)
+			break;
+	}
+	Lck_Unlock(&pool_mtx);
+	return (tp);
+}
+
 /*--------------------------------------------------------------------
  * Helper function to update stats for purges under lock
  */
@@ -126,6 +208,7 @@ pool_stat_summ(struct worker *wrk, void *priv)
 
 	Lck_Lock(&wstat_mtx);
 	VSC_main_Summ_wrk(VSC_C_main, src);
+	VSL_Sumstat();
 
 	Lck_Lock(&pp->mtx);
 	VSC_main_Summ_pool(VSC_C_main, pp->stats);
@@ -163,13 +246,23 @@ pool_mkpool(unsigned pool_no)
 	for (i = 0; i < TASK_QUEUE_RESERVE; i++)
 		VTAILQ_INIT(&pp->queues[i]);
 	PTOK(pthread_cond_init(&pp->herder_cond, NULL));
+
+	/* Threads started from here on inherit the NUMA placement */
+	pp->pool_no = pool_no;
+	pp->numa_node = NUMA_PoolNode(pool_no);
+	if (pp->numa_node >= 0)
+		NUMA_Bind(pp->numa_node);
+
 	PTOK(pthread_create(&pp->herder_thr, NULL, pool_herder, pp));
 
 	while (VTAILQ_EMPTY(&pp->idle_queue))
 		(void)usleep(10000);
 
 	SES_NewPool(pp, pool_no);
-	VCA_NewPool(pp);
+	VCA_NewPool(pp, pool_no);
+
+	if (pp->numa_node >= 0)
+		NUMA_Bind(-1);
 
 	return (pp);
 }
@@ -186,8 +279,9 @@ static void * v_matchproto_()
 pool_poolherder(void *priv)
 {
 	unsigned nwq;
-	struct pool *pp, *ppx;
+	struct pool *pp, *ppx, *heir;
 	uint64_t u;
+	vtim_dur lat;
 	void *rvp;
 
 	THR_SetName("pool_poolherder");
@@ -215,16 +309,20 @@ pool_poolherder(void *priv)
 			VTAILQ_INSERT_TAIL(&pools, pp, list);
 			if (!pp->die)
 				nwq--;
+			VTAILQ_FOREACH(heir, &pools, list)
+				if (heir != pp && !heir->die)
+					break;
 			Lck_Unlock(&pool_mtx);
 			if (!pp->die) {
 				VSL(SLT_Debug, NO_VXID, "XXX Kill Pool %p", pp);
+				VCA_DestroyPool(pp, heir);
 				pp->die = 1;
-				VCA_DestroyPool(pp);
 				PTOK(pthread_cond_signal(&pp->herder_cond));
 			}
 		}
 		(void)sleep(1);
 		u = 0;
+		lat = 0.;
 		ppx = NULL;
 		Lck_Lock(&pool_mtx);
 		VTAILQ_FOREACH(pp, &pools, list) {
@@ -233,6 +331,7 @@ pool_poolherder(void *priv)
 			if (pp->die && pp->nthr == 0)
 				ppx = pp;
 			u += pp->lqueue;
+			lat = vmax(lat, pp->lat_p99);
 		}
 		if (ppx != NULL) {
 			VTAILQ_REMOVE(&pools, ppx, list);
@@ -247,6 +346,7 @@ pool_poolherder(void *priv)
 		}
 		Lck_Unlock(&pool_mtx);
 		VSC_C_main->thread_queue_len = u;
+		VSC_C_main->thread_queue_latency = (uint64_t)(lat * 1e6);
 	}
 	NEEDLESS(return (NULL));
 }
@@ -280,6 +380,7 @@ Pool_Init(void)
 
 	Lck_New(&wstat_mtx, lck_wstat);
 	Lck_New(&pool_mtx, lck_wq);
+	NUMA_Init();
 	PTOK(pthread_create(&thr_pool_herder, NULL, pool_poolherder, NULL));
 	while (!VSC_C_main->pools)
 		(void)usleep(10000);
@@ -56,6 +56,19 @@ struct pool {
 	struct VSC_main_wrk		*a_stat;
 	struct VSC_main_wrk		*b_stat;
 
+	int				numa_node;
+	unsigned			pool_no;
+
+	/* Queue latency controller, see pool_adapt() */
+#define POOL_LAT_BUCKETS		24
+	vtim_mono			t_window;
+	unsigned			ntask;
+	unsigned			nbusy;
+	unsigned			lat[POOL_LAT_BUCKETS];
+	vtim_dur			lat_p99;
+	vtim_dur			breed_cost;
+	unsigned			want;
+
 	struct mempool			*mpl_req;
 	struct mempool			*mpl_sess;
 	struct waiter			*waiter;
@@ -64,5 +77,16 @@ struct pool {
 void *pool_herder(void*);
 task_func_t pool_stat_summ;
 extern struct lock			pool_mtx;
-void VCA_NewPool(struct pool *);
-void VCA_DestroyPool(struct pool *);
+extern unsigned				pool_nqueued;
+void Pool_Steal_Wakeup(const struct pool *);
+struct pool_task *Pool_Steal(struct pool *, unsigned maxprio);
+void Pool_Dequeued(struct pool *, const struct pool_task *, vtim_mono now);
+void VCA_NewPool(struct pool *, unsigned pool_no);
+void VCA_DestroyPool(struct pool *, struct pool *heir);
+
+/* cache_numa.c */
+void NUMA_Init(void);
+int NUMA_PoolNode(unsigned pool_no);
+void NUMA_Bind(int node);
+void NUMA_Steer(int sock, int node, unsigned pool_no);
+int NUMA_Local(int fd, int node);
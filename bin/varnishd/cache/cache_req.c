@@ -56,7 +56,7 @@ Req_AcctLogCharge(struct VSC_main_wrk *ds, struct req *req)
 	a = &req->acct;
 
 	if (!IS_NO_VXID(req->vsl->wid) && !(req->res_mode & RES_PIPE)) {
-		VSLb(req->vsl, SLT_ReqAcct, "%ju %ju %ju %ju %ju %ju",
+		VSLb_uint(req->vsl, SLT_ReqAcct, 6,
 		    (uintmax_t)a->req_hdrbytes,
 		    (uintmax_t)a->req_bodybytes,
 		    (uintmax_t)(a->req_hdrbytes + a->req_bodybytes),
@@ -32,6 +32,7 @@
 #include "config.h"
 
 #include "cache_varnishd.h"
+#include "cache_pool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -91,15 +92,31 @@ strands_cat(char *buf, unsigned bufl, const struct strands *s)
 }
 
 /* These cannot be struct lock, which depends on vsm/vsl working */
-static pthread_mutex_t vsl_mtx;
 static pthread_mutex_t vsc_mtx;
 static pthread_mutex_t vsm_mtx;
 
+struct vsl_ring {
+	pthread_mutex_t		mtx;
+	struct VSL_ring		*head;
+	uint32_t		*log;
+	const uint32_t		*end;
+	uint32_t		*ptr;
+	unsigned		segment_n;
+
+	/* Counted under mtx, see VSL_Sumstat() */
+	uint64_t		shm_writes;
+	uint64_t		shm_flushes;
+	uint64_t		shm_records;
+	uint64_t		shm_bytes;
+	uint64_t		shm_cont;
+	uint64_t		shm_cycles;
+};
+
 static struct VSL_head		*vsl_head;
-static const uint32_t		*vsl_end;
-static uint32_t			*vsl_ptr;
-static unsigned			vsl_segment_n;
+static struct vsl_ring		*vsl_rings;
+static unsigned			vsl_nring;
 static ssize_t			vsl_segsize;
+static uint32_t			vsl_seq;
 
 struct VSC_main *VSC_C_main;
 
@@ -142,18 +159,20 @@ VSL_tag_is_masked(enum VSL_tag_e tag)
  */
 
 static inline uint32_t *
-vsl_hdr(enum VSL_tag_e tag, uint32_t *p, unsigned len, vxid_t vxid)
+vsl_hdr(enum VSL_tag_e tag, uint32_t *p, unsigned len, vxid_t vxid,
+    unsigned ver)
 {
 
 	AZ((uintptr_t)p & 0x3);
 	assert(tag > SLT__Bogus);
 	assert(tag < SLT__Reserved);
 	AZ(len & ~VSL_LENMASK);
+	AZ(ver & ~VSL_VERMASK);
 
 	p[2] = vxid.vxid >> 32;
 	p[1] = vxid.vxid;
 	p[0] = (((unsigned)tag & VSL_IDMASK) << VSL_IDSHIFT) |
-	     (VSL_VERSION_3 << VSL_VERSHIFT) |
+	     (ver << VSL_VERSHIFT) |
 	     len;
 	return (VSL_END(p, len));
 }
@@ -179,76 +198,133 @@ vsl_space(const struct vsl_log *vsl)
 }
 
 /*--------------------------------------------------------------------
- * Wrap the VSL buffer
+ * Wrap a VSL ring
  */
 
 static void
-vsl_wrap(void)
+vsl_wrap(struct vsl_ring *vr)
 {
 
-	assert(vsl_ptr >= vsl_head->log);
-	assert(vsl_ptr < vsl_end);
-	vsl_segment_n += VSL_SEGMENTS - (vsl_segment_n % VSL_SEGMENTS);
-	assert(vsl_segment_n % VSL_SEGMENTS == 0);
-	vsl_head->offset[0] = 0;
-	vsl_head->log[0] = VSL_ENDMARKER;
+	assert(vr->ptr >= vr->log);
+	assert(vr->ptr < vr->end);
+	vr->segment_n += VSL_SEGMENTS - (vr->segment_n % VSL_SEGMENTS);
+	assert(vr->segment_n % VSL_SEGMENTS == 0);
+	vr->head->offset[0] = 0;
+	vr->log[0] = VSL_ENDMARKER;
 	VWMB();
-	if (vsl_ptr != vsl_head->log) {
-		*vsl_ptr = VSL_WRAPMARKER;
-		vsl_ptr = vsl_head->log;
+	if (vr->ptr != vr->log) {
+		*vr->ptr = VSL_WRAPMARKER;
+		vr->ptr = vr->log;
+	}
+	vr->head->segment_n = vr->segment_n;
+	vr->shm_cycles++;
+}
+
+/*--------------------------------------------------------------------
+ * Threads log to the ring of their pool
+ */
+
+static struct vsl_ring *
+vsl_ring(void)
+{
+	struct worker *wrk;
+
+	if (vsl_nring == 1)
+		return (vsl_rings);
+	wrk = THR_GetWorker();
+	if (wrk == NULL || wrk->pool == NULL)
+		return (vsl_rings);
+	CHECK_OBJ(wrk->pool, POOL_MAGIC);
+	return (&vsl_rings[wrk->pool->pool_no % vsl_nring]);
+}
+
+/*--------------------------------------------------------------------
+ * Add the counters of the rings to the shm_* statistics.  The caller
+ * serializes updates of VSC_C_main.
+ */
+
+void
+VSL_Sumstat(void)
+{
+	struct vsl_ring *vr;
+	unsigned u;
+
+	for (u = 0; u < vsl_nring; u++) {
+		vr = &vsl_rings[u];
+		PTOK(pthread_mutex_lock(&vr->mtx));
+		VSC_C_main->shm_writes += vr->shm_writes;
+		VSC_C_main->shm_flushes += vr->shm_flushes;
+		VSC_C_main->shm_records += vr->shm_records;
+		VSC_C_main->shm_bytes += vr->shm_bytes;
+		VSC_C_main->shm_cont += vr->shm_cont;
+		VSC_C_main->shm_cycles += vr->shm_cycles;
+		vr->shm_writes = 0;
+		vr->shm_flushes = 0;
+		vr->shm_records = 0;
+		vr->shm_bytes = 0;
+		vr->shm_cont = 0;
+		vr->shm_cycles = 0;
+		PTOK(pthread_mutex_unlock(&vr->mtx));
 	}
-	vsl_head->segment_n = vsl_segment_n;
-	VSC_C_main->shm_cycles++;
 }
 
 /*--------------------------------------------------------------------
- * Reserve bytes for a record, wrap if necessary
+ * Reserve bytes for a record, wrap if necessary.  The space is marked
+ * pending, and with several rings gets the sequence number of the
+ * record.
  */
 
 static uint32_t *
 vsl_get(unsigned len, unsigned records, unsigned flushes)
 {
+	struct vsl_ring *vr;
 	uint32_t *p;
 	int err;
 
-	err = pthread_mutex_trylock(&vsl_mtx);
+	vr = vsl_ring();
+	err = pthread_mutex_trylock(&vr->mtx);
 	if (err == EBUSY) {
-		PTOK(pthread_mutex_lock(&vsl_mtx));
-		VSC_C_main->shm_cont++;
+		PTOK(pthread_mutex_lock(&vr->mtx));
+		vr->shm_cont++;
 	} else {
 		AZ(err);
 	}
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
+	assert(vr->ptr < vr->end);
+	AZ((uintptr_t)vr->ptr & 0x3);
 
-	VSC_C_main->shm_writes++;
-	VSC_C_main->shm_flushes += flushes;
-	VSC_C_main->shm_records += records;
-	VSC_C_main->shm_bytes +=
-	    VSL_BYTES(VSL_OVERHEAD + VSL_WORDS((uint64_t)len));
+	vr->shm_writes++;
+	vr->shm_flushes += flushes;
+	vr->shm_records += records;
+	vr->shm_bytes += VSL_BYTES(VSL_OVERHEAD + VSL_WORDS((uint64_t)len));
 
 	/* Wrap if necessary */
-	if (VSL_END(vsl_ptr, len) >= vsl_end)
-		vsl_wrap();
+	if (VSL_END(vr->ptr, len) >= vr->end)
+		vsl_wrap(vr);
 
-	p = vsl_ptr;
-	vsl_ptr = VSL_END(vsl_ptr, len);
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
+	p = vr->ptr;
+	vr->ptr = VSL_END(vr->ptr, len);
+	assert(vr->ptr < vr->end);
+	AZ((uintptr_t)vr->ptr & 0x3);
 
-	*vsl_ptr = VSL_ENDMARKER;
+	*vr->ptr = VSL_ENDMARKER;
 
-	while ((vsl_ptr - vsl_head->log) / vsl_segsize >
-	    vsl_segment_n % VSL_SEGMENTS) {
-		vsl_segment_n++;
-		vsl_head->offset[vsl_segment_n % VSL_SEGMENTS] =
-		    vsl_ptr - vsl_head->log;
+	/* Taken under the lock, so sequence numbers grow in each ring */
+	if (vsl_nring > 1)
+		VSL_SEQ(p) = __atomic_add_fetch(&vsl_seq, 1, __ATOMIC_SEQ_CST);
+	VWMB();
+	p[0] = VSL_PENDMARKER;
+
+	while ((vr->ptr - vr->log) / vsl_segsize >
+	    vr->segment_n % VSL_SEGMENTS) {
+		vr->segment_n++;
+		vr->head->offset[vr->segment_n % VSL_SEGMENTS] =
+		    vr->ptr - vr->log;
 	}
 
-	PTOK(pthread_mutex_unlock(&vsl_mtx));
+	PTOK(pthread_mutex_unlock(&vr->mtx));
 	/* Implicit VWMB() in mutex op ensures ENDMARKER and new table
 	   values are seen before new segment number */
-	vsl_head->segment_n = vsl_segment_n;
+	vr->head->segment_n = vr->segment_n;
 
 	return (p);
 }
@@ -261,7 +337,7 @@ static void
 vslr(enum VSL_tag_e tag, vxid_t vxid, const char *b, unsigned len)
 {
 	uint32_t *p;
-	unsigned mlen;
+	unsigned mlen, l;
 
 	mlen = cache_param->vsl_reclen;
 
@@ -269,6 +345,18 @@ vslr(enum VSL_tag_e tag, vxid_t vxid, const char *b, unsigned len)
 	if (len > mlen)
 		len = mlen;
 
+	if (vsl_nring > 1) {
+		/* Only batches have a sequence number to merge rings by */
+		l = VSL_BYTES(VSL_OVERHEAD + VSL_WORDS(len));
+		p = vsl_get(l, 1, 0);
+		memcpy(p + 2 * VSL_OVERHEAD, b, len);
+		(void)vsl_hdr(tag, p + VSL_OVERHEAD, len, vxid, VSL_VERSION_3);
+		p[1] = l;
+		VWMB();
+		p[0] = ((((unsigned)SLT__Batch & 0xff) << VSL_IDSHIFT));
+		return;
+	}
+
 	p = vsl_get(len, 1, 0);
 
 	memcpy(p + VSL_OVERHEAD, b, len);
@@ -281,7 +369,7 @@ vslr(enum VSL_tag_e tag, vxid_t vxid, const char *b, unsigned len)
 	p[2] = vxid.vxid >> 32;
 	p[1] = vxid.vxid;
 	VWMB();
-	(void)vsl_hdr(tag, p, len, vxid);
+	(void)vsl_hdr(tag, p, len, vxid, VSL_VERSION_3);
 }
 
 /*--------------------------------------------------------------------
@@ -384,7 +472,7 @@ vslb_get(struct vsl_log *vsl, enum VSL_tag_e tag, unsigned *length)
 	if (VSL_END(vsl->wlp, mlen) > vsl->wle)
 		mlen = vsl_space(vsl);
 
-	vsl->wlp = vsl_hdr(tag, vsl->wlp, mlen, vsl->wid);
+	vsl->wlp = vsl_hdr(tag, vsl->wlp, mlen, vsl->wid, VSL_VERSION_3);
 	vsl->wlr++;
 	*length = mlen;
 	return (retval);
@@ -513,13 +601,104 @@ VSLb(struct vsl_log *vsl, enum VSL_tag_e tag, const char *fmt, ...)
 	va_end(ap);
 }
 
+/*--------------------------------------------------------------------
+ * VSL-buffered-packed, see vapi/vsl_int.h for the format.  We only pack
+ * a record if its rendering fits vsl_reclen, so it reads the same as
+ * the text record would have.
+ */
+
+#define VSL_PACK_UINT_MAX	8
+#define VSL_PACK_UINT_TXT	21	/* "%ju " */
+#define VSL_PACK_TS_TXT		(2 + 3 * 28)	/* ": " + "%ju.%06ju " x3 */
+
+static unsigned
+vsl_pack_uint(uint8_t *p, uintmax_t u)
+{
+	unsigned l = 0;
+
+	do {
+		p[l] = u & 0x7f;
+		u >>= 7;
+		if (u != 0)
+			p[l] |= 0x80;
+		l++;
+	} while (u != 0);
+	return (l);
+}
+
+static void
+vslb_packed(struct vsl_log *vsl, enum VSL_tag_e tag, const uint8_t *b,
+    unsigned len)
+{
+
+	assert(len <= cache_param->vsl_reclen);
+	if (VSL_END(vsl->wlp, len) > vsl->wle)
+		VSL_Flush(vsl, 1);
+	assert(VSL_END(vsl->wlp, len) <= vsl->wle);
+	memcpy(VSL_DATA(vsl->wlp), b, len);
+	vsl->wlp = vsl_hdr(tag, vsl->wlp, len, vsl->wid, VSL_VERSION_PACKED);
+	vsl->wlr++;
+
+	if (DO_DEBUG(DBG_SYNCVSL))
+		VSL_Flush(vsl, 0);
+}
+
+void
+VSLb_uint(struct vsl_log *vsl, enum VSL_tag_e tag, unsigned n, ...)
+{
+	uint8_t b[1 + VSL_PACK_UINT_MAX * 10];
+	char t[VSL_PACK_UINT_MAX * VSL_PACK_UINT_TXT];
+	unsigned i, l = 0;
+	int packed;
+	va_list ap;
+
+	vsl_sanity(vsl);
+	assert(n > 0 && n <= VSL_PACK_UINT_MAX);
+	if (vsl_tag_is_masked(tag))
+		return;
+
+	packed = cache_param->vsl_packed &&
+	    n * VSL_PACK_UINT_TXT <= cache_param->vsl_reclen;
+	if (packed)
+		b[l++] = VSL_PACK_UINT;
+	va_start(ap, n);
+	for (i = 0; i < n; i++) {
+		if (packed)
+			l += vsl_pack_uint(b + l, va_arg(ap, uintmax_t));
+		else
+			l += snprintf(t + l, sizeof t - l, "%s%ju",
+			    i ? " " : "", va_arg(ap, uintmax_t));
+	}
+	va_end(ap);
+
+	if (packed) {
+		assert(l <= sizeof b);
+		vslb_packed(vsl, tag, b, l);
+	} else {
+		assert(l < sizeof t);
+		vslb_simple(vsl, tag, l, t);
+	}
+}
+
 #define Tf6 "%ju.%06ju"
 #define Ta6(t) (uintmax_t)floor((t)), (uintmax_t)floor((t) * 1e6) % 1000000U
 
+static unsigned
+vsl_pack_ts(uint8_t *p, vtim_real t)
+{
+	unsigned l;
+
+	l = vsl_pack_uint(p, (uintmax_t)floor(t));
+	l += vsl_pack_uint(p + l, (uintmax_t)floor(t * 1e6) % 1000000U);
+	return (l);
+}
+
 void
 VSLb_ts(struct vsl_log *vsl, const char *event, vtim_real first,
     vtim_real *pprev, vtim_real now)
 {
+	uint8_t b[1 + VSL_UNPACKED_MAX + 3 * 20];
+	size_t l;
 
 	/*
 	 * XXX: Make an option to turn off some unnecessary timestamp
@@ -531,8 +710,22 @@ VSLb_ts(struct vsl_log *vsl, const char *event, vtim_real first,
 	AN(event);
 	AN(pprev);
 	assert(!isnan(now) && now != 0.);
-	VSLb(vsl, SLT_Timestamp, "%s: " Tf6 " " Tf6 " " Tf6,
-	    event, Ta6(now), Ta6(now - first), Ta6(now - *pprev));
+	l = strlen(event);
+	if (cache_param->vsl_packed && !vsl_tag_is_masked(SLT_Timestamp) &&
+	    l + VSL_PACK_TS_TXT <= vmin_t(unsigned, cache_param->vsl_reclen,
+	    VSL_UNPACKED_MAX)) {
+		b[0] = VSL_PACK_TS;
+		memcpy(b + 1, event, l + 1);
+		l += 2;
+		l += vsl_pack_ts(b + l, now);
+		l += vsl_pack_ts(b + l, now - first);
+		l += vsl_pack_ts(b + l, now - *pprev);
+		assert(l <= sizeof b);
+		vslb_packed(vsl, SLT_Timestamp, b, l);
+	} else {
+		VSLb(vsl, SLT_Timestamp, "%s: " Tf6 " " Tf6 " " Tf6,
+		    event, Ta6(now), Ta6(now - first), Ta6(now - *pprev));
+	}
 	*pprev = now;
 }
 
@@ -559,7 +752,7 @@ VSLb_bin(struct vsl_log *vsl, enum VSL_tag_e tag, ssize_t len, const void *ptr)
 	assert(VSL_END(vsl->wlp, len) <= vsl->wle);
 	p = VSL_DATA(vsl->wlp);
 	memcpy(p, ptr, len);
-	vsl->wlp = vsl_hdr(tag, vsl->wlp, len, vsl->wid);
+	vsl->wlp = vsl_hdr(tag, vsl->wlp, len, vsl->wid, VSL_VERSION_3);
 	assert(vsl->wlp <= vsl->wle);
 	vsl->wlr++;
 
@@ -650,11 +843,12 @@ vsm_vsmw_unlock(void)
 void
 VSM_Init(void)
 {
-	unsigned u;
+	struct vsl_ring *vr;
+	size_t space;
+	unsigned u, v;
 
 	assert(UINT_MAX % VSL_SEGMENTS == VSL_SEGMENTS - 1);
 
-	PTOK(pthread_mutex_init(&vsl_mtx, &mtxattr_errorcheck));
 	PTOK(pthread_mutex_init(&vsc_mtx, &mtxattr_errorcheck));
 	PTOK(pthread_mutex_init(&vsm_mtx, &mtxattr_errorcheck));
 
@@ -673,22 +867,40 @@ VSM_Init(void)
 	vsl_head = VSMW_Allocf(heritage.proc_vsmw, NULL, VSL_CLASS,
 	    cache_param->vsl_space, VSL_CLASS);
 	AN(vsl_head);
-	vsl_segsize = ((cache_param->vsl_space - sizeof *vsl_head) /
-	    sizeof *vsl_end) / VSL_SEGMENTS;
-	vsl_end = vsl_head->log + vsl_segsize * VSL_SEGMENTS;
-	/* Make segment_n always overflow on first log wrap to make any
-	   problems with regard to readers on that event visible */
-	vsl_segment_n = UINT_MAX - (VSL_SEGMENTS - 1);
-	AZ(vsl_segment_n % VSL_SEGMENTS);
-	vsl_ptr = vsl_head->log;
-	*vsl_ptr = VSL_ENDMARKER;
+	space = (cache_param->vsl_space - sizeof *vsl_head) / sizeof(uint32_t);
+
+	/* Each segment of a ring must hold a full VSL buffer */
+	vsl_nring = vmin(cache_param->vsl_rings, VSL_RINGS_MAX);
+	while (vsl_nring > 1 && VSL_BYTES(space / VSL_SEGMENTS / vsl_nring) <
+	    cache_param->vsl_buffer)
+		vsl_nring--;
+	vsl_segsize = space / VSL_SEGMENTS / vsl_nring;
 
 	memset(vsl_head, 0, sizeof *vsl_head);
 	vsl_head->segsize = vsl_segsize;
-	vsl_head->offset[0] = 0;
-	vsl_head->segment_n = vsl_segment_n;
-	for (u = 1; u < VSL_SEGMENTS; u++)
-		vsl_head->offset[u] = -1;
+	vsl_head->nring = vsl_nring;
+
+	vsl_rings = calloc(vsl_nring, sizeof *vsl_rings);
+	AN(vsl_rings);
+	for (u = 0; u < vsl_nring; u++) {
+		vr = &vsl_rings[u];
+		PTOK(pthread_mutex_init(&vr->mtx, &mtxattr_errorcheck));
+		vr->head = &vsl_head->ring[u];
+		vr->log = vsl_head->log + u * vsl_segsize * VSL_SEGMENTS;
+		vr->end = vr->log + vsl_segsize * VSL_SEGMENTS;
+		/* Make segment_n always overflow on first log wrap to make
+		   any problems with regard to readers on that event
+		   visible */
+		vr->segment_n = UINT_MAX - (VSL_SEGMENTS - 1);
+		AZ(vr->segment_n % VSL_SEGMENTS);
+		vr->ptr = vr->log;
+		*vr->ptr = VSL_ENDMARKER;
+
+		vr->head->offset[0] = 0;
+		vr->head->segment_n = vr->segment_n;
+		for (v = 1; v < VSL_SEGMENTS; v++)
+			vr->head->offset[v] = -1;
+	}
 	VWMB();
 	memcpy(vsl_head->marker, VSL_HEAD_MARKER, sizeof vsl_head->marker);
 }
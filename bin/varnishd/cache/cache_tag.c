@@ -0,0 +1,411 @@
+/*-
+ * Copyright (c) 2024 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Tag index (surrogate keys)
+ *
+ * Objects are indexed by the tokens of the response header named by the
+ * tag_header parameter, so all objects with a tag can be purged without
+ * testing every object in the cache, as a ban would.
+ *
+ * An object is added when it is unbusied and removed when the objcore
+ * is freed.  The index holds no references: purging takes a reference
+ * on each object with the objhead locked, and tag_mtx keeps the objcore
+ * (and thus its objhead) around until then.  The lock order is tag_mtx
+ * before objhead mutexes.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "cache_varnishd.h"
+#include "cache_objhead.h"
+
+#include "vcli_serve.h"
+#include "vct.h"
+#include "vtim.h"
+#include "vtree.h"
+
+#include "hash/hash_slinger.h"
+
+#define TAG_PURGE_BATCH		64
+
+struct tag_key {
+	unsigned		magic;
+#define TAG_KEY_MAGIC		0x2b7d90e1
+	VRBT_ENTRY(tag_key)	entry;
+	VTAILQ_HEAD(, tag_ref)	refs;
+	const char		*name;
+	size_t			len;
+};
+
+struct tag_ref {
+	unsigned		magic;
+#define TAG_REF_MAGIC		0x61a0c5f4
+	struct objcore		*oc;
+	struct tag_key		*key;
+	VTAILQ_ENTRY(tag_ref)	list;
+	struct tag_ref		*next;		/* of the same objcore */
+};
+
+VRBT_HEAD(tag_keys, tag_key);
+
+static struct lock tag_mtx;
+static struct tag_keys tag_keys = VRBT_INITIALIZER(&tag_keys);
+static char *tag_hdr;
+
+static inline int
+tag_cmp(const struct tag_key *a, const struct tag_key *b)
+{
+
+	if (a->len != b->len)
+		return (a->len < b->len ? -1 : 1);
+	return (memcmp(a->name, b->name, a->len));
+}
+
+VRBT_GENERATE_INSERT_COLOR(tag_keys, tag_key, entry, static)
+VRBT_GENERATE_FIND(tag_keys, tag_key, entry, tag_cmp, static)
+VRBT_GENERATE_INSERT_FINISH(tag_keys, tag_key, entry, static)
+VRBT_GENERATE_INSERT(tag_keys, tag_key, entry, tag_cmp, static)
+VRBT_GENERATE_REMOVE_COLOR(tag_keys, tag_key, entry, static)
+VRBT_GENERATE_REMOVE(tag_keys, tag_key, entry, static)
+
+/*--------------------------------------------------------------------
+ * Split a list of tags on white space and commas.
+ */
+
+static const char *
+tag_next(const char **pp, size_t *lp)
+{
+	const char *p, *b;
+
+	for (p = *pp; *p == ',' || vct_islws(*p); p++)
+		continue;
+	if (*p == '\0')
+		return (NULL);
+	for (b = p; *p != '\0' && *p != ',' && !vct_islws(*p); p++)
+		continue;
+	*lp = p - b;
+	*pp = p;
+	return (b);
+}
+
+static struct tag_key *
+tag_find(const char *name, size_t len)
+{
+	struct tag_key needle, *tk;
+
+	Lck_AssertHeld(&tag_mtx);
+	INIT_OBJ(&needle, TAG_KEY_MAGIC);
+	needle.name = name;
+	needle.len = len;
+	tk = VRBT_FIND(tag_keys, &tag_keys, &needle);
+	CHECK_OBJ_ORNULL(tk, TAG_KEY_MAGIC);
+	return (tk);
+}
+
+static void
+tag_add(struct objcore *oc, const char *name, size_t len)
+{
+	struct tag_key *tk, *tk2;
+	struct tag_ref *tr;
+
+	Lck_AssertHeld(&tag_mtx);
+
+	tk = tag_find(name, len);
+	if (tk == NULL) {
+		tk = malloc(sizeof *tk + len);
+		AN(tk);
+		INIT_OBJ(tk, TAG_KEY_MAGIC);
+		VTAILQ_INIT(&tk->refs);
+		memcpy(tk + 1, name, len);
+		tk->name = (const char *)(tk + 1);
+		tk->len = len;
+		tk2 = VRBT_INSERT(tag_keys, &tag_keys, tk);
+		AZ(tk2);
+		VSC_C_main->tags++;
+		VSC_C_main->tag_bytes += sizeof *tk + len;
+	} else {
+		for (tr = oc->tags; tr != NULL; tr = tr->next)
+			if (tr->key == tk)
+				return;
+	}
+	ALLOC_OBJ(tr, TAG_REF_MAGIC);
+	AN(tr);
+	tr->oc = oc;
+	tr->key = tk;
+	VTAILQ_INSERT_TAIL(&tk->refs, tr, list);
+	tr->next = oc->tags;
+	oc->tags = tr;
+	VSC_C_main->tag_refs++;
+	VSC_C_main->tag_bytes += sizeof *tr;
+}
+
+/*--------------------------------------------------------------------
+ * Index a new object under its tags
+ */
+
+void
+TAG_NewObjCore(struct worker *wrk, struct objcore *oc)
+{
+	const char *hp, *p, *b;
+	size_t l, len;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(oc->tags);
+
+	if (tag_hdr == NULL || oc->flags & OC_F_PRIVATE)
+		return;
+
+	l = tag_hdr[0];
+	HTTP_FOREACH_PACK(wrk, oc, hp) {
+		if (strncasecmp(hp, tag_hdr + 1, l))
+			continue;
+		p = hp + l;
+		Lck_Lock(&tag_mtx);
+		while ((b = tag_next(&p, &len)) != NULL)
+			tag_add(oc, b, len);
+		Lck_Unlock(&tag_mtx);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * An object is destroyed, take it out of the index
+ */
+
+void
+TAG_DestroyObj(struct objcore *oc)
+{
+	struct tag_ref *tr;
+	struct tag_key *tk;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(oc->refcnt);
+	if (oc->tags == NULL)
+		return;
+
+	Lck_Lock(&tag_mtx);
+	while (oc->tags != NULL) {
+		tr = oc->tags;
+		CHECK_OBJ(tr, TAG_REF_MAGIC);
+		oc->tags = tr->next;
+		tk = tr->key;
+		CHECK_OBJ_NOTNULL(tk, TAG_KEY_MAGIC);
+		VTAILQ_REMOVE(&tk->refs, tr, list);
+		FREE_OBJ(tr);
+		VSC_C_main->tag_refs--;
+		VSC_C_main->tag_bytes -= sizeof *tr;
+		if (!VTAILQ_EMPTY(&tk->refs))
+			continue;
+		VRBT_REMOVE(tag_keys, &tag_keys, tk);
+		VSC_C_main->tags--;
+		VSC_C_main->tag_bytes -= sizeof *tk + tk->len;
+		FREE_OBJ(tk);
+	}
+	Lck_Unlock(&tag_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Purge all objects with one tag, as HSH_Purge() does for an objhead.
+ * The last reference collected in a batch is kept as a bookmark into
+ * the tag's list of objects for the next one.
+ */
+
+static unsigned
+tag_purge(struct worker *wrk, const char *name, size_t len,
+    vtim_real ttl_now, vtim_dur ttl, vtim_dur grace, vtim_dur keep)
+{
+	struct objcore *oc, *ocp[TAG_PURGE_BATCH];
+	struct objhead *oh;
+	struct tag_key *tk;
+	struct tag_ref *tr;
+	unsigned i, j, n, total = 0;
+	int is_purge;
+
+	is_purge = (ttl == 0 && grace == 0 && keep == 0);
+
+	Lck_Lock(&tag_mtx);
+	tk = tag_find(name, len);
+	if (tk == NULL) {
+		Lck_Unlock(&tag_mtx);
+		return (0);
+	}
+	tr = VTAILQ_FIRST(&tk->refs);
+	n = 0;
+	while (1) {
+		for (; n < TAG_PURGE_BATCH && tr != NULL;
+		    tr = VTAILQ_NEXT(tr, list)) {
+			CHECK_OBJ_NOTNULL(tr, TAG_REF_MAGIC);
+			oc = tr->oc;
+			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+			oh = oc->objhead;
+			CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+			Lck_Lock(&oh->mtx);
+			if (oc->refcnt > 0 &&
+			    !(oc->flags & (OC_F_BUSY | OC_F_DYING))) {
+				OC_REFCNT_INC(oc);
+				ocp[n++] = oc;
+			}
+			Lck_Unlock(&oh->mtx);
+		}
+		Lck_Unlock(&tag_mtx);
+
+		if (n == 0)
+			break;
+
+		j = n;
+		if (tr != NULL) {
+			/* Keep the last one as bookmark */
+			j--;
+			assert(j >= 1);
+		}
+		for (i = 0; i < j; i++) {
+			if (is_purge)
+				HSH_Kill(ocp[i]);
+			else
+				EXP_Reduce(ocp[i], ttl_now, ttl, grace, keep);
+			(void)HSH_DerefObjCore(wrk, &ocp[i], 0);
+			AZ(ocp[i]);
+			total++;
+		}
+		if (j == n)
+			break;
+
+		Lck_Lock(&tag_mtx);
+		ocp[0] = ocp[j];
+		n = 1;
+		/* Our reference keeps the bookmark, and its key, indexed */
+		for (tr = ocp[0]->tags; tr != NULL; tr = tr->next)
+			if (tr->key == tk)
+				break;
+		CHECK_OBJ_NOTNULL(tr, TAG_REF_MAGIC);
+		tr = VTAILQ_NEXT(tr, list);
+	}
+	return (total);
+}
+
+/*--------------------------------------------------------------------
+ * Purge all objects with any of a list of tags.  With all of ttl, grace
+ * and keep zero, the objects are removed, otherwise their timers are
+ * reduced as for a soft purge.
+ */
+
+unsigned
+TAG_Purge(struct worker *wrk, const char *tags, vtim_real ttl_now,
+    vtim_dur ttl, vtim_dur grace, vtim_dur keep)
+{
+	const char *p, *b;
+	unsigned total = 0;
+	size_t len;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(tags);
+
+	p = tags;
+	while ((b = tag_next(&p, &len)) != NULL)
+		total += tag_purge(wrk, b, len, ttl_now, ttl, grace, keep);
+	if (ttl == 0 && grace == 0 && keep == 0)
+		Pool_PurgeStat(total);
+	return (total);
+}
+
+/*--------------------------------------------------------------------
+ * The CLI thread has no worker, give it one for dropping references
+ */
+
+static void v_matchproto_(cli_func_t)
+ccf_tag_purge(struct cli *cli, const char * const *av, void *priv)
+{
+	struct worker wrk[1];
+	struct worker_priv wpriv[1];
+	struct VSC_main_wrk ds;
+	vtim_dur grace, keep;
+	unsigned n = 0;
+	int i = 2;
+
+	(void)priv;
+	grace = keep = 0;
+	if (!strcmp(av[i], "-s")) {
+		grace = keep = NAN;
+		i++;
+	}
+	if (av[i] == NULL) {
+		VCLI_Out(cli, "No tags given");
+		VCLI_SetResult(cli, CLIS_PARAM);
+		return;
+	}
+	if (tag_hdr == NULL) {
+		VCLI_Out(cli, "No tag_header configured");
+		VCLI_SetResult(cli, CLIS_CANT);
+		return;
+	}
+
+	INIT_OBJ(wrk, WORKER_MAGIC);
+	INIT_OBJ(wpriv, WORKER_PRIV_MAGIC);
+	wrk->wpriv = wpriv;
+	memset(&ds, 0, sizeof ds);
+	wrk->stats = &ds;
+
+	for (; av[i] != NULL; i++)
+		n += TAG_Purge(wrk, av[i], VTIM_real(), 0, grace, keep);
+
+	HSH_Cleanup(wrk);
+	Pool_Sumstat(wrk);
+	VCLI_Out(cli, "%u", n);
+}
+
+static struct cli_proto tag_cmds[] = {
+	{ CLICMD_TAG_PURGE,			"", ccf_tag_purge },
+	{ NULL }
+};
+
+/*--------------------------------------------------------------------*/
+
+void
+TAG_Init(void)
+{
+	const char *hdr;
+	size_t l;
+
+	Lck_New(&tag_mtx, lck_tag);
+	CLI_AddFuncs(tag_cmds);
+
+	/* tag_header needs a restart, so it cannot change under us */
+	hdr = TRUST_ME(cache_param->tag_header);
+	if (*hdr == '\0')
+		return;
+	l = strlen(hdr);
+	assert(l < UINT8_MAX);
+	tag_hdr = malloc(l + 3);
+	AN(tag_hdr);
+	tag_hdr[0] = (char)(l + 1);
+	memcpy(tag_hdr + 1, hdr, l);
+	tag_hdr[l + 1] = ':';
+	tag_hdr[l + 2] = '\0';
+}
@@ -74,6 +74,29 @@ struct vxid_pool {
  * Private part of worker threads
  */
 
+/*
+ * A worker keeps a few free items of the mempools it uses, so it does not
+ * need the mempool lock for every MPL_Get() and MPL_Free().
+ */
+
+#define MPL_MAGS		4
+#define MPL_MAG_MAX		16
+
+struct memitem;
+
+struct mpl_mag {
+	struct mempool		*mpl;
+	unsigned		state;
+	VTAILQ_ENTRY(mpl_mag)	list;
+	unsigned		n;
+	unsigned		nsync;
+	unsigned		allocs;
+	unsigned		frees;
+	unsigned		hits;
+	unsigned		toosmall;
+	struct memitem		*item[MPL_MAG_MAX];
+};
+
 struct worker_priv {
 	unsigned		magic;
 #define WORKER_PRIV_MAGIC	0x3047db99
@@ -82,6 +105,7 @@ struct worker_priv {
 	void			*nhashpriv;
 	struct vxid_pool	vxid_pool[1];
 	struct vcl		*vcl;
+	struct mpl_mag		mpl_mag[MPL_MAGS];
 };
 
 /*--------------------------------------------------------------------
@@ -252,6 +276,7 @@ void BAN_Shutdown(void);
 void BAN_NewObjCore(struct objcore *oc);
 void BAN_DestroyObj(struct objcore *oc);
 int BAN_CheckObject(struct worker *, struct objcore *, struct req *);
+int BAN_Current(const struct objcore *);
 
 /* cache_busyobj.c */
 void VBO_Init(void);
@@ -327,6 +352,7 @@ struct mempool * MPL_New(const char *name, volatile struct poolparam *pp,
 void MPL_Destroy(struct mempool **mpp);
 void *MPL_Get(struct mempool *mpl, unsigned *size);
 void MPL_Free(struct mempool *mpl, void *item);
+void MPL_Cleanup(struct worker *wrk);
 
 /* cache_obj.c */
 void ObjInit(void);
@@ -466,6 +492,14 @@ void VSL_ChgId(struct vsl_log *vsl, const char *typ, const char *why,
     vxid_t vxid);
 void VSL_End(struct vsl_log *vsl);
 void VSL_Flush(struct vsl_log *, int overflow);
+void VSL_Sumstat(void);
+
+/* cache_tag.c */
+void TAG_Init(void);
+void TAG_NewObjCore(struct worker *, struct objcore *);
+void TAG_DestroyObj(struct objcore *);
+unsigned TAG_Purge(struct worker *, const char *tags, vtim_real ttl_now,
+    vtim_dur ttl, vtim_dur grace, vtim_dur keep);
 
 /* cache_conn_pool.c */
 struct conn_pool;
@@ -478,6 +512,10 @@ void VBP_Init(void);
 /* cache_vary.c */
 int VRY_Create(struct busyobj *bo, struct vsb **psb);
 int VRY_Match(const struct req *, const uint8_t *vary);
+uint32_t VRY_Hash(const uint8_t *vary);
+int VRY_Key(const struct req *, const uint8_t *vary, uint32_t *key);
+uint8_t *VRY_Shape(const uint8_t *vary);
+int VRY_SameShape(const uint8_t *shape, const uint8_t *vary);
 void VRY_Prep(struct req *);
 void VRY_Clear(struct req *);
 enum vry_finish_flag { KEEP, DISCARD };
@@ -577,6 +615,10 @@ void STV_BanExport(const uint8_t *banlist, unsigned len);
 // STV_NewObject() len is space for OBJ_VARATTR
 int STV_NewObject(struct worker *, struct objcore *,
     const struct stevedore *, unsigned len);
+int STV_Admit(struct worker *, const struct objcore *,
+    const struct stevedore *, ssize_t len);
+void STV_AgeLRU(void);
+int STV_FileRef(const void *ptr, size_t len, int *fd, off_t *off);
 
 struct stv_buffer;
 struct stv_buffer *STV_AllocBuf(struct worker *wrk, const struct stevedore *stv,
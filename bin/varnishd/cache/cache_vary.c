@@ -278,6 +278,52 @@ VRY_Finish(struct req *req, enum vry_finish_flag flg)
 	req->vary_b = p;
 }
 
+/**********************************************************************
+ * Build the entry for the header of vary from the request at vsp,
+ * and terminate the predictive vary string behind it.
+ *
+ * Return zero if there is not enough workspace.
+ */
+
+static int
+vry_build(const struct req *req, uint8_t *vsp, const uint8_t *vary)
+{
+	const char *h, *e;
+	unsigned lh, ln;
+
+	ln = 2 + vary[2] + 2;
+	if (http_GetHdr(req->http, (const char*)(vary+2), &h)) {
+		/* Trim trailing space */
+		e = strchr(h, '\0');
+		while (e > h && vct_issp(e[-1]))
+			e--;
+		lh = e - h;
+		assert(lh < 0xffff);
+		ln += lh;
+	} else {
+		e = h = NULL;
+		lh = 0xffff;
+	}
+
+	if (vsp + ln + 3 >= req->vary_e) {
+		/*
+		 * Not enough space to build new entry
+		 * and put terminator behind it.
+		 */
+		return (0);
+	}
+
+	vbe16enc(vsp, (uint16_t)lh);
+	memcpy(vsp + 2, vary + 2, vary[2] + 2);
+	if (h != NULL)
+		memcpy(vsp + 2 + vsp[2] + 2, h, lh);
+	vsp[ln++] = 0xff;
+	vsp[ln++] = 0xff;
+	vsp[ln++] = 0;
+	assert(VRY_Validate(vsp) == ln);
+	return (1);
+}
+
 /**********************************************************************
  * Match vary strings, and build a new cached string if possible.
  *
@@ -289,8 +335,6 @@ int
 VRY_Match(const struct req *req, const uint8_t *vary)
 {
 	uint8_t *vsp = req->vary_b;
-	const char *h, *e;
-	unsigned lh, ln;
 	int i, oflo = 0;
 
 	AN(vsp);
@@ -309,40 +353,10 @@ VRY_Match(const struct req *req, const uint8_t *vary)
 			 * Different header, build a new entry,
 			 * then compare again with that new entry.
 			 */
-
-			ln = 2 + vary[2] + 2;
-			i = http_GetHdr(req->http, (const char*)(vary+2), &h);
-			if (i) {
-				/* Trim trailing space */
-				e = strchr(h, '\0');
-				while (e > h && vct_issp(e[-1]))
-					e--;
-				lh = e - h;
-				assert(lh < 0xffff);
-				ln += lh;
-			} else {
-				e = h = NULL;
-				lh = 0xffff;
-			}
-
-			if (vsp + ln + 3 >= req->vary_e) {
-				/*
-				 * Not enough space to build new entry
-				 * and put terminator behind it.
-				 */
+			if (!vry_build(req, vsp, vary)) {
 				oflo = 1;
 				break;
 			}
-
-			vbe16enc(vsp, (uint16_t)lh);
-			memcpy(vsp + 2, vary + 2, vary[2] + 2);
-			if (h != NULL)
-				memcpy(vsp + 2 + vsp[2] + 2, h, lh);
-			vsp[ln++] = 0xff;
-			vsp[ln++] = 0xff;
-			vsp[ln++] = 0;
-			assert(VRY_Validate(vsp) == ln);
-
 			i = vry_cmp(vary, vsp);
 			assert(i == 0 || i == 2);
 		}
@@ -368,6 +382,128 @@ VRY_Match(const struct req *req, const uint8_t *vary)
 	}
 }
 
+/**********************************************************************
+ * Hash vary strings for the per-objhead variant index.
+ *
+ * Vary strings which compare equal get the same hash.  Since vry_cmp()
+ * ignores the contents of Accept-Encoding when http_gzip_support is on,
+ * and the parameter can change while the hash is stored, we never hash
+ * those contents.  A NULL vary string (no Vary on the object) hashes
+ * like an empty one.
+ */
+
+static uint32_t
+vry_hash(uint32_t h, const uint8_t *p, size_t l)
+{
+
+	/* FNV-1a */
+	while (l-- > 0) {
+		h ^= *p++;
+		h *= 16777619;
+	}
+	return (h);
+}
+
+static uint32_t
+vry_hash_entry(uint32_t h, const uint8_t *vary)
+{
+
+	if (http_hdr_eq(H_Accept_Encoding, (const char*)vary + 2))
+		return (vry_hash(h, vary + 2, vary[2] + 2));
+	return (vry_hash(h, vary, VRY_Len(vary)));
+}
+
+uint32_t
+VRY_Hash(const uint8_t *vary)
+{
+	uint32_t h = 2166136261;
+
+	if (vary == NULL)
+		return (h);
+	while (vary[2]) {
+		h = vry_hash_entry(h, vary);
+		vary += VRY_Len(vary);
+	}
+	return (h);
+}
+
+/*
+ * Build the predictive vary string for all the headers of vary, and
+ * return the VRY_Hash() which any matching object vary string must have.
+ *
+ * Return zero if we ran out of workspace.
+ */
+
+int
+VRY_Key(const struct req *req, const uint8_t *vary, uint32_t *key)
+{
+	uint8_t *vsp = req->vary_b;
+	uint32_t h = 2166136261;
+
+	AN(vsp);
+	AN(vary);
+	AN(key);
+	while (vary[2]) {
+		if (vsp + 2 >= req->vary_e || (vry_cmp(vary, vsp) == 1 &&
+		    !vry_build(req, vsp, vary))) {
+			vsp = req->vary_b;
+			if (vsp + 2 < req->vary_e) {
+				vsp[0] = 0xff;
+				vsp[1] = 0xff;
+				vsp[2] = 0;
+			}
+			return (0);
+		}
+		h = vry_hash_entry(h, vsp);
+		vsp += VRY_Len(vsp);
+		vary += VRY_Len(vary);
+	}
+	*key = h;
+	return (1);
+}
+
+/*
+ * The shape of a vary string is the list of headers it varies on.
+ * VRY_Shape() returns a malloc'ed copy of vary without the header
+ * contents, suitable for VRY_Key() and VRY_SameShape().
+ */
+
+uint8_t *
+VRY_Shape(const uint8_t *vary)
+{
+	uint8_t *p, *q;
+	unsigned l;
+
+	AN(vary);
+	p = malloc(VRY_Validate(vary));
+	AN(p);
+	for (q = p; vary[2]; vary += VRY_Len(vary)) {
+		vbe16enc(q, 0xffff);
+		l = vary[2] + 2;
+		memcpy(q + 2, vary + 2, l);
+		q += 2 + l;
+	}
+	q[0] = 0xff;
+	q[1] = 0xff;
+	q[2] = 0;
+	return (p);
+}
+
+int
+VRY_SameShape(const uint8_t *shape, const uint8_t *vary)
+{
+
+	AN(shape);
+	AN(vary);
+	while (shape[2] && vary[2]) {
+		if (memcmp(shape + 2, vary + 2, shape[2] + 2))
+			return (0);
+		shape += VRY_Len(shape);
+		vary += VRY_Len(vary);
+	}
+	return (shape[2] == vary[2]);
+}
+
 /*
  * Check the validity of a Vary string and return its total length
  */
@@ -1016,6 +1016,30 @@ VRT_purge(VRT_CTX, VCL_DURATION ttl, VCL_DURATION grace, VCL_DURATION keep)
 	    ctx->req->t_req, ttl, grace, keep));
 }
 
+VCL_INT
+VRT_purge_tags(VRT_CTX, VCL_STRING tags, VCL_DURATION ttl,
+    VCL_DURATION grace, VCL_DURATION keep)
+{
+	struct worker *wrk;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+	if (ctx->req != NULL) {
+		CHECK_OBJ(ctx->req, REQ_MAGIC);
+		wrk = ctx->req->wrk;
+	} else if (ctx->bo != NULL) {
+		CHECK_OBJ(ctx->bo, BUSYOBJ_MAGIC);
+		wrk = ctx->bo->wrk;
+	} else {
+		VRT_fail(ctx, "tag purges need a client or backend task");
+		return (0);
+	}
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	if (tags == NULL)
+		return (0);
+	return (TAG_Purge(wrk, tags, ctx->now, ttl, grace, keep));
+}
+
 /*--------------------------------------------------------------------
  */
 
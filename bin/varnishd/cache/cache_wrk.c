@@ -162,6 +162,7 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 		VCL_Rel(&w->wpriv->vcl);
 	PTOK(pthread_cond_destroy(&w->cond));
 	HSH_Cleanup(w);
+	MPL_Cleanup(w);
 	Pool_Sumstat(w);
 }
 
@@ -225,6 +226,42 @@ pool_reserve(void)
 	return (lim);
 }
 
+/*--------------------------------------------------------------------
+ * Queue latency accounting for pool_adapt()
+ *
+ * Tasks handed straight to an idle thread count as not waiting at all,
+ * queued tasks are put in log2 buckets of microseconds when they are
+ * taken off the queue.
+ */
+
+static void
+pool_dispatched(struct pool *pp)
+{
+
+	Lck_AssertHeld(&pp->mtx);
+	pp->ntask++;
+	if (pp->nthr > pp->nidle && pp->nthr - pp->nidle > pp->nbusy)
+		pp->nbusy = pp->nthr - pp->nidle;
+}
+
+void
+Pool_Dequeued(struct pool *pp, const struct pool_task *tp, vtim_mono now)
+{
+	uint64_t us;
+	unsigned b;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	AN(tp);
+	Lck_AssertHeld(&pp->mtx);
+	pool_dispatched(pp);
+	if (now <= tp->queued)
+		return;
+	us = (uint64_t)((now - tp->queued) * 1e6);
+	for (b = 0; us > 1 && b < POOL_LAT_BUCKETS - 1; b++)
+		us >>= 1;
+	pp->lat[b]++;
+}
+
 /*--------------------------------------------------------------------*/
 
 static struct worker *
@@ -250,6 +287,7 @@ pool_getidleworker(struct pool *pp, enum task_prio prio)
 	AN(pp->nidle);
 	VTAILQ_REMOVE(&pp->idle_queue, wrk->task, list);
 	pp->nidle--;
+	pool_dispatched(pp);
 
 	return (wrk);
 }
@@ -303,7 +341,7 @@ int
 Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 {
 	struct worker *wrk;
-	int retval = 0;
+	int retval = 0, steal = 0;
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 	AN(task);
 	AN(task->func);
@@ -345,8 +383,12 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 	    cache_param->wthread_queue_limit) {
 		pp->stats->sess_queued++;
 		pp->lqueue++;
+		__atomic_add_fetch(&pool_nqueued, 1, __ATOMIC_RELAXED);
+		task->queued = VTIM_mono();
 		VTAILQ_INSERT_TAIL(&pp->queues[prio], task, list);
 		PTOK(pthread_cond_signal(&pp->herder_cond));
+		steal = cache_param->wthread_steal > 0 &&
+		    pp->lqueue >= cache_param->wthread_steal;
 	} else {
 		/* NB: This is counter-intuitive but when we drop a REQ
 		 * task, it is an HTTP/1 request and we effectively drop
@@ -360,6 +402,8 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 		retval = -1;
 	}
 	Lck_Unlock(&pp->mtx);
+	if (steal)
+		Pool_Steal_Wakeup(pp);
 	return (retval);
 }
 
@@ -385,6 +429,7 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 	struct pool_task *tp;
 	struct pool_task tpx, tps;
 	vtim_real tmo, now;
+	vtim_mono t;
 	unsigned i, reserve;
 
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
@@ -396,16 +441,33 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 		WS_Rollback(wrk->aws, 0);
 		AZ(wrk->vsl);
 
-		Lck_Lock(&pp->mtx);
 		reserve = pool_reserve();
 
-		for (i = 0; i < TASK_QUEUE_RESERVE; i++) {
+		/* Unlocked peek, our own queue goes first */
+		if (pp->lqueue == 0 && cache_param->wthread_steal > 0) {
+			for (i = 1; i < TASK_QUEUE_RESERVE; i++) {
+				if (pp->nidle <
+				    (reserve * i / TASK_QUEUE_RESERVE))
+					break;
+			}
+			tp = Pool_Steal(pp, i);
+			if (tp != NULL)
+				wrk->stats->tasks_stolen++;
+		}
+
+		t = pp->lqueue > 0 ? VTIM_mono() : 0.;
+		Lck_Lock(&pp->mtx);
+
+		for (i = 0; tp == NULL && i < TASK_QUEUE_RESERVE; i++) {
 			if (pp->nidle < (reserve * i / TASK_QUEUE_RESERVE))
 				break;
 			tp = VTAILQ_FIRST(&pp->queues[i]);
 			if (tp != NULL) {
+				Pool_Dequeued(pp, tp, t);
 				pp->lqueue--;
 				pp->ndequeued--;
+				__atomic_sub_fetch(&pool_nqueued, 1,
+				    __ATOMIC_RELAXED);
 				VTAILQ_REMOVE(&pp->queues[i], tp, list);
 				break;
 			}
@@ -532,11 +594,12 @@ pool_thread(void *priv)
 }
 
 static void
-pool_breed(struct pool *qp)
+pool_breed(struct pool *qp, int adapt)
 {
 	pthread_t tp;
 	pthread_attr_t tp_attr;
 	struct pool_info *pi;
+	vtim_mono t0;
 
 	PTOK(pthread_attr_init(&tp_attr));
 	PTOK(pthread_attr_setdetachstate(&tp_attr, PTHREAD_CREATE_DETACHED));
@@ -550,6 +613,7 @@ pool_breed(struct pool *qp)
 	PTOK(pthread_attr_getstacksize(&tp_attr, &pi->stacksize));
 	pi->qp = qp;
 
+	t0 = VTIM_mono();
 	errno = pthread_create(&tp, &tp_attr, pool_thread, pi);
 	if (errno) {
 		FREE_OBJ(pi);
@@ -561,11 +625,14 @@ pool_breed(struct pool *qp)
 		VTIM_sleep(cache_param->wthread_fail_delay);
 	} else {
 		qp->nthr++;
+		qp->breed_cost = qp->breed_cost * .9 + (VTIM_mono() - t0) * .1;
 		Lck_Lock(&pool_mtx);
 		VSC_C_main->threads++;
 		VSC_C_main->threads_created++;
+		if (adapt)
+			VSC_C_main->threads_latency_created++;
 		Lck_Unlock(&pool_mtx);
-		if (cache_param->wthread_add_delay > 0.0)
+		if (cache_param->wthread_add_delay > 0.0 && !adapt)
 			VTIM_sleep(cache_param->wthread_add_delay);
 		else
 			(void)sched_yield();
@@ -574,6 +641,85 @@ pool_breed(struct pool *qp)
 	PTOK(pthread_attr_destroy(&tp_attr));
 }
 
+/*--------------------------------------------------------------------
+ * Size a pool for a target queue latency
+ *
+ * Once per window the 99th percentile of the time tasks waited for a
+ * thread is taken from the histogram.  The pool wants as many threads
+ * as were busy at the peak, plus what is queued, plus enough idle ones
+ * to take the arrivals while a new thread is being created.  Above the
+ * target it grows by at least one thread, below half of it it may
+ * shrink, in between it holds.
+ *
+ * Between windows, a queued task older than the target makes the pool
+ * want a thread for every queued task right away.
+ */
+
+#define POOL_ADAPT_WINDOW	1.0
+
+static unsigned
+pool_adapt(struct pool *pp, vtim_dur target, vtim_mono now)
+{
+	struct pool_task *pt;
+	vtim_dur age = 0., p99;
+	unsigned want, need, spare, n, i, u;
+	const char *how;
+
+	Lck_Lock(&pp->mtx);
+	for (i = 0; i < TASK_QUEUE_RESERVE; i++) {
+		pt = VTAILQ_FIRST(&pp->queues[i]);
+		if (pt != NULL)
+			age = vmax(age, now - pt->queued);
+	}
+	want = pp->want;
+	if (age > target)
+		want = vmax(want, pp->nthr + pp->lqueue);
+	if (now >= pp->t_window + POOL_ADAPT_WINDOW) {
+		n = 0;
+		for (u = 0; u < POOL_LAT_BUCKETS; u++)
+			n += pp->lat[u];
+		assert(n <= pp->ntask);
+		/* Tasks not queued waited zero */
+		n = pp->ntask - n;
+		need = pp->ntask - pp->ntask / 100;
+		p99 = 0.;
+		for (u = 0; n < need && u < POOL_LAT_BUCKETS; u++) {
+			n += pp->lat[u];
+			p99 = (2 << u) * 1e-6;
+		}
+		spare = (unsigned)ceil(pp->ntask /
+		    (now - pp->t_window) * pp->breed_cost) + 1;
+		need = pp->nbusy + pp->lqueue + spare;
+		if (p99 > target) {
+			want = vmax(need, pp->nthr + 1);
+			how = "grow";
+		} else if (p99 > target * .5) {
+			want = vmax(need, pp->nthr);
+			how = "hold";
+		} else {
+			want = need;
+			how = "shrink";
+		}
+		want = vlimit_t(unsigned, want, cache_param->wthread_min,
+		    cache_param->wthread_max);
+		if (pp->t_window > 0. && (want != pp->want || p99 > target))
+			VSL(SLT_PoolHerder, NO_VXID,
+			    "%u %s %u %u %u %u %.6f %.6f",
+			    pp->pool_no, how, pp->nthr, want, pp->nbusy,
+			    pp->lqueue, p99, pp->breed_cost);
+		pp->lat_p99 = p99;
+		pp->t_window = now;
+		pp->ntask = 0;
+		pp->nbusy = 0;
+		memset(pp->lat, 0, sizeof pp->lat);
+	}
+	want = vlimit_t(unsigned, want, cache_param->wthread_min,
+	    cache_param->wthread_max);
+	pp->want = want;
+	Lck_Unlock(&pp->mtx);
+	return (want);
+}
+
 /*--------------------------------------------------------------------
  * Herd a single pool
  *
@@ -598,7 +744,9 @@ pool_herder(void *priv)
 	double t_idle;
 	struct worker *wrk;
 	double delay;
-	unsigned wthread_min;
+	unsigned wthread_min, want;
+	vtim_dur target;
+	int shrink;
 	uintmax_t dq = (1ULL << 31);
 	vtim_mono dqt = 0;
 	int r = 0;
@@ -640,10 +788,24 @@ pool_herder(void *priv)
 		if (pp->die)
 			wthread_min = 0;
 
+		target = cache_param->wthread_latency;
+		if (target > 0. && !pp->die) {
+			want = pool_adapt(pp, target, VTIM_mono());
+		} else {
+			want = 0;
+			pp->want = 0;
+			pp->lat_p99 = 0.;
+		}
+
 		/* Make more threads if needed and allowed */
 		if (pp->nthr < wthread_min ||
-		    (pp->lqueue > 0 && pp->nthr < cache_param->wthread_max)) {
-			pool_breed(pp);
+		    (want == 0 && pp->lqueue > 0 &&
+		    pp->nthr < cache_param->wthread_max)) {
+			pool_breed(pp, 0);
+			continue;
+		}
+		if (pp->nthr < want) {
+			pool_breed(pp, 1);
 			continue;
 		}
 
@@ -656,14 +818,20 @@ pool_herder(void *priv)
 
 			Lck_Lock(&pp->mtx);
 			wrk = NULL;
+			shrink = 0;
 			pt = VTAILQ_LAST(&pp->idle_queue, taskhead);
 			if (pt != NULL) {
 				AN(pp->nidle);
 				AZ(pt->func);
 				CAST_OBJ_NOTNULL(wrk, pt->priv, WORKER_MAGIC);
 
+				/* Shrinking for pool_adapt() */
+				shrink = want > 0 && pp->nthr > want &&
+				    wrk->lastused >= t_idle &&
+				    pp->nthr <= cache_param->wthread_max;
 				if (pp->die || wrk->lastused < t_idle ||
-				    pp->nthr > cache_param->wthread_max) {
+				    pp->nthr > cache_param->wthread_max ||
+				    shrink) {
 					/* Give it a kiss on the cheek... */
 					VTAILQ_REMOVE(&pp->idle_queue,
 					    wrk->task, list);
@@ -682,6 +850,8 @@ pool_herder(void *priv)
 				Lck_Lock(&pool_mtx);
 				VSC_C_main->threads--;
 				VSC_C_main->threads_destroyed++;
+				if (shrink)
+					VSC_C_main->threads_latency_destroyed++;
 				Lck_Unlock(&pool_mtx);
 				delay = cache_param->wthread_destroy_delay;
 			} else
@@ -697,9 +867,11 @@ pool_herder(void *priv)
 			VTIM_sleep(delay);
 			continue;
 		}
+		if (want > 0)
+			delay = vmin(delay, POOL_ADAPT_WINDOW);
 		Lck_Lock(&pp->mtx);
 		if (pp->lqueue == 0) {
-			if (DO_DEBUG(DBG_VTC_MODE))
+			if (DO_DEBUG(DBG_VTC_MODE) && want == 0)
 				delay = 0.5;
 			r = Lck_CondWaitTimeout(
 			    &pp->herder_cond, &pp->mtx, delay);
@@ -709,6 +881,10 @@ pool_herder(void *priv)
 				VSC_C_main->threads_limited++;
 			r = Lck_CondWaitTimeout(
 			    &pp->herder_cond, &pp->mtx, 1.0);
+		} else if (want > 0) {
+			/* Queued, but not for long enough to grow yet */
+			r = Lck_CondWaitTimeout(
+			    &pp->herder_cond, &pp->mtx, vmin(target, delay));
 		}
 		Lck_Unlock(&pp->mtx);
 	}
@@ -103,6 +103,9 @@ PARAM_BITMAP(feature_t,		FEATURE_Reserved);
 PARAM_BITMAP(vcc_feature_t,	VCC_FEATURE_Reserved);
 #undef PARAM_BITMAP
 
+#define PARAM_HEADER_LEN	64
+typedef char header_t[PARAM_HEADER_LEN + 1];
+
 struct params {
 
 #define ptyp_boolean		unsigned
@@ -113,6 +116,7 @@ struct params {
 #define ptyp_duration		vtim_dur
 #define ptyp_experimental	experimental_t
 #define ptyp_feature		feature_t
+#define ptyp_header		header_t
 #define ptyp_poolparam		struct poolparam
 #define ptyp_thread_pool_max	unsigned
 #define ptyp_thread_pool_min	unsigned
@@ -133,6 +137,7 @@ struct params {
 #undef ptyp_duration
 #undef ptyp_experimental
 #undef ptyp_feature
+#undef ptyp_header
 #undef ptyp_poolparam
 #undef ptyp_thread_pool_max
 #undef ptyp_thread_pool_min
@@ -53,6 +53,12 @@ struct listen_sock {
 	const struct uds_perms		*perms;
 	unsigned			test_heritage;
 	struct conn_heritage		*conn_heritage;
+
+	/* listen_reuseport: one socket per pool, [0] is the primary */
+	unsigned			reuseport;
+	unsigned			nreuse;
+	struct listen_sock		**reuse;
+	const struct listen_sock	*primary;
 };
 
 VTAILQ_HEAD(listen_sock_head, listen_sock);
@@ -29,6 +29,13 @@
  * SUCH DAMAGE.
  *
  * A classic bucketed hash
+ *
+ * The digest picks one of hcl_nlock lock stripes, each with its own
+ * power of two sized table of buckets, which is doubled when the stripe
+ * holds more than HCL_LOAD objheads per bucket.  The old table is then
+ * rehashed into the new one a few buckets at a time, by whoever holds
+ * the stripe lock, and until a bucket has been moved, its objheads are
+ * found in the old table.
  */
 
 #include "config.h"
@@ -42,48 +49,194 @@
 
 #include "hash/hash_slinger.h"
 
+#include "VSC_hcl.h"
+
+#define HCL_LOAD		2
+#define HCL_REHASH_STEP		4
+#define HCL_MAX_LOCKS		1024
+
 static struct VSC_lck *lck_hcl;
+static struct VSC_hcl *hcl_stats;
+static uint64_t *hcl_len[7];
 
 /*--------------------------------------------------------------------*/
 
+struct hcl_bucket {
+	VTAILQ_HEAD(, objhead)	head;
+	unsigned		len;
+};
+
 struct hcl_hd {
 	unsigned		magic;
 #define HCL_HEAD_MAGIC		0x0f327016
-	VTAILQ_HEAD(, objhead)	head;
 	struct lock		mtx;
+	unsigned		nobjhead;
+	unsigned		mask;
+	struct hcl_bucket	*tbl;
+
+	/* Table being rehashed into tbl, buckets below next are done */
+	unsigned		omask;
+	unsigned		next;
+	struct hcl_bucket	*otbl;
 };
 
 static unsigned			hcl_nhash = 16383;
+static unsigned			hcl_nlock;
 static struct hcl_hd		*hcl_head;
 
 /*--------------------------------------------------------------------
  * The ->init method allows the management process to pass arguments
  */
 
+static unsigned
+hcl_pow2(unsigned u)
+{
+	unsigned p = 1;
+
+	while (p < u && p < (1U << 31))
+		p <<= 1;
+	return (p);
+}
+
 static void v_matchproto_(hash_init_f)
 hcl_init(int ac, char * const *av)
 {
-	int i;
 	unsigned u;
 
+	if (ac > 2)
+		ARGV_ERR("(-hclassic) too many arguments\n");
+	if (ac > 0 && sscanf(av[0], "%u", &u) == 1 && u > 0)
+		hcl_nhash = u;
+	if (ac > 1 && sscanf(av[1], "%u", &u) == 1 && u > 0)
+		hcl_nlock = u;
+
+	hcl_nhash = hcl_pow2(hcl_nhash);
+	if (hcl_nlock == 0)
+		hcl_nlock = HCL_MAX_LOCKS;
+	hcl_nlock = hcl_pow2(hcl_nlock);
+	if (hcl_nlock > hcl_nhash)
+		hcl_nlock = hcl_nhash;
 	if (ac == 0)
 		return;
-	if (ac > 1)
-		ARGV_ERR("(-hclassic) too many arguments\n");
-	i = sscanf(av[0], "%u", &u);
-	if (i <= 0 || u == 0)
+	fprintf(stderr, "Classic hash: %u buckets, %u locks\n",
+	    hcl_nhash, hcl_nlock);
+}
+
+/*--------------------------------------------------------------------
+ * Bucket length histogram
+ */
+
+static void
+hcl_len_add(unsigned len, int n)
+{
+	unsigned b, m;
+
+	if (len <= 2)
+		b = len;
+	else
+		for (b = 3, m = 4; len > m && b < 6; b++)
+			m <<= 1;
+	(void)__atomic_add_fetch(hcl_len[b], (uint64_t)(int64_t)n,
+	    __ATOMIC_RELAXED);
+}
+
+static void
+hcl_bucket_insert(struct hcl_bucket *bp, struct objhead *oh,
+    struct objhead *before)
+{
+
+	if (before != NULL)
+		VTAILQ_INSERT_BEFORE(before, oh, hoh_list);
+	else
+		VTAILQ_INSERT_TAIL(&bp->head, oh, hoh_list);
+	hcl_len_add(bp->len, -1);
+	hcl_len_add(++bp->len, 1);
+}
+
+static void
+hcl_bucket_remove(struct hcl_bucket *bp, struct objhead *oh)
+{
+
+	VTAILQ_REMOVE(&bp->head, oh, hoh_list);
+	AN(bp->len);
+	hcl_len_add(bp->len, -1);
+	hcl_len_add(--bp->len, 1);
+}
+
+/*--------------------------------------------------------------------
+ * Table management, all under the stripe lock
+ */
+
+static struct hcl_bucket *
+hcl_table(unsigned n)
+{
+	struct hcl_bucket *tbl;
+	unsigned u;
+
+	tbl = calloc(n, sizeof *tbl);
+	XXXAN(tbl);
+	for (u = 0; u < n; u++)
+		VTAILQ_INIT(&tbl[u].head);
+	(void)__atomic_add_fetch(&hcl_stats->g_buckets, n, __ATOMIC_RELAXED);
+	(void)__atomic_add_fetch(hcl_len[0], n, __ATOMIC_RELAXED);
+	return (tbl);
+}
+
+static struct hcl_bucket *
+hcl_bucket(const struct hcl_hd *hp, unsigned hdigest)
+{
+
+	if (hp->otbl != NULL && (hdigest & hp->omask) >= hp->next)
+		return (&hp->otbl[hdigest & hp->omask]);
+	return (&hp->tbl[hdigest & hp->mask]);
+}
+
+static void
+hcl_rehash(struct hcl_hd *hp)
+{
+	struct hcl_bucket *ob;
+	struct objhead *oh;
+	unsigned n, hdigest;
+
+	Lck_AssertHeld(&hp->mtx);
+	if (hp->otbl == NULL)
 		return;
-	if (u > 2 && !(u & (u - 1))) {
-		fprintf(stderr,
-		    "NOTE:\n"
-		    "\tA power of two number of hash buckets is "
-		    "marginally less efficient\n"
-		    "\twith systematic URLs.  Reducing by one"
-		    " hash bucket.\n");
-		u--;
+	for (n = 0; n < HCL_REHASH_STEP && hp->next <= hp->omask; n++) {
+		ob = &hp->otbl[hp->next++];
+		/* The old chain is sorted, so appending keeps order */
+		while ((oh = VTAILQ_FIRST(&ob->head)) != NULL) {
+			hcl_bucket_remove(ob, oh);
+			memcpy(&hdigest, oh->digest + sizeof hdigest,
+			    sizeof hdigest);
+			hcl_bucket_insert(&hp->tbl[hdigest & hp->mask], oh,
+			    NULL);
+			(void)__atomic_add_fetch(&hcl_stats->c_moved, 1,
+			    __ATOMIC_RELAXED);
+		}
 	}
-	hcl_nhash = u;
-	fprintf(stderr, "Classic hash: %u buckets\n", hcl_nhash);
+	if (hp->next <= hp->omask)
+		return;
+	n = hp->omask + 1;
+	(void)__atomic_sub_fetch(&hcl_stats->g_buckets, n, __ATOMIC_RELAXED);
+	(void)__atomic_sub_fetch(hcl_len[0], n, __ATOMIC_RELAXED);
+	free(hp->otbl);
+	hp->otbl = NULL;
+}
+
+static void
+hcl_grow(struct hcl_hd *hp)
+{
+
+	Lck_AssertHeld(&hp->mtx);
+	if (hp->otbl != NULL || hp->nobjhead <= HCL_LOAD * (hp->mask + 1) ||
+	    hp->mask == UINT_MAX >> 1)
+		return;
+	hp->otbl = hp->tbl;
+	hp->omask = hp->mask;
+	hp->next = 0;
+	hp->mask = hp->mask * 2 + 1;
+	hp->tbl = hcl_table(hp->mask + 1);
+	(void)__atomic_add_fetch(&hcl_stats->c_grow, 1, __ATOMIC_RELAXED);
 }
 
 /*--------------------------------------------------------------------
@@ -94,16 +247,30 @@ hcl_init(int ac, char * const *av)
 static void v_matchproto_(hash_start_f)
 hcl_start(void)
 {
+	struct hcl_hd *hp;
 	unsigned u;
 
+	AN(hcl_nlock);
 	lck_hcl = Lck_CreateClass(NULL, "hcl");
-	hcl_head = calloc(hcl_nhash, sizeof *hcl_head);
+	hcl_stats = VSC_hcl_New(NULL, NULL, "");
+	AN(hcl_stats);
+	hcl_len[0] = &hcl_stats->g_len_0;
+	hcl_len[1] = &hcl_stats->g_len_1;
+	hcl_len[2] = &hcl_stats->g_len_2;
+	hcl_len[3] = &hcl_stats->g_len_4;
+	hcl_len[4] = &hcl_stats->g_len_8;
+	hcl_len[5] = &hcl_stats->g_len_16;
+	hcl_len[6] = &hcl_stats->g_len_more;
+
+	hcl_head = calloc(hcl_nlock, sizeof *hcl_head);
 	XXXAN(hcl_head);
 
-	for (u = 0; u < hcl_nhash; u++) {
-		VTAILQ_INIT(&hcl_head[u].head);
-		Lck_New(&hcl_head[u].mtx, lck_hcl);
-		hcl_head[u].magic = HCL_HEAD_MAGIC;
+	for (u = 0; u < hcl_nlock; u++) {
+		hp = &hcl_head[u];
+		hp->magic = HCL_HEAD_MAGIC;
+		Lck_New(&hp->mtx, lck_hcl);
+		hp->mask = hcl_nhash / hcl_nlock - 1;
+		hp->tbl = hcl_table(hp->mask + 1);
 	}
 }
 
@@ -121,7 +288,8 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 {
 	struct objhead *oh;
 	struct hcl_hd *hp;
-	unsigned u1, hdigest;
+	struct hcl_bucket *bp;
+	unsigned hdigest[2];
 	int i;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -130,12 +298,13 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
 
 	assert(sizeof oh->digest >= sizeof hdigest);
-	memcpy(&hdigest, digest, sizeof hdigest);
-	u1 = hdigest % hcl_nhash;
-	hp = &hcl_head[u1];
+	memcpy(hdigest, digest, sizeof hdigest);
+	hp = &hcl_head[hdigest[0] & (hcl_nlock - 1)];
 
 	Lck_Lock(&hp->mtx);
-	VTAILQ_FOREACH(oh, &hp->head, hoh_list) {
+	hcl_rehash(hp);
+	bp = hcl_bucket(hp, hdigest[1]);
+	VTAILQ_FOREACH(oh, &bp->head, hoh_list) {
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 		i = memcmp(oh->digest, digest, sizeof oh->digest);
 		if (i < 0)
@@ -153,16 +322,15 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		return (NULL);
 	}
 
-	if (oh != NULL)
-		VTAILQ_INSERT_BEFORE(oh, *noh, hoh_list);
-	else
-		VTAILQ_INSERT_TAIL(&hp->head, *noh, hoh_list);
+	hcl_bucket_insert(bp, *noh, oh);
 
 	oh = *noh;
 	*noh = NULL;
 	memcpy(oh->digest, digest, sizeof oh->digest);
 
 	oh->hoh_head = hp;
+	hp->nobjhead++;
+	hcl_grow(hp);
 
 	Lck_Unlock(&hp->mtx);
 	Lck_Lock(&oh->mtx);
@@ -177,6 +345,7 @@ static int v_matchproto_(hash_deref_f)
 hcl_deref(struct worker *wrk, struct objhead *oh)
 {
 	struct hcl_hd *hp;
+	unsigned hdigest;
 	int ret;
 
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
@@ -186,8 +355,11 @@ hcl_deref(struct worker *wrk, struct objhead *oh)
 	CAST_OBJ_NOTNULL(hp, oh->hoh_head, HCL_HEAD_MAGIC);
 	assert(oh->refcnt > 0);
 	Lck_Lock(&hp->mtx);
+	hcl_rehash(hp);
 	if (--oh->refcnt == 0) {
-		VTAILQ_REMOVE(&hp->head, oh, hoh_list);
+		memcpy(&hdigest, oh->digest + sizeof hdigest, sizeof hdigest);
+		hcl_bucket_remove(hcl_bucket(hp, hdigest), oh);
+		hp->nobjhead--;
 		ret = 0;
 	} else
 		ret = 1;
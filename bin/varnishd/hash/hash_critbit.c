@@ -43,7 +43,15 @@
 #include "vmb.h"
 #include "vtim.h"
 
+/* Wake up the cleaner early once this many objheads were deleted */
+#define HCB_BATCH		1024
+
+/* Lockless readers, see hcb_enter() */
+#define HCB_NREADER		64
+
 static struct lock hcb_mtx;
+static pthread_cond_t hcb_cond;
+static unsigned hcb_ncool;
 
 /*---------------------------------------------------------------------
  * Table for finding out how many bits two bytes have in common,
@@ -102,16 +110,77 @@ struct hcb_y {
 #define HCB_BIT_NODE		(1<<0)
 #define HCB_BIT_Y		(1<<1)
 
+/*
+ * The tree is split by the first byte of the digest, each part with
+ * its own lock for modifications and its own lists of deleted nodes.
+ */
+
+VSTAILQ_HEAD(hcb_ylist, hcb_y);
+VTAILQ_HEAD(hcb_hlist, objhead);
+
 struct hcb_root {
 	volatile uintptr_t	origo;
+	struct lock		mtx;
+	struct hcb_ylist	cool_y;
+	struct hcb_hlist	cool_h;
+};
+
+static struct hcb_root	hcb_root[256];
+
+/*
+ * Lookups walk the tree without locks.  While doing so, they are counted
+ * in a slot of hcb_readers for the parity of hcb_epoch they entered in.
+ * The cleaner frees the nodes deleted so far only after flipping the
+ * epoch and seeing the count for the previous parity drop to zero in all
+ * slots, so no reader which could have found them is left.
+ */
+
+struct hcb_reader {
+	unsigned		n[2];
+	char			pad[64 - 2 * sizeof(unsigned)];
 };
 
-static struct hcb_root	hcb_root;
+static unsigned			hcb_epoch;
+static struct hcb_reader	hcb_readers[HCB_NREADER];
 
-static VSTAILQ_HEAD(, hcb_y)	cool_y = VSTAILQ_HEAD_INITIALIZER(cool_y);
-static VSTAILQ_HEAD(, hcb_y)	dead_y = VSTAILQ_HEAD_INITIALIZER(dead_y);
-static VTAILQ_HEAD(, objhead)	cool_h = VTAILQ_HEAD_INITIALIZER(cool_h);
-static VTAILQ_HEAD(, objhead)	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
+static unsigned
+hcb_enter(const struct worker *wrk)
+{
+	struct hcb_reader *rd;
+	unsigned u, e;
+
+	u = (unsigned)(((uintptr_t)wrk >> 4) * 2654435761U) % HCB_NREADER;
+	rd = &hcb_readers[u];
+	while (1) {
+		e = __atomic_load_n(&hcb_epoch, __ATOMIC_SEQ_CST) & 1;
+		(void)__atomic_add_fetch(&rd->n[e], 1, __ATOMIC_SEQ_CST);
+		/* A stale epoch would not be waited for, try again */
+		if ((__atomic_load_n(&hcb_epoch, __ATOMIC_SEQ_CST) & 1) == e)
+			return (u << 1 | e);
+		(void)__atomic_sub_fetch(&rd->n[e], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void
+hcb_leave(unsigned token)
+{
+
+	assert((token >> 1) < HCB_NREADER);
+	(void)__atomic_sub_fetch(&hcb_readers[token >> 1].n[token & 1], 1,
+	    __ATOMIC_SEQ_CST);
+}
+
+static void
+hcb_sync(void)
+{
+	unsigned u, e;
+
+	e = __atomic_fetch_add(&hcb_epoch, 1, __ATOMIC_SEQ_CST) & 1;
+	for (u = 0; u < HCB_NREADER; u++)
+		while (__atomic_load_n(&hcb_readers[u].n[e],
+		    __ATOMIC_SEQ_CST) != 0)
+			(void)usleep(10);
+}
 
 /*---------------------------------------------------------------------
  * Pointer accessor functions
@@ -281,6 +350,7 @@ hcb_delete(struct hcb_root *r, const struct objhead *oh)
 	volatile uintptr_t *p;
 	unsigned s;
 
+	Lck_AssertHeld(&r->mtx);
 	if (r->origo == hcb_r_node(oh)) {
 		r->origo = 0;
 		return;
@@ -297,7 +367,7 @@ hcb_delete(struct hcb_root *r, const struct objhead *oh)
 		assert(s < 2);
 		if (y->leaf[s] == hcb_r_node(oh)) {
 			*p = y->leaf[1 - s];
-			VSTAILQ_INSERT_TAIL(&cool_y, y, list);
+			VSTAILQ_INSERT_TAIL(&r->cool_y, y, list);
 			return;
 		}
 		p = &y->leaf[s];
@@ -306,14 +376,32 @@ hcb_delete(struct hcb_root *r, const struct objhead *oh)
 
 /*--------------------------------------------------------------------*/
 
+/*
+ * Collect what was deleted from all parts of the tree, wait for the
+ * readers which might still see it, and free it.  We do this every
+ * critbit_cooloff, or as soon as HCB_BATCH objheads were deleted.
+ */
+
 static void * v_matchproto_(bgthread_t)
 hcb_cleaner(struct worker *wrk, void *priv)
 {
+	struct hcb_ylist dead_y = VSTAILQ_HEAD_INITIALIZER(dead_y);
+	struct hcb_hlist dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
+	struct hcb_root *r;
 	struct hcb_y *y, *y2;
 	struct objhead *oh, *oh2;
 
 	(void)priv;
 	while (1) {
+		__atomic_store_n(&hcb_ncool, 0, __ATOMIC_SEQ_CST);
+		for (r = hcb_root; r < hcb_root + 256; r++) {
+			Lck_Lock(&r->mtx);
+			VSTAILQ_CONCAT(&dead_y, &r->cool_y);
+			VTAILQ_CONCAT(&dead_h, &r->cool_h, hoh_list);
+			Lck_Unlock(&r->mtx);
+		}
+		if (!VSTAILQ_EMPTY(&dead_y) || !VTAILQ_EMPTY(&dead_h))
+			hcb_sync();
 		VSTAILQ_FOREACH_SAFE(y, &dead_y, list, y2) {
 			CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
 			VSTAILQ_REMOVE_HEAD(&dead_y, list);
@@ -324,12 +412,12 @@ hcb_cleaner(struct worker *wrk, void *priv)
 			VTAILQ_REMOVE(&dead_h, oh, hoh_list);
 			HSH_DeleteObjHead(wrk, oh);
 		}
+		Pool_Sumstat(wrk);
 		Lck_Lock(&hcb_mtx);
-		VSTAILQ_CONCAT(&dead_y, &cool_y);
-		VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
+		if (__atomic_load_n(&hcb_ncool, __ATOMIC_SEQ_CST) < HCB_BATCH)
+			(void)Lck_CondWaitTimeout(&hcb_cond, &hcb_mtx,
+			    cache_param->critbit_cooloff);
 		Lck_Unlock(&hcb_mtx);
-		Pool_Sumstat(wrk);
-		VTIM_sleep(cache_param->critbit_cooloff);
 	}
 	NEEDLESS(return (NULL));
 }
@@ -339,45 +427,59 @@ hcb_cleaner(struct worker *wrk, void *priv)
 static void v_matchproto_(hash_start_f)
 hcb_start(void)
 {
-	struct objhead *oh = NULL;
+	struct hcb_root *r;
 	pthread_t tp;
 
-	(void)oh;
 	Lck_New(&hcb_mtx, lck_hcb);
-	WRK_BgThread(&tp, "hcb-cleaner", hcb_cleaner, NULL);
-	memset(&hcb_root, 0, sizeof hcb_root);
+	PTOK(pthread_cond_init(&hcb_cond, NULL));
+	for (r = hcb_root; r < hcb_root + 256; r++) {
+		r->origo = 0;
+		Lck_New(&r->mtx, lck_hcb);
+		VSTAILQ_INIT(&r->cool_y);
+		VTAILQ_INIT(&r->cool_h);
+	}
 	hcb_build_bittbl();
+	WRK_BgThread(&tp, "hcb-cleaner", hcb_cleaner, NULL);
 }
 
 static int v_matchproto_(hash_deref_f)
 hcb_deref(struct worker *wrk, struct objhead *oh)
 {
-	int r;
+	struct hcb_root *r;
+	int ret;
 
 	(void)wrk;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	Lck_AssertHeld(&oh->mtx);
 	assert(oh->refcnt > 0);
-	r = --oh->refcnt;
+	ret = --oh->refcnt;
 	if (oh->refcnt == 0) {
-		Lck_Lock(&hcb_mtx);
-		hcb_delete(&hcb_root, oh);
-		VTAILQ_INSERT_TAIL(&cool_h, oh, hoh_list);
-		Lck_Unlock(&hcb_mtx);
+		r = &hcb_root[oh->digest[0]];
+		Lck_Lock(&r->mtx);
+		hcb_delete(r, oh);
+		VTAILQ_INSERT_TAIL(&r->cool_h, oh, hoh_list);
+		Lck_Unlock(&r->mtx);
+		if (__atomic_add_fetch(&hcb_ncool, 1, __ATOMIC_SEQ_CST) ==
+		    HCB_BATCH) {
+			Lck_Lock(&hcb_mtx);
+			PTOK(pthread_cond_signal(&hcb_cond));
+			Lck_Unlock(&hcb_mtx);
+		}
 	}
 	Lck_Unlock(&oh->mtx);
 #ifdef PHK
-	fprintf(stderr, "hcb_defef %d %d <%s>\n", __LINE__, r, oh->hash);
+	fprintf(stderr, "hcb_defef %d %d <%s>\n", __LINE__, ret, oh->hash);
 #endif
-	return (r);
+	return (ret);
 }
 
 static struct objhead * v_matchproto_(hash_lookup_f)
 hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 {
 	struct objhead *oh;
+	struct hcb_root *r;
 	struct hcb_y *y;
-	unsigned u;
+	unsigned u, token;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AN(digest);
@@ -385,11 +487,13 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
 		assert((*noh)->refcnt == 1);
 	}
+	r = &hcb_root[((const uint8_t *)digest)[0]];
 
 	/* First try in read-only mode without holding a lock */
 
+	token = hcb_enter(wrk);
 	wrk->stats->hcb_nolock++;
-	oh = hcb_insert(wrk, &hcb_root, digest, NULL);
+	oh = hcb_insert(wrk, r, digest, NULL);
 	if (oh != NULL) {
 		Lck_Lock(&oh->mtx);
 		/*
@@ -399,6 +503,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		u = oh->refcnt;
 		if (u > 0) {
 			oh->refcnt++;
+			hcb_leave(token);
 			return (oh);
 		}
 		Lck_Unlock(&oh->mtx);
@@ -407,20 +512,23 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	while (1) {
 		/* No luck, try with lock held, so we can modify tree */
 		CAST_OBJ_NOTNULL(y, wrk->wpriv->nhashpriv, HCB_Y_MAGIC);
-		Lck_Lock(&hcb_mtx);
-		VSC_C_main->hcb_lock++;
-		oh = hcb_insert(wrk, &hcb_root, digest, noh);
-		Lck_Unlock(&hcb_mtx);
+		Lck_Lock(&r->mtx);
+		wrk->stats->hcb_lock++;
+		oh = hcb_insert(wrk, r, digest, noh);
+		Lck_Unlock(&r->mtx);
 
-		if (oh == NULL)
+		if (oh == NULL) {
+			hcb_leave(token);
 			return (NULL);
+		}
 
 		Lck_Lock(&oh->mtx);
 
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 		if (noh != NULL && *noh == NULL) {
 			assert(oh->refcnt > 0);
-			VSC_C_main->hcb_insert++;
+			wrk->stats->hcb_insert++;
+			hcb_leave(token);
 			return (oh);
 		}
 		/*
@@ -430,12 +538,38 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		u = oh->refcnt;
 		if (u > 0) {
 			oh->refcnt++;
+			hcb_leave(token);
 			return (oh);
 		}
 		Lck_Unlock(&oh->mtx);
 	}
 }
 
+/*
+ * Find the objhead without taking any locks or references.  The caller
+ * may only inspect it, and must call hcb_unpeek() with the token when
+ * done, after which it may be freed.
+ */
+
+static struct objhead * v_matchproto_(hash_peek_f)
+hcb_peek(struct worker *wrk, const void *digest, unsigned *token)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	AN(token);
+	*token = hcb_enter(wrk);
+	return (hcb_insert(wrk, &hcb_root[((const uint8_t *)digest)[0]],
+	    digest, NULL));
+}
+
+static void v_matchproto_(hash_unpeek_f)
+hcb_unpeek(unsigned token)
+{
+
+	hcb_leave(token);
+}
+
 static void v_matchproto_(hash_prep_f)
 hcb_prep(struct worker *wrk)
 {
@@ -455,4 +589,6 @@ const struct hash_slinger hcb_slinger = {
 	.lookup =	hcb_lookup,
 	.prep =		hcb_prep,
 	.deref  =	hcb_deref,
+	.peek =		hcb_peek,
+	.unpeek =	hcb_unpeek,
 };
@@ -39,6 +39,9 @@ typedef void hash_prep_f(struct worker *);
 typedef struct objhead *hash_lookup_f(struct worker *, const void *digest,
     struct objhead **);
 typedef int hash_deref_f(struct worker *, struct objhead *);
+typedef struct objhead *hash_peek_f(struct worker *, const void *digest,
+    unsigned *token);
+typedef void hash_unpeek_f(unsigned token);
 
 struct hash_slinger {
 	unsigned		magic;
@@ -49,6 +52,8 @@ struct hash_slinger {
 	hash_prep_f		*prep;
 	hash_lookup_f		*lookup;
 	hash_deref_f		*deref;
+	hash_peek_f		*peek;
+	hash_unpeek_f		*unpeek;
 };
 
 /* mgt_hash.c */
@@ -71,6 +71,7 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 	int err = 0, chunked = 0;
 	stream_close_t sc;
 	uint64_t hdrbytes, bytes;
+	void *sendfile_oc = NULL;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
@@ -97,9 +98,17 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 				req->doclose = SC_TX_EOF;
 			}
 		}
+		/*
+		 * sendfile() needs the storage to stay until V1L_Close(),
+		 * which is not the case for objects freed as they are
+		 * delivered, nor for ESI includes.
+		 */
+		if (!(req->res_mode & RES_ESI) && !(req->objcore->flags &
+		    (OC_F_PRIVATE | OC_F_HFM | OC_F_HFP)))
+			sendfile_oc = req->objcore;
 		INIT_OBJ(ctx, VRT_CTX_MAGIC);
 		VCL_Req2Ctx(ctx, req);
-		if (VDP_Push(ctx, req->vdc, req->ws, VDP_v1l, NULL)) {
+		if (VDP_Push(ctx, req->vdc, req->ws, VDP_v1l, sendfile_oc)) {
 			v1d_error(req, boc, "Failure to push v1d processor");
 			return;
 		}
@@ -46,8 +46,19 @@
 #include "cache/cache_filter.h"
 
 #include <stdio.h>
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#  include <sys/ioctl.h>
+#  include <sys/sendfile.h>
+#  ifdef HAVE_LINUX_SOCKIOS_H
+#    include <linux/sockios.h>
+#  endif
+#  ifdef SIOCOUTQ
+#    define V1L_SENDFILE 1
+#  endif
+#endif
 
 #include "cache_http1.h"
+#include "vtcp.h"
 #include "vtim.h"
 
 /*--------------------------------------------------------------------*/
@@ -66,6 +77,7 @@ struct v1l {
 	vtim_real		deadline;
 	struct vsl_log		*vsl;
 	ssize_t			cnt;	/* Flushed byte count */
+	unsigned		sendfile;
 	struct ws		*ws;
 	uintptr_t		ws_snap;
 };
@@ -127,6 +139,44 @@ V1L_Open(struct worker *wrk, struct ws *ws, int *fd, struct vsl_log *vsl,
 	WS_Release(ws, u * sizeof(struct iovec));
 }
 
+/*--------------------------------------------------------------------
+ * The kernel references the file pages sent with sendfile() until the
+ * peer has acknowledged them, but the caller drops its reference on the
+ * object, and so on its storage, when we return.  Wait for the socket
+ * to drain, and if it does not, make sure the close throws away what
+ * is left rather than sending storage which may have been reused.
+ */
+
+static int
+v1l_drain(const struct v1l *v1l, stream_close_t sc)
+{
+#ifdef V1L_SENDFILE
+	vtim_dur d = 1e-3;
+	int n;
+
+	while (sc == SC_NULL) {
+		if (ioctl(*v1l->wfd, SIOCOUTQ, &n) != 0)
+			break;
+		if (n == 0)
+			return (0);
+		if (VTIM_real() > v1l->deadline) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit total send timeout, "
+			    "unacknowledged = %d; not retrying", n);
+			break;
+		}
+		VTIM_sleep(d);
+		d = vmin_t(vtim_dur, d * 2, 0.1);
+	}
+	(void)VTCP_linger(*v1l->wfd, 1);
+	return (-1);
+#else
+	(void)v1l;
+	(void)sc;
+	WRONG("sendfile without V1L_SENDFILE");
+#endif
+}
+
 stream_close_t
 V1L_Close(struct worker *wrk, uint64_t *cnt)
 {
@@ -139,6 +189,10 @@ V1L_Close(struct worker *wrk, uint64_t *cnt)
 	AN(cnt);
 	sc = V1L_Flush(wrk);
 	TAKE_OBJ_NOTNULL(v1l, &wrk->v1l, V1L_MAGIC);
+	if (v1l->sendfile && *v1l->wfd >= 0 && v1l_drain(v1l, sc)) {
+		if (sc == SC_NULL)
+			sc = SC_TX_ERROR;
+	}
 	*cnt = v1l->cnt;
 	ws = v1l->ws;
 	ws_snap = v1l->ws_snap;
@@ -291,6 +345,113 @@ V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 	return (len);
 }
 
+/*--------------------------------------------------------------------
+ * Send a body segment with sendfile() if it lies in the mapping of a
+ * file backed stevedore and is large enough, otherwise add it to the
+ * io vector like V1L_Write().  Pending io vectors are flushed first,
+ * and with chunked encoding the segment is sent as a chunk of its own.
+ *
+ * The caller must hold a reference on the storage until V1L_Close().
+ */
+
+#ifdef V1L_SENDFILE
+static void
+v1l_raw(struct v1l *v1l, const void *ptr, ssize_t len)
+{
+
+	/* Not counted in cliov, so V1L_Flush() does not make it a chunk */
+	assert(v1l->niov < v1l->siov);
+	v1l->iov[v1l->niov].iov_base = TRUST_ME(ptr);
+	v1l->iov[v1l->niov].iov_len = len;
+	v1l->liov += len;
+	v1l->niov++;
+}
+#endif
+
+size_t
+V1L_SendFile(const struct worker *wrk, const void *ptr, ssize_t len)
+{
+#ifdef V1L_SENDFILE
+	struct v1l *v1l;
+	ssize_t i, l;
+	off_t off;
+	int fd, err;
+	char cbuf[32];
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	v1l = wrk->v1l;
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(v1l->wfd);
+	if (cache_param->sendfile_threshold == 0 ||
+	    len < (ssize_t)cache_param->sendfile_threshold ||
+	    *v1l->wfd < 0 || !STV_FileRef(ptr, len, &fd, &off))
+		return (V1L_Write(wrk, ptr, len));
+
+	if (V1L_Flush(wrk) != SC_NULL)
+		return (0);
+
+	if (v1l->ciov < v1l->siov) {
+		bprintf(cbuf, "%zx\r\n", len);
+		v1l_raw(v1l, cbuf, strlen(cbuf));
+		if (V1L_Flush(wrk) != SC_NULL)
+			return (0);
+	}
+
+	v1l->sendfile = 1;
+	l = len;
+	err = 0;
+	do {
+		if (VTIM_real() > v1l->deadline) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit total send timeout, "
+			    "sent = %zd/%zd; not retrying",
+			    len - l, len);
+			i = -1;
+			break;
+		}
+
+		i = sendfile(*v1l->wfd, fd, &off, l);
+		if (i > 0) {
+			v1l->cnt += i;
+			l -= i;
+		}
+
+		if (l == 0)
+			break;
+
+		err = i < 0 ? errno : 0;
+		if (err == EWOULDBLOCK) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit idle send timeout, "
+			    "sent = %zd/%zd; retrying",
+			    len - l, len);
+		}
+	} while (i > 0 || err == EWOULDBLOCK);
+
+	wrk->stats->http1_sendfile++;
+	wrk->stats->http1_sendfile_bytes += len - l;
+
+	if (l > 0) {
+		VSLb(v1l->vsl, SLT_Debug,
+		    "Sendfile error, retval = %zd, len = %zd, errno = %s",
+		    i, l, VAS_errtxt(err));
+		assert(v1l->werr == SC_NULL);
+		if (err == EPIPE)
+			v1l->werr = SC_REM_CLOSE;
+		else
+			v1l->werr = SC_TX_ERROR;
+		errno = err;
+	} else if (v1l->ciov < v1l->siov) {
+		v1l_raw(v1l, "\r\n", 2);
+		if (V1L_Flush(wrk) != SC_NULL)
+			return (0);
+	}
+	return (len - l);
+#else
+	return (V1L_Write(wrk, ptr, len));
+#endif
+}
+
 void
 V1L_Chunked(const struct worker *wrk)
 {
@@ -353,11 +514,14 @@ v1l_bytes(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
 	ssize_t wl = 0;
 
 	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
-	(void)priv;
+	AN(priv);
 
 	AZ(vdc->nxt);		/* always at the bottom of the pile */
 
-	if (len > 0)
+	/* V1D_Deliver() pushes us with a priv if sendfile() is safe */
+	if (len > 0 && *priv != NULL)
+		wl = V1L_SendFile(vdc->wrk, ptr, len);
+	else if (len > 0)
 		wl = V1L_Write(vdc->wrk, ptr, len);
 	if (act > VDP_NULL && V1L_Flush(vdc->wrk) != SC_NULL)
 		return (-1);
@@ -366,7 +530,18 @@ v1l_bytes(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
 	return (0);
 }
 
+static int v_matchproto_(vdp_fini_f)
+v1l_fini(struct vdp_ctx *vdc, void **priv)
+{
+
+	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
+	AN(priv);
+	*priv = NULL;
+	return (0);
+}
+
 const struct vdp * const VDP_v1l = &(struct vdp){
 	.name =		"V1B",
 	.bytes =	v1l_bytes,
+	.fini =		v1l_fini,
 };
@@ -98,7 +98,7 @@ V1P_Charge(struct req *req, const struct v1p_acct *a, struct VSC_vbe *b)
 {
 
 	AN(b);
-	VSLb(req->vsl, SLT_PipeAcct, "%ju %ju %ju %ju",
+	VSLb_uint(req->vsl, SLT_PipeAcct, 4,
 	    (uintmax_t)a->req,
 	    (uintmax_t)a->bereq,
 	    (uintmax_t)a->in,
@@ -72,6 +72,7 @@ extern const char * const builtin_vcl;
 
 void MAC_Arg(const char *);
 int MAC_reopen_sockets(void);
+int MAC_reuseport_sockets(void);
 
 /* mgt_child.c */
 void MCH_Init(void);
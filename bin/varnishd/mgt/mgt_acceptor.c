@@ -93,7 +93,9 @@ mac_opensocket(struct listen_sock *ls)
 		MCH_Fd_Inherit(ls->sock, NULL);
 		closefd(&ls->sock);
 	}
-	if (!ls->uds)
+	if (!ls->uds && ls->reuseport)
+		ls->sock = VTCP_bind_reuseport(ls->addr, NULL);
+	else if (!ls->uds)
 		ls->sock = VTCP_bind(ls->addr, NULL);
 	else
 		ls->sock = VUS_resolver(ls->endpoint, mac_vus_bind, NULL, &err);
@@ -141,6 +143,105 @@ MAC_reopen_sockets(void)
 	return (fail);
 }
 
+/*=====================================================================
+ * With listen_reuseport, give every TCP listen address one socket per
+ * thread pool, all bound with SO_REUSEPORT.  This is done before each
+ * child start, because the number of pools is only known then and the
+ * child may not be allowed to bind.  The primary socket is reopened
+ * whenever it needs SO_REUSEPORT set or cleared.
+ * returns the highest errno encountered, 0 for success
+ */
+
+static void
+mac_close_reuse(struct listen_sock *ls)
+{
+
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	AN(ls->primary);
+	VTAILQ_REMOVE(&heritage.socks, ls, list);
+	if (ls->sock > 0) {
+		MCH_Fd_Inherit(ls->sock, NULL);
+		closefd(&ls->sock);
+	}
+	VSA_free(&ls->addr);
+	free(ls->endpoint);
+	FREE_OBJ(ls);
+}
+
+int
+MAC_reuseport_sockets(void)
+{
+	struct listen_sock *ls, *ls2;
+	unsigned n = 1;
+	int err, fail = 0;
+
+#ifdef HAVE_SO_REUSEPORT
+	if (mgt_param.listen_reuseport)
+		n = mgt_param.wthread_pools;
+#endif
+
+	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		if (ls->uds || ls->primary != NULL)
+			continue;
+		if (ls->reuse == NULL) {
+			ls->reuse = calloc(1, sizeof *ls->reuse);
+			AN(ls->reuse);
+			ls->reuse[0] = ls;
+			ls->nreuse = 1;
+		}
+		while (ls->nreuse > n)
+			mac_close_reuse(ls->reuse[--ls->nreuse]);
+
+		if (ls->reuseport != (n > 1)) {
+			ls->reuseport = (n > 1);
+			VJ_master(JAIL_MASTER_PRIVPORT);
+			err = mac_opensocket(ls);
+			VJ_master(JAIL_MASTER_LOW);
+			if (err) {
+				fail = vmax(fail, err);
+				MGT_Complain(C_ERR,
+				    "Could not reopen listen socket %s: %s",
+				    ls->endpoint, VAS_errtxt(err));
+				continue;
+			}
+		}
+		if (ls->nreuse == n)
+			continue;
+
+		ls->reuse = realloc(ls->reuse, n * sizeof *ls->reuse);
+		AN(ls->reuse);
+		while (ls->nreuse < n) {
+			ALLOC_OBJ(ls2, LISTEN_SOCK_MAGIC);
+			AN(ls2);
+			ls2->sock = -1;
+			ls2->addr = VSA_Clone(ls->addr);
+			AN(ls2->addr);
+			REPLACE(ls2->endpoint, ls->endpoint);
+			ls2->name = ls->name;
+			ls2->transport = ls->transport;
+			ls2->reuseport = 1;
+			ls2->primary = ls;
+			VJ_master(JAIL_MASTER_PRIVPORT);
+			err = mac_opensocket(ls2);
+			VJ_master(JAIL_MASTER_LOW);
+			if (err) {
+				fail = vmax(fail, err);
+				MGT_Complain(C_ERR,
+				    "Could not open listen socket %s: %s",
+				    ls->endpoint, VAS_errtxt(err));
+				VSA_free(&ls2->addr);
+				free(ls2->endpoint);
+				FREE_OBJ(ls2);
+				break;
+			}
+			VTAILQ_INSERT_AFTER(&heritage.socks,
+			    ls->reuse[ls->nreuse - 1], ls2, list);
+			ls->reuse[ls->nreuse++] = ls2;
+		}
+	}
+	return (fail);
+}
+
 /*--------------------------------------------------------------------*/
 
 static struct listen_sock *
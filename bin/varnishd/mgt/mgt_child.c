@@ -317,6 +317,13 @@ mgt_launch_child(struct cli *cli)
 
 	child_state = CH_STARTING;
 
+	if (MAC_reuseport_sockets()) {
+		mgt_launch_err(cli, CLIS_CANT,
+		    "Could not open SO_REUSEPORT listen sockets");
+		child_state = CH_STOPPED;
+		return;
+	}
+
 	/* Open pipe for mgt->child CLI */
 	AZ(socketpair(AF_UNIX, SOCK_STREAM, 0, cp));
 	heritage.cli_fd = cp[0];
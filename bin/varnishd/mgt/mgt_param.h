@@ -79,6 +79,7 @@ tweak_t tweak_duration;
 tweak_t tweak_debug;
 tweak_t tweak_experimental;
 tweak_t tweak_feature;
+tweak_t tweak_header;
 tweak_t tweak_poolparam;
 tweak_t tweak_storage;
 tweak_t tweak_string;
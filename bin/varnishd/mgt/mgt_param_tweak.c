@@ -45,6 +45,7 @@
 #include "mgt/mgt_param.h"
 #include "storage/storage.h"
 #include "vav.h"
+#include "vct.h"
 #include "vnum.h"
 #include "vsl_priv.h"
 
@@ -592,6 +593,44 @@ tweak_storage(struct vsb *vsb, const struct parspec *par, const char *arg)
 	return (tweak_string(vsb, par, arg));
 }
 
+/*--------------------------------------------------------------------
+ * Tweak a header name, empty is allowed
+ */
+
+int v_matchproto_(tweak_t)
+tweak_header(struct vsb *vsb, const struct parspec *par, const char *arg)
+{
+	volatile char *dest;
+	const char *p;
+	char buf[PARAM_HEADER_LEN + 1];
+
+	dest = par->priv;
+	if (arg == NULL || arg == JSON_FMT) {
+		bprintf(buf, "%s", (const char *)TRUST_ME(dest));
+		if (arg == JSON_FMT) {
+			VSB_putc(vsb, '"');
+			VSB_quote(vsb, buf, -1, VSB_QUOTE_JSON);
+			VSB_putc(vsb, '"');
+		} else
+			VSB_quote(vsb, buf, -1, 0);
+		return (0);
+	}
+
+	for (p = arg; *p != '\0'; p++) {
+		if (!vct_istchar(*p)) {
+			VSB_printf(vsb, "invalid header name '%s'", arg);
+			return (-1);
+		}
+	}
+	if (p - arg > PARAM_HEADER_LEN) {
+		VSB_cat(vsb, "header name too long");
+		return (-1);
+	}
+	bprintf(buf, "%s", arg);
+	memcpy(TRUST_ME(dest), buf, sizeof buf);
+	return (0);
+}
+
 /*--------------------------------------------------------------------
  * Tweak alias
  */
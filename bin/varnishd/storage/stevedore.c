@@ -100,6 +100,119 @@ STV_NewObject(struct worker *wrk, struct objcore *oc,
 	return (1);
 }
 
+/*-------------------------------------------------------------------
+ * Ask the admission filter of the stevedore, if any, whether a new
+ * object of len bytes (-1 if unknown) should be stored.
+ */
+
+int
+STV_Admit(struct worker *wrk, const struct objcore *oc,
+    const struct stevedore *stv, ssize_t len)
+{
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+
+	if (stv->lru == NULL)
+		return (1);
+	return (LRU_Admit(wrk, stv->lru, oc, len));
+}
+
+/*-------------------------------------------------------------------
+ * Let the admission filters forget about formerly popular objects.
+ * Called periodically from the expiry thread.
+ */
+
+void
+STV_AgeLRU(void)
+{
+	struct stevedore *stv;
+
+	STV_Foreach(stv)
+		if (stv->lru != NULL)
+			LRU_Age(stv->lru);
+}
+
+/*-------------------------------------------------------------------
+ * Pick one of n shards for the calling thread.  Threads in the same
+ * pool get the same shard, other threads go by their worker.
+ */
+
+unsigned
+STV_Shard(unsigned n)
+{
+	struct worker *wrk;
+	uint64_t u;
+
+	AN(n);
+	if (n == 1)
+		return (0);
+	wrk = THR_GetWorker();
+	if (wrk == NULL)
+		return (0);
+	if (wrk->pool != NULL)
+		u = (uintptr_t)wrk->pool;
+	else
+		u = (uintptr_t)wrk;
+	u *= 0x9e3779b97f4a7c15ULL;
+	return ((u >> 32) % n);
+}
+
+/*-------------------------------------------------------------------
+ * File backed stevedores register their mappings here, so delivery can
+ * find the file and offset behind a pointer into storage and hand it
+ * to sendfile().  Mappings are only added while the stevedores are
+ * opened, before any delivery, so lookups need no lock.
+ */
+
+#define STV_NFMAP	64
+
+static struct stv_fmap {
+	uintptr_t		ptr;
+	size_t			len;
+	int			fd;
+	off_t			off;
+} stv_fmap[STV_NFMAP];
+static unsigned stv_nfmap;
+
+void
+STV_FileMap(const void *ptr, size_t len, int fd, off_t off)
+{
+	struct stv_fmap *fm;
+
+	ASSERT_CLI();
+	AN(ptr);
+	AN(len);
+	assert(fd >= 0);
+	if (stv_nfmap == STV_NFMAP)
+		return;
+	fm = &stv_fmap[stv_nfmap++];
+	fm->ptr = (uintptr_t)ptr;
+	fm->len = len;
+	fm->fd = fd;
+	fm->off = off;
+}
+
+int
+STV_FileRef(const void *ptr, size_t len, int *fd, off_t *off)
+{
+	const struct stv_fmap *fm;
+	uintptr_t p = (uintptr_t)ptr;
+	unsigned u;
+
+	AN(fd);
+	AN(off);
+	for (u = 0; u < stv_nfmap; u++) {
+		fm = &stv_fmap[u];
+		if (p < fm->ptr || p + len > fm->ptr + fm->len)
+			continue;
+		*fd = fm->fd;
+		*off = fm->off + (off_t)(p - fm->ptr);
+		return (1);
+	}
+	return (0);
+}
+
 /*-------------------------------------------------------------------*/
 
 struct stv_buffer {
@@ -129,6 +129,8 @@ void STV_Register(const struct stevedore *, const char *altname);
 #define STV_Foreach(arg) for (arg = NULL; STV__iter(&arg);)
 
 int STV__iter(struct stevedore ** const );
+unsigned STV_Shard(unsigned n);
+void STV_FileMap(const void *ptr, size_t len, int fd, off_t off);
 
 /*--------------------------------------------------------------------*/
 int STV_GetFile(const char *fn, int *fdp, const char **fnp, const char *ctx);
@@ -136,16 +138,20 @@ uintmax_t STV_FileSize(int fd, const char *size, unsigned *granularity,
     const char *ctx);
 
 /*--------------------------------------------------------------------*/
-struct lru *LRU_Alloc(void);
+struct lru *LRU_Alloc(const char *ident);
 void LRU_Free(struct lru **);
-void LRU_Add(struct objcore *, vtim_real now);
+void LRU_Add(struct objcore *, vtim_real now, uint64_t len);
 void LRU_Remove(struct objcore *);
 int LRU_NukeOne(struct worker *, struct lru *);
+int LRU_Admit(struct worker *, struct lru *, const struct objcore *,
+    ssize_t len);
+void LRU_Age(struct lru *);
 void LRU_Touch(struct worker *, struct objcore *, vtim_real now);
 
 /*--------------------------------------------------------------------*/
 extern const struct stevedore smu_stevedore;
 extern const struct stevedore sma_stevedore;
+extern const struct stevedore sms_stevedore;
 extern const struct stevedore smd_stevedore;
 extern const struct stevedore smf_stevedore;
 extern const struct stevedore smp_stevedore;
@@ -46,6 +46,7 @@
 
 #include "vnum.h"
 #include "vfil.h"
+#include "vtree.h"
 
 #include "VSC_smf.h"
 
@@ -64,27 +65,32 @@
 #define MINPAGES		128
 
 /*
- * Number of buckets on free-list.
+ * Free ranges shorter than this many pages count as fragments.
  *
- * Last bucket is "larger than" so choose number so that the second
- * to last bucket matches the 128k CHUNKSIZE in cache_fetch.c when
- * using the a 4K minimal page size
+ * Chosen so that the 128k CHUNKSIZE in cache_fetch.c is not a fragment
+ * when using the a 4K minimal page size
  */
-#define NBUCKET			(128 / 4 + 1)
+#define SMF_LARGE		(128 / 4 + 1)
 
 static struct VSC_lck *lck_smf;
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * The file is split into file_shards shards, each with its own lock,
+ * and its free ranges in a tree ordered by size and offset, so the
+ * best fit is found in O(log n).
+ */
 
 VTAILQ_HEAD(smfhead, smf);
+VRBT_HEAD(smf_tree, smf);
 
 struct smf {
 	unsigned		magic;
 #define SMF_MAGIC		0x0927a8a0
 	struct storage		s;
-	struct smf_sc		*sc;
+	struct smf_shard	*sh;
 
 	int			alloc;
+	int			intree;
 
 	off_t			size;
 	off_t			offset;
@@ -92,7 +98,20 @@ struct smf {
 
 	VTAILQ_ENTRY(smf)	order;
 	VTAILQ_ENTRY(smf)	status;
-	struct smfhead		*flist;
+	VRBT_ENTRY(smf)		tree;
+};
+
+struct smf_shard {
+	unsigned		magic;
+#define SMF_SHARD_MAGIC		0x1f5de7c3
+	struct lock		mtx;
+	struct smf_sc		*sc;
+	unsigned		nop;
+	struct VSC_smf_shard	stats[1];
+
+	struct smfhead		order;
+	struct smf_tree		free;
+	struct smfhead		used;
 };
 
 struct smf_sc {
@@ -106,11 +125,26 @@ struct smf_sc {
 	unsigned		pagesize;
 	uintmax_t		filesize;
 	int			advice;
-	struct smfhead		order;
-	struct smfhead		free[NBUCKET];
-	struct smfhead		used;
+	unsigned		nshard;
+	struct smf_shard	*shard;
 };
 
+static inline int
+smf_cmp(const struct smf *a, const struct smf *b)
+{
+	if (a->size != b->size)
+		return (a->size < b->size ? -1 : 1);
+	if (a->offset != b->offset)
+		return (a->offset < b->offset ? -1 : 1);
+	return (0);
+}
+
+VRBT_GENERATE_INSERT_COLOR(smf_tree, smf, tree, static)
+VRBT_GENERATE_INSERT_FINISH(smf_tree, smf, tree, static)
+VRBT_GENERATE_INSERT(smf_tree, smf, tree, smf_cmp, static)
+VRBT_GENERATE_REMOVE_COLOR(smf_tree, smf, tree, static)
+VRBT_GENERATE_REMOVE(smf_tree, smf, tree, static)
+
 /*--------------------------------------------------------------------*/
 
 static void v_matchproto_(storage_init_f)
@@ -118,7 +152,6 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 {
 	const char *size, *fn, *r;
 	struct smf_sc *sc;
-	unsigned u;
 	uintmax_t page_size;
 	int advice = MADV_RANDOM;
 
@@ -155,10 +188,6 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 
 	ALLOC_OBJ(sc, SMF_SC_MAGIC);
 	XXXAN(sc);
-	VTAILQ_INIT(&sc->order);
-	for (u = 0; u < NBUCKET; u++)
-		VTAILQ_INIT(&sc->free[u]);
-	VTAILQ_INIT(&sc->used);
 	sc->pagesize = page_size;
 	sc->advice = advice;
 	parent->priv = sc;
@@ -171,101 +200,114 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 }
 
 /*--------------------------------------------------------------------
- * Insert/Remove from correct freelist
+ * Summ the shard counters into the stevedore counters.  Like the
+ * worker stats, try every time but only insist every so often.
  */
 
 static void
-insfree(struct smf_sc *sc, struct smf *sp)
+smf_summ(struct smf_shard *sh)
 {
-	off_t b, ns;
-	struct smf *sp2;
+	struct smf_sc *sc;
 
-	AZ(sp->alloc);
-	assert(sp->flist == NULL);
-	Lck_AssertHeld(&sc->mtx);
-	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
-		sc->stats->g_smf_large++;
+	Lck_AssertHeld(&sh->mtx);
+	sc = sh->sc;
+	if (++sh->nop < 64) {
+		if (Lck_Trylock(&sc->mtx))
+			return;
 	} else {
-		sc->stats->g_smf_frag++;
-	}
-	sp->flist = &sc->free[b];
-	ns = b * sc->pagesize;
-	VTAILQ_FOREACH(sp2, sp->flist, status) {
-		assert(sp2->size >= ns);
-		AZ(sp2->alloc);
-		assert(sp2->flist == sp->flist);
-		if (sp->offset < sp2->offset)
-			break;
+		Lck_Lock(&sc->mtx);
 	}
-	if (sp2 == NULL)
-		VTAILQ_INSERT_TAIL(sp->flist, sp, status);
+	sh->nop = 0;
+	VSC_smf_Summ_shard(sc->stats, sh->stats);
+	Lck_Unlock(&sc->mtx);
+	memset(sh->stats, 0, sizeof sh->stats);
+}
+
+/*--------------------------------------------------------------------
+ * Insert/Remove from the free tree
+ */
+
+static void
+insfree(struct smf_shard *sh, struct smf *sp)
+{
+
+	AZ(sp->alloc);
+	AZ(sp->intree);
+	Lck_AssertHeld(&sh->mtx);
+	if (sp->size / sh->sc->pagesize >= SMF_LARGE)
+		sh->stats->g_smf_large++;
 	else
-		VTAILQ_INSERT_BEFORE(sp2, sp, status);
+		sh->stats->g_smf_frag++;
+	AZ(VRBT_INSERT(smf_tree, &sh->free, sp));
+	sp->intree = 1;
 }
 
 static void
-remfree(const struct smf_sc *sc, struct smf *sp)
+remfree(struct smf_shard *sh, struct smf *sp)
 {
-	size_t b;
 
 	AZ(sp->alloc);
-	assert(sp->flist != NULL);
-	Lck_AssertHeld(&sc->mtx);
-	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
-		sc->stats->g_smf_large--;
-	} else {
-		sc->stats->g_smf_frag--;
+	AN(sp->intree);
+	Lck_AssertHeld(&sh->mtx);
+	if (sp->size / sh->sc->pagesize >= SMF_LARGE)
+		sh->stats->g_smf_large--;
+	else
+		sh->stats->g_smf_frag--;
+	(void)VRBT_REMOVE(smf_tree, &sh->free, sp);
+	sp->intree = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Find the smallest free range which is large enough, the one with the
+ * lowest offset if there are several.
+ */
+
+static struct smf *
+bestfit_smf(struct smf_shard *sh, off_t bytes)
+{
+	struct smf *sp, *res = NULL;
+
+	sh->stats->c_search++;
+	sp = VRBT_ROOT(&sh->free);
+	while (sp != NULL) {
+		sh->stats->c_search_steps++;
+		if (sp->size >= bytes) {
+			res = sp;
+			sp = VRBT_LEFT(sp, tree);
+		} else {
+			sp = VRBT_RIGHT(sp, tree);
+		}
 	}
-	assert(sp->flist == &sc->free[b]);
-	VTAILQ_REMOVE(sp->flist, sp, status);
-	sp->flist = NULL;
+	return (res);
 }
 
 /*--------------------------------------------------------------------
- * Allocate a range from the first free range that is large enough.
+ * Allocate a range from the best fitting free range.
  */
 
 static struct smf *
-alloc_smf(struct smf_sc *sc, off_t bytes)
+alloc_smf(struct smf_shard *sh, off_t bytes)
 {
 	struct smf *sp, *sp2;
-	off_t b;
-
-	AZ(bytes % sc->pagesize);
-	b = bytes / sc->pagesize;
-	if (b >= NBUCKET)
-		b = NBUCKET - 1;
-	sp = NULL;
-	for (; b < NBUCKET - 1; b++) {
-		sp = VTAILQ_FIRST(&sc->free[b]);
-		if (sp != NULL)
-			break;
-	}
-	if (sp == NULL) {
-		VTAILQ_FOREACH(sp, &sc->free[NBUCKET -1], status)
-			if (sp->size >= bytes)
-				break;
-	}
+
+	AZ(bytes % sh->sc->pagesize);
+	sp = bestfit_smf(sh, bytes);
 	if (sp == NULL)
 		return (sp);
 
 	assert(sp->size >= bytes);
-	remfree(sc, sp);
+	remfree(sh, sp);
 
 	if (sp->size == bytes) {
 		sp->alloc = 1;
-		VTAILQ_INSERT_TAIL(&sc->used, sp, status);
+		VTAILQ_INSERT_TAIL(&sh->used, sp, status);
 		return (sp);
 	}
 
 	/* Split from front */
 	sp2 = malloc(sizeof *sp2);
 	XXXAN(sp2);
-	sc->stats->g_smf++;
+	sh->stats->g_smf++;
 	*sp2 = *sp;
 
 	sp->offset += bytes;
@@ -275,27 +317,28 @@ alloc_smf(struct smf_sc *sc, off_t bytes)
 	sp2->size = bytes;
 	sp2->alloc = 1;
 	VTAILQ_INSERT_BEFORE(sp, sp2, order);
-	VTAILQ_INSERT_TAIL(&sc->used, sp2, status);
-	insfree(sc, sp);
+	VTAILQ_INSERT_TAIL(&sh->used, sp2, status);
+	insfree(sh, sp);
 	return (sp2);
 }
 
 /*--------------------------------------------------------------------
- * Free a range.  Attempt merge forward and backward, then sort into
- * free list according to age.
+ * Free a range.  Attempt merge forward and backward, then insert it
+ * into the free tree.
  */
 
 static void
 free_smf(struct smf *sp)
 {
 	struct smf *sp2;
-	struct smf_sc *sc = sp->sc;
+	struct smf_shard *sh = sp->sh;
 
 	CHECK_OBJ_NOTNULL(sp, SMF_MAGIC);
+	CHECK_OBJ_NOTNULL(sh, SMF_SHARD_MAGIC);
 	AN(sp->alloc);
 	assert(sp->size > 0);
-	AZ(sp->size % sc->pagesize);
-	VTAILQ_REMOVE(&sc->used, sp, status);
+	AZ(sp->size % sh->sc->pagesize);
+	VTAILQ_REMOVE(&sh->used, sp, status);
 	sp->alloc = 0;
 
 	sp2 = VTAILQ_NEXT(sp, order);
@@ -303,11 +346,12 @@ free_smf(struct smf *sp)
 	    sp2->alloc == 0 &&
 	    (sp2->ptr == sp->ptr + sp->size) &&
 	    (sp2->offset == sp->offset + sp->size)) {
+		remfree(sh, sp2);
 		sp->size += sp2->size;
-		VTAILQ_REMOVE(&sc->order, sp2, order);
-		remfree(sc, sp2);
+		VTAILQ_REMOVE(&sh->order, sp2, order);
 		free(sp2);
-		sc->stats->g_smf--;
+		sh->stats->g_smf--;
+		sh->stats->c_coalesce++;
 	}
 
 	sp2 = VTAILQ_PREV(sp, smfhead, order);
@@ -315,15 +359,16 @@ free_smf(struct smf *sp)
 	    sp2->alloc == 0 &&
 	    (sp->ptr == sp2->ptr + sp2->size) &&
 	    (sp->offset == sp2->offset + sp2->size)) {
-		remfree(sc, sp2);
+		remfree(sh, sp2);
 		sp2->size += sp->size;
-		VTAILQ_REMOVE(&sc->order, sp, order);
+		VTAILQ_REMOVE(&sh->order, sp, order);
 		free(sp);
-		sc->stats->g_smf--;
+		sh->stats->g_smf--;
+		sh->stats->c_coalesce++;
 		sp = sp2;
 	}
 
-	insfree(sc, sp);
+	insfree(sh, sp);
 }
 
 /*--------------------------------------------------------------------
@@ -331,32 +376,32 @@ free_smf(struct smf *sp)
  */
 
 static void
-new_smf(struct smf_sc *sc, unsigned char *ptr, off_t off, size_t len)
+new_smf(struct smf_shard *sh, unsigned char *ptr, off_t off, size_t len)
 {
 	struct smf *sp, *sp2;
 
-	AZ(len % sc->pagesize);
+	AZ(len % sh->sc->pagesize);
 	ALLOC_OBJ(sp, SMF_MAGIC);
 	XXXAN(sp);
 	sp->s.magic = STORAGE_MAGIC;
-	sc->stats->g_smf++;
+	sh->stats->g_smf++;
 
-	sp->sc = sc;
+	sp->sh = sh;
 	sp->size = len;
 	sp->ptr = ptr;
 	sp->offset = off;
 	sp->alloc = 1;
 
-	VTAILQ_FOREACH(sp2, &sc->order, order) {
+	VTAILQ_FOREACH(sp2, &sh->order, order) {
 		if (sp->ptr < sp2->ptr) {
 			VTAILQ_INSERT_BEFORE(sp2, sp, order);
 			break;
 		}
 	}
 	if (sp2 == NULL)
-		VTAILQ_INSERT_TAIL(&sc->order, sp, order);
+		VTAILQ_INSERT_TAIL(&sh->order, sp, order);
 
-	VTAILQ_INSERT_HEAD(&sc->used, sp, status);
+	VTAILQ_INSERT_HEAD(&sh->used, sp, status);
 
 	free_smf(sp);
 }
@@ -371,8 +416,10 @@ new_smf(struct smf_sc *sc, unsigned char *ptr, off_t off, size_t len)
  */
 
 static void
-smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
+smf_open_chunk(struct smf_shard *sh, off_t sz, off_t off, off_t *fail,
+    off_t *sum)
 {
+	struct smf_sc *sc = sh->sc;
 	void *p;
 	off_t h;
 
@@ -388,7 +435,8 @@ smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
 		if (p != MAP_FAILED) {
 			(void)madvise(p, sz, sc->advice);
 			(*sum) += sz;
-			new_smf(sc, p, off, sz);
+			STV_FileMap(p, sz, sc->fd, off);
+			new_smf(sh, p, off, sz);
 			return;
 		}
 	}
@@ -399,27 +447,54 @@ smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
 	h = sz / 2;
 	h -= (h % sc->pagesize);
 
-	smf_open_chunk(sc, h, off, fail, sum);
-	smf_open_chunk(sc, sz - h, off + h, fail, sum);
+	smf_open_chunk(sh, h, off, fail, sum);
+	smf_open_chunk(sh, sz - h, off + h, fail, sum);
 }
 
 static void v_matchproto_(storage_open_f)
 smf_open(struct stevedore *st)
 {
 	struct smf_sc *sc;
+	struct smf_shard *sh;
 	off_t fail = 1 << 30;	/* XXX: where is OFF_T_MAX ? */
-	off_t sum = 0;
+	off_t sum = 0, off, len;
+	unsigned u;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st->ident);
 	if (lck_smf == NULL)
 		lck_smf = Lck_CreateClass(NULL, "smf");
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
 	sc->stats = VSC_smf_New(NULL, NULL, st->ident);
 	Lck_New(&sc->mtx, lck_smf);
-	Lck_Lock(&sc->mtx);
-	smf_open_chunk(sc, sc->filesize, 0, &fail, &sum);
-	Lck_Unlock(&sc->mtx);
+
+	/* Each shard gets a whole number of pages, the last one the rest */
+	sc->nshard = cache_param->file_shards;
+	len = (off_t)(sc->filesize / sc->pagesize / sc->nshard);
+	if (len < MINPAGES)
+		sc->nshard = 1;
+	len *= sc->pagesize;
+	sc->shard = calloc(sc->nshard, sizeof *sc->shard);
+	AN(sc->shard);
+	for (u = 0; u < sc->nshard; u++) {
+		sh = &sc->shard[u];
+		INIT_OBJ(sh, SMF_SHARD_MAGIC);
+		sh->sc = sc;
+		Lck_New(&sh->mtx, lck_smf);
+		VTAILQ_INIT(&sh->order);
+		VRBT_INIT(&sh->free);
+		VTAILQ_INIT(&sh->used);
+		off = (off_t)u * len;
+		if (u == sc->nshard - 1)
+			len = (off_t)sc->filesize - off;
+		Lck_Lock(&sh->mtx);
+		smf_open_chunk(sh, len, off, &fail, &sum);
+		Lck_Lock(&sc->mtx);
+		VSC_smf_Summ_shard(sc->stats, sh->stats);
+		Lck_Unlock(&sc->mtx);
+		memset(sh->stats, 0, sizeof sh->stats);
+		Lck_Unlock(&sh->mtx);
+	}
 	if (sum < MINPAGES * (off_t)getpagesize()) {
 		ARGV_ERR(
 		    "-sfile too small for this architecture,"
@@ -437,14 +512,18 @@ smf_open(struct stevedore *st)
 	sc->stats->g_space += sc->filesize;
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Try the shard of this thread first, then the others.
+ */
 
 static struct storage * v_matchproto_(sml_alloc_f)
 smf_alloc(const struct stevedore *st, size_t sz)
 {
-	struct smf *smf;
+	struct smf *smf = NULL;
 	struct smf_sc *sc;
+	struct smf_shard *sh = NULL;
 	off_t size;
+	unsigned u, n;
 
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
 	assert(sz > 0);
@@ -452,20 +531,28 @@ smf_alloc(const struct stevedore *st, size_t sz)
 	size = (off_t)sz;
 	size += (sc->pagesize - 1UL);
 	size &= ~(sc->pagesize - 1UL);
-	Lck_Lock(&sc->mtx);
-	sc->stats->c_req++;
-	smf = alloc_smf(sc, size);
-	if (smf == NULL) {
-		sc->stats->c_fail++;
-		Lck_Unlock(&sc->mtx);
-		return (NULL);
+	u = STV_Shard(sc->nshard);
+	for (n = 0; smf == NULL && n < sc->nshard; n++) {
+		sh = &sc->shard[(u + n) % sc->nshard];
+		Lck_Lock(&sh->mtx);
+		sh->stats->c_req++;
+		smf = alloc_smf(sh, size);
+		if (smf == NULL) {
+			sh->stats->c_fail++;
+			smf_summ(sh);
+			Lck_Unlock(&sh->mtx);
+		}
 	}
+	if (smf == NULL)
+		return (NULL);
 	CHECK_OBJ_NOTNULL(smf, SMF_MAGIC);
-	sc->stats->g_alloc++;
-	sc->stats->c_bytes += smf->size;
-	sc->stats->g_bytes += smf->size;
-	sc->stats->g_space -= smf->size;
-	Lck_Unlock(&sc->mtx);
+	AN(sh);
+	sh->stats->g_alloc++;
+	sh->stats->c_bytes += smf->size;
+	sh->stats->g_bytes += smf->size;
+	sh->stats->g_space -= smf->size;
+	smf_summ(sh);
+	Lck_Unlock(&sh->mtx);
 	CHECK_OBJ_NOTNULL(&smf->s, STORAGE_MAGIC);	/*lint !e774 */
 	XXXAN(smf);
 	assert(smf->size == size);
@@ -482,18 +569,20 @@ static void v_matchproto_(sml_free_f)
 smf_free(struct storage *s)
 {
 	struct smf *smf;
-	struct smf_sc *sc;
+	struct smf_shard *sh;
 
 	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
 	CAST_OBJ_NOTNULL(smf, s->priv, SMF_MAGIC);
-	sc = smf->sc;
-	Lck_Lock(&sc->mtx);
-	sc->stats->g_alloc--;
-	sc->stats->c_freed += smf->size;
-	sc->stats->g_bytes -= smf->size;
-	sc->stats->g_space += smf->size;
+	sh = smf->sh;
+	CHECK_OBJ_NOTNULL(sh, SMF_SHARD_MAGIC);
+	Lck_Lock(&sh->mtx);
+	sh->stats->g_alloc--;
+	sh->stats->c_freed += smf->size;
+	sh->stats->g_bytes -= smf->size;
+	sh->stats->g_space += smf->size;
 	free_smf(smf);
-	Lck_Unlock(&sc->mtx);
+	smf_summ(sh);
+	Lck_Unlock(&sh->mtx);
 }
 
 /*--------------------------------------------------------------------*/
@@ -28,22 +28,64 @@
  * SUCH DAMAGE.
  *
  * Least-Recently-Used logic for freeing space in stevedores.
+ *
+ * With the lru_clock parameter, the lists are run as a CLOCK instead:
+ * A hit only marks the objcore as referenced, without taking any lock,
+ * and the nuker acts as the clock hand, sparing and unmarking the
+ * referenced objects it passes.
+ *
+ * With the lru_admission parameter, a count-min sketch of lookup
+ * frequencies is kept (TinyLFU), and while the stevedore is nuking,
+ * new objects are only admitted if they are more popular than the
+ * objects which would be evicted to make room for them.
  */
 
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "cache/cache_varnishd.h"
 #include "cache/cache_objhead.h"
 
 #include "storage/storage.h"
 
+#include "vtim.h"
+
+#include "VSC_lru.h"
+
+struct lru_shard {
+	VTAILQ_HEAD(,objcore)	lru_head;
+	struct lock		mtx;
+	unsigned		n_oc;
+	struct VSC_lru		*stats;
+	struct vsc_seg		*vsc_seg;
+};
+
+#define LRU_SKETCH_ROWS		4
+#define LRU_SKETCH_BITS		16
+#define LRU_SKETCH_WIDTH	(1U << LRU_SKETCH_BITS)
+#define LRU_SKETCH_RESET	(10U * LRU_SKETCH_WIDTH)
+
+/*
+ * The sketch is updated with atomic operations but without locking.
+ * Aging it races with increments, which only makes the frequency
+ * estimates slightly less accurate.
+ */
+struct lru_sketch {
+	unsigned		nadd;
+	uint8_t			cnt[LRU_SKETCH_ROWS][LRU_SKETCH_WIDTH];
+};
+
 struct lru {
 	unsigned		magic;
 #define LRU_MAGIC		0x3fec7bb0
-	VTAILQ_HEAD(,objcore)	lru_head;
-	struct lock		mtx;
+	unsigned		nshard;
+	unsigned		clock;
+	unsigned		nuke_next;
+	struct lru_shard	*shard;
+	struct lru_sketch	*sketch;
+	vtim_real		t_nuke;
 };
 
 static struct lru *
@@ -55,15 +97,50 @@ lru_get(const struct objcore *oc)
 	return (oc->stobj->stevedore->lru);
 }
 
+/*--------------------------------------------------------------------
+ * The shard of an objcore must not change while it is on the LRU, so
+ * we hash the address, which is stable for the lifetime of the objcore.
+ */
+
+static struct lru_shard *
+lru_shard(const struct lru *lru, const struct objcore *oc)
+{
+	uint64_t u;
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	if (lru->nshard == 1)
+		return (lru->shard);
+	u = (uintptr_t)oc;
+	u *= 0x9e3779b97f4a7c15ULL;
+	return (&lru->shard[(u >> 32) % lru->nshard]);
+}
+
 struct lru *
-LRU_Alloc(void)
+LRU_Alloc(const char *ident)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
+	unsigned u;
 
+	AN(ident);
 	ALLOC_OBJ(lru, LRU_MAGIC);
 	AN(lru);
-	VTAILQ_INIT(&lru->lru_head);
-	Lck_New(&lru->mtx, lck_lru);
+	lru->nshard = cache_param->lru_shards;
+	lru->clock = cache_param->lru_clock;
+	if (cache_param->lru_admission) {
+		lru->sketch = calloc(1, sizeof *lru->sketch);
+		AN(lru->sketch);
+	}
+	assert(lru->nshard > 0);
+	lru->shard = calloc(lru->nshard, sizeof *lru->shard);
+	AN(lru->shard);
+	for (u = 0; u < lru->nshard; u++) {
+		ls = &lru->shard[u];
+		VTAILQ_INIT(&ls->lru_head);
+		Lck_New(&ls->mtx, lck_lru);
+		ls->stats = VSC_lru_New(NULL, &ls->vsc_seg, "%s.%u", ident, u);
+		AN(ls->stats);
+	}
 	return (lru);
 }
 
@@ -71,19 +148,105 @@ void
 LRU_Free(struct lru **pp)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(lru, pp, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	AN(VTAILQ_EMPTY(&lru->lru_head));
-	Lck_Unlock(&lru->mtx);
-	Lck_Delete(&lru->mtx);
+	for (u = 0; u < lru->nshard; u++) {
+		ls = &lru->shard[u];
+		Lck_Lock(&ls->mtx);
+		AN(VTAILQ_EMPTY(&ls->lru_head));
+		Lck_Unlock(&ls->mtx);
+		Lck_Delete(&ls->mtx);
+		VSC_lru_Destroy(&ls->vsc_seg);
+	}
+	free(lru->shard);
+	free(lru->sketch);
 	FREE_OBJ(lru);
 }
 
+/*--------------------------------------------------------------------
+ * Count-min sketch of lookup frequencies, indexed by the object digest.
+ * The digest is a cryptographic hash, so we can use disjoint parts of
+ * it as the independent hashes for the rows.  Counts are halved once in
+ * a while to let the sketch forget about formerly popular objects.
+ */
+
+static unsigned
+lru_sketch_idx(const uint8_t *digest, unsigned row)
+{
+	unsigned u;
+
+	assert(row < LRU_SKETCH_ROWS);
+	u = digest[2 * row];
+	u |= (unsigned)digest[2 * row + 1] << 8;
+	return (u & (LRU_SKETCH_WIDTH - 1));
+}
+
+static unsigned
+lru_sketch_get(const struct lru_sketch *sk, const struct objcore *oc)
+{
+	const uint8_t *digest;
+	unsigned u, c, r = UINT8_MAX;
+
+	AN(sk);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	digest = oc->objhead->digest;
+	for (u = 0; u < LRU_SKETCH_ROWS; u++) {
+		c = __atomic_load_n(&sk->cnt[u][lru_sketch_idx(digest, u)],
+		    __ATOMIC_RELAXED);
+		r = vmin(r, c);
+	}
+	return (r);
+}
+
+static void
+lru_sketch_add(struct lru_sketch *sk, const struct objcore *oc)
+{
+	const uint8_t *digest;
+	uint8_t *p, c;
+	unsigned u;
+
+	AN(sk);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	digest = oc->objhead->digest;
+	for (u = 0; u < LRU_SKETCH_ROWS; u++) {
+		p = &sk->cnt[u][lru_sketch_idx(digest, u)];
+		c = __atomic_load_n(p, __ATOMIC_RELAXED);
+		while (c < UINT8_MAX && !__atomic_compare_exchange_n(p, &c,
+		    c + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			continue;
+	}
+	(void)__atomic_add_fetch(&sk->nadd, 1, __ATOMIC_RELAXED);
+}
+
 void
-LRU_Add(struct objcore *oc, vtim_real now)
+LRU_Age(struct lru *lru)
 {
-	struct lru *lru;
+	struct lru_sketch *sk;
+	uint8_t *p;
+	unsigned u, v;
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	sk = lru->sketch;
+	if (sk == NULL ||
+	    __atomic_load_n(&sk->nadd, __ATOMIC_RELAXED) < LRU_SKETCH_RESET)
+		return;
+	__atomic_store_n(&sk->nadd, 0, __ATOMIC_RELAXED);
+	for (u = 0; u < LRU_SKETCH_ROWS; u++) {
+		for (v = 0; v < LRU_SKETCH_WIDTH; v++) {
+			p = &sk->cnt[u][v];
+			__atomic_store_n(p,
+			    __atomic_load_n(p, __ATOMIC_RELAXED) >> 1,
+			    __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void
+LRU_Add(struct objcore *oc, vtim_real now, uint64_t len)
+{
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -93,19 +256,22 @@ LRU_Add(struct objcore *oc, vtim_real now)
 	AZ(oc->boc);
 	AN(isnan(oc->last_lru));
 	AZ(isnan(now));
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	ls = lru_shard(lru_get(oc), oc);
+	Lck_Lock(&ls->mtx);
+	VTAILQ_INSERT_TAIL(&ls->lru_head, oc, lru_list);
 	oc->last_lru = now;
+	oc->lru_ref = 0;
+	oc->lru_size = (len == 0) ? 0 : 64 - __builtin_clzll(len);
 	AZ(isnan(oc->last_lru));
-	Lck_Unlock(&lru->mtx);
+	ls->n_oc++;
+	ls->stats->g_objects++;
+	Lck_Unlock(&ls->mtx);
 }
 
 void
 LRU_Remove(struct objcore *oc)
 {
-	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -113,19 +279,22 @@ LRU_Remove(struct objcore *oc)
 		return;
 
 	AZ(oc->boc);
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
+	ls = lru_shard(lru_get(oc), oc);
+	Lck_Lock(&ls->mtx);
 	AZ(isnan(oc->last_lru));
-	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+	VTAILQ_REMOVE(&ls->lru_head, oc, lru_list);
 	oc->last_lru = NAN;
-	Lck_Unlock(&lru->mtx);
+	AN(ls->n_oc);
+	ls->n_oc--;
+	ls->stats->g_objects--;
+	Lck_Unlock(&ls->mtx);
 }
 
 void v_matchproto_(objtouch_f)
 LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -133,8 +302,14 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 	if (oc->flags & OC_F_PRIVATE || isnan(oc->last_lru))
 		return;
 
+	lru = lru_get(oc);
+	/* The miss which fetched the object was counted by LRU_Admit() */
+	if (lru->sketch != NULL &&
+	    __atomic_load_n(&oc->hits, __ATOMIC_RELAXED) > 0)
+		lru_sketch_add(lru->sketch, oc);
+
 	/*
-	 * To avoid the exphdl->mtx becoming a hotspot, we only
+	 * To avoid the LRU lock becoming a hotspot, we only
 	 * attempt to move objects if they have not been moved
 	 * recently and if the lock is available.  This optimization
 	 * obviously leaves the LRU list imperfectly sorted.
@@ -143,19 +318,121 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 	if (now - oc->last_lru < cache_param->lru_interval)
 		return;
 
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	if (lru->clock) {
+		/* Only write if needed, to keep the cache line clean */
+		if (!oc->lru_ref)
+			oc->lru_ref = 1;
+		return;
+	}
 
-	if (Lck_Trylock(&lru->mtx))
+	ls = lru_shard(lru, oc);
+
+	if (Lck_Trylock(&ls->mtx)) {
+		ls->stats->c_busy++;	// racy, but only statistics
 		return;
+	}
 
 	if (!isnan(oc->last_lru)) {
-		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+		VTAILQ_REMOVE(&ls->lru_head, oc, lru_list);
+		VTAILQ_INSERT_TAIL(&ls->lru_head, oc, lru_list);
 		VSC_C_main->n_lru_moved++;
+		ls->stats->c_moved++;
 		oc->last_lru = now;
 	}
-	Lck_Unlock(&lru->mtx);
+	Lck_Unlock(&ls->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Find the shard to nuke from first.  The shards simply take turns, so
+ * a nuke only ever holds the lock of the shard it is working on.  With
+ * objects spread evenly over the shards, this evicts in roughly global
+ * LRU order.
+ */
+
+static unsigned
+lru_next(struct lru *lru)
+{
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	if (lru->nshard == 1)
+		return (0);
+	return (__atomic_fetch_add(&lru->nuke_next, 1, __ATOMIC_RELAXED) %
+	    lru->nshard);
+}
+
+/*--------------------------------------------------------------------
+ * Find the first currently unused object on one LRU shard.
+ */
+
+static struct objcore *
+lru_nuke_shard(struct worker *wrk, struct lru_shard *ls)
+{
+	struct objcore *oc, *oc2;
+
+	Lck_Lock(&ls->mtx);
+	VTAILQ_FOREACH_SAFE(oc, &ls->lru_head, lru_list, oc2) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		AZ(isnan(oc->last_lru));
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		if (HSH_Snipe(wrk, oc)) {
+			VSC_C_main->n_lru_nuked++;
+			ls->stats->c_nuked++;
+			VTAILQ_REMOVE(&ls->lru_head, oc, lru_list);
+			VTAILQ_INSERT_TAIL(&ls->lru_head, oc, lru_list);
+			break;
+		}
+	}
+	if (oc == NULL && ls->n_oc > 0)
+		ls->stats->c_fail++;
+	Lck_Unlock(&ls->mtx);
+	return (oc);
+}
+
+/*--------------------------------------------------------------------
+ * Advance the clock hand over one LRU shard until an unreferenced and
+ * unused object is found.  Each object is visited at most twice, so we
+ * give up once everything has been spared or found busy.
+ */
+
+static struct objcore *
+lru_clock_shard(struct worker *wrk, struct lru_shard *ls)
+{
+	struct objcore *oc = NULL;
+	unsigned n;
+
+	Lck_Lock(&ls->mtx);
+	for (n = 2 * ls->n_oc; n > 0; n--) {
+		oc = VTAILQ_FIRST(&ls->lru_head);
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		AZ(isnan(oc->last_lru));
+		VTAILQ_REMOVE(&ls->lru_head, oc, lru_list);
+		VTAILQ_INSERT_TAIL(&ls->lru_head, oc, lru_list);
+
+		if (oc->lru_ref) {
+			oc->lru_ref = 0;
+			ls->stats->c_spared++;
+			continue;
+		}
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		if (HSH_Snipe(wrk, oc)) {
+			VSC_C_main->n_lru_nuked++;
+			ls->stats->c_nuked++;
+			break;
+		}
+	}
+	if (n == 0) {
+		oc = NULL;
+		if (ls->n_oc > 0)
+			ls->stats->c_fail++;
+	}
+	Lck_Unlock(&ls->mtx);
+	return (oc);
 }
 
 /*--------------------------------------------------------------------
@@ -167,7 +444,9 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 int
 LRU_NukeOne(struct worker *wrk, struct lru *lru)
 {
-	struct objcore *oc, *oc2;
+	struct lru_shard *ls;
+	struct objcore *oc = NULL;
+	unsigned u, n;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
@@ -178,29 +457,23 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 		return (0);
 	}
 
-	/* Find the first currently unused object on the LRU.  */
-	Lck_Lock(&lru->mtx);
-	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		AZ(isnan(oc->last_lru));
-
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
-		    oc, oc->flags, oc->refcnt);
-
-		if (HSH_Snipe(wrk, oc)) {
-			VSC_C_main->n_lru_nuked++; // XXX per lru ?
-			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-			break;
-		}
+	n = lru_next(lru);
+	for (u = 0; oc == NULL && u < lru->nshard; u++) {
+		ls = &lru->shard[(n + u) % lru->nshard];
+		if (lru->clock)
+			oc = lru_clock_shard(wrk, ls);
+		else
+			oc = lru_nuke_shard(wrk, ls);
 	}
-	Lck_Unlock(&lru->mtx);
 
 	if (oc == NULL) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Fail");
 		return (0);
 	}
 
+	if (lru->sketch != NULL)
+		lru->t_nuke = W_TIM_real(wrk);	// racy, only a hint
+
 	/* XXX: We could grab and return one storage segment to our caller */
 	ObjSlim(wrk, oc);
 
@@ -208,3 +481,66 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 	(void)HSH_DerefObjCore(wrk, &oc, 0);	// Ref from HSH_Snipe
 	return (1);
 }
+
+/*--------------------------------------------------------------------
+ * Admission filter: Count the lookup of a new object and, if we
+ * recently had to nuke, decide if it is popular enough to displace
+ * the objects we would nuke to make room for its len bytes.  Their
+ * frequencies add up, so a large object has to be more popular than a
+ * small one to get in.  If the length is not known, the new object
+ * only has to beat the next victim.
+ * Returns: 1: admit, 0: reject;
+ */
+
+#define LRU_ADMIT_VICTIMS	8
+
+int
+LRU_Admit(struct worker *wrk, struct lru *lru, const struct objcore *oc,
+    ssize_t len)
+{
+	struct lru_shard *ls;
+	struct objcore *victim;
+	unsigned freq, vfreq = 0, nvictim = 0, nscan = 0;
+	ssize_t vlen = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	if (lru->sketch == NULL || oc->objhead == NULL)
+		return (1);
+
+	lru_sketch_add(lru->sketch, oc);
+
+	if (W_TIM_real(wrk) - lru->t_nuke > cache_param->lru_interval)
+		return (1);
+
+	freq = lru_sketch_get(lru->sketch, oc);
+
+	/* The shard the next nuke will start on */
+	ls = &lru->shard[__atomic_load_n(&lru->nuke_next, __ATOMIC_RELAXED) %
+	    lru->nshard];
+	Lck_Lock(&ls->mtx);
+	VTAILQ_FOREACH(victim, &ls->lru_head, lru_list) {
+		if (nvictim == LRU_ADMIT_VICTIMS ||
+		    nscan++ == 2 * LRU_ADMIT_VICTIMS)
+			break;
+		if (nvictim > 0 && vlen >= len)
+			break;
+		/* The clock hand would spare a referenced object */
+		if (lru->clock && victim->lru_ref)
+			continue;
+		vfreq += lru_sketch_get(lru->sketch, victim);
+		vlen += (ssize_t)1 << vmin_t(uint8_t, victim->lru_size, 62);
+		nvictim++;
+	}
+	Lck_Unlock(&ls->mtx);
+
+	if (nvictim == 0 || freq > vfreq)
+		return (1);
+
+	VSLb(wrk->vsl, SLT_ExpKill, "LRU_Reject freq=%u victims=%u vfreq=%u",
+	    freq, nvictim, vfreq);
+	wrk->stats->n_lru_rejected++;
+	return (0);
+}
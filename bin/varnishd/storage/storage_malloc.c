@@ -210,7 +210,7 @@ sma_open(struct stevedore *st)
 	struct sma_sc *sma_sc;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st->ident);
 	if (lck_sma == NULL)
 		lck_sma = Lck_CreateClass(NULL, "sma");
 	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
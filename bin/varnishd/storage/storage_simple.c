@@ -598,7 +598,8 @@ sml_bocdone(struct worker *wrk, struct objcore *oc, struct boc *boc)
 	if (stv->lru != NULL) {
 		if (isnan(wrk->lastused))
 			wrk->lastused = VTIM_real();
-		LRU_Add(oc, wrk->lastused);	// approx timestamp is OK
+		LRU_Add(oc, wrk->lastused,	// approx timestamp is OK
+		    ObjGetLen(wrk, oc));
 	}
 }
 
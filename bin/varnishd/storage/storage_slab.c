@@ -0,0 +1,669 @@
+/*-
+ * Copyright (c) 2024 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Storage method based on size classed slabs
+ *
+ * The storage is one arena, reserved up front, which is carved into
+ * pages of SMS_PAGE bytes.  A page in use belongs to a single size class
+ * and is split into chunks of that size.  Free chunks are cached in
+ * stripes, and a thread uses the stripe of its thread pool, so the fetch
+ * path normally only takes an uncontended stripe lock.  The class lock
+ * is taken to refill or flush half a stripe cache at a time, and the
+ * stevedore lock only to hand out and take back whole pages.
+ *
+ * Allocations larger than the biggest size class are malloc'ed, but
+ * they count against the size of the arena.
+ *
+ * Lock order: stripe, class, stevedore.
+ */
+
+#include "config.h"
+
+#include <sys/mman.h>
+
+#include "cache/cache_varnishd.h"
+#include "common/heritage.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "storage/storage.h"
+#include "storage/storage_simple.h"
+
+#include "vnum.h"
+
+#include "VSC_slab.h"
+#include "VSC_slabclass.h"
+
+#ifndef MAP_NORESERVE
+#  define MAP_NORESERVE 0
+#endif
+
+#define SMS_PAGE	(1U << 20)
+#define SMS_MINCLASS	64
+#define SMS_MAXCLASS	(SMS_PAGE / 4)
+#define SMS_NCLASS	49		/* Four per power of two */
+#define SMS_NOCLASS	UINT_MAX
+#define SMS_CACHE	(64 * 1024)	/* Stripe cache per class, bytes */
+#define SMS_SUMM	64		/* Stripe operations per stats summ */
+
+struct sms_page {
+	unsigned		class;
+	unsigned		nfree;
+	unsigned		next;
+	void			*freelist;
+	VTAILQ_ENTRY(sms_page)	list;
+};
+
+struct sms_class {
+	unsigned		magic;
+#define SMS_CLASS_MAGIC		0x3e0c7a19
+	struct lock		mtx;
+	size_t			size;
+	unsigned		nchunk;
+	unsigned		ncache;
+	VTAILQ_HEAD(,sms_page)	partial;
+	struct VSC_slabclass	*stats;
+	struct vsc_seg		*vsc_seg;
+};
+
+struct sms_cache {
+	unsigned		n;
+	void			**chunk;
+};
+
+struct sms_stripe {
+	unsigned		magic;
+#define SMS_STRIPE_MAGIC	0x5a61c0d4
+	struct lock		mtx;
+	unsigned		nop;
+	struct VSC_slab_stripe	stats[1];
+	struct sms_cache	cache[SMS_NCLASS];
+};
+
+struct sms_sc {
+	unsigned		magic;
+#define SMS_SC_MAGIC		0x7d2b90e6
+	struct lock		mtx;
+	const char		*ident;
+	size_t			max;
+	size_t			huge;
+	uint8_t			*base;
+	unsigned		npage;
+	unsigned		nused;
+	struct sms_page		*page;
+	VTAILQ_HEAD(,sms_page)	free_pages;
+	unsigned		hdrclass;
+	unsigned		nstripe;
+	struct sms_stripe	*stripe;
+	struct sms_class	class[SMS_NCLASS];
+	struct VSC_slab		*stats;
+};
+
+struct sms {
+	unsigned		magic;
+#define SMS_MAGIC		0x2f96a4b3
+	struct storage		s;
+	size_t			sz;
+	struct sms_sc		*sc;
+};
+
+static struct VSC_lck *lck_sms;
+
+/*--------------------------------------------------------------------
+ * Size classes go 64, 80, 96, 112, 128, 160, ... SMS_MAXCLASS
+ */
+
+static size_t
+sms_classsize(unsigned c)
+{
+	unsigned k;
+
+	assert(c < SMS_NCLASS);
+	if (c == 0)
+		return (SMS_MINCLASS);
+	k = (c - 1) / 4;
+	return (((size_t)SMS_MINCLASS << k) +
+	    ((c - 1) % 4 + 1) * ((size_t)SMS_MINCLASS << k) / 4);
+}
+
+static unsigned
+sms_classidx(size_t size)
+{
+	unsigned b, c;
+	size_t step;
+
+	assert(size <= SMS_MAXCLASS);
+	if (size <= SMS_MINCLASS)
+		return (0);
+	for (b = 6; size > ((size_t)2 << b); b++)
+		continue;
+	step = (size_t)1 << (b - 2);
+	c = (b - 6) * 4 + (unsigned)((size - ((size_t)1 << b) + step - 1) / step);
+	assert(c < SMS_NCLASS);
+	assert(sms_classsize(c) >= size);
+	assert(c == 0 || sms_classsize(c - 1) < size);
+	return (c);
+}
+
+/*--------------------------------------------------------------------
+ * Whole pages, under the stevedore lock
+ */
+
+static uint8_t *
+sms_pageaddr(const struct sms_sc *sc, const struct sms_page *pg)
+{
+
+	return (sc->base + (size_t)(pg - sc->page) * SMS_PAGE);
+}
+
+static struct sms_page *
+sms_chunkpage(const struct sms_sc *sc, const void *p)
+{
+	size_t u;
+
+	assert((const uint8_t *)p >= sc->base);
+	u = (size_t)((const uint8_t *)p - sc->base) / SMS_PAGE;
+	assert(u < sc->npage);
+	return (&sc->page[u]);
+}
+
+static struct sms_page *
+sms_newpage(struct sms_sc *sc, unsigned c)
+{
+	struct sms_page *pg;
+
+	Lck_Lock(&sc->mtx);
+	pg = VTAILQ_FIRST(&sc->free_pages);
+	if (pg != NULL &&
+	    (size_t)(sc->nused + 1) * SMS_PAGE + sc->huge <= sc->max) {
+		VTAILQ_REMOVE(&sc->free_pages, pg, list);
+		sc->nused++;
+		sc->stats->g_pages++;
+		sc->stats->g_space -= SMS_PAGE;
+	} else {
+		pg = NULL;
+	}
+	Lck_Unlock(&sc->mtx);
+	if (pg == NULL)
+		return (NULL);
+	assert(pg->class == SMS_NOCLASS);
+	pg->class = c;
+	pg->nfree = sc->class[c].nchunk;
+	pg->next = 0;
+	pg->freelist = NULL;
+	return (pg);
+}
+
+static void
+sms_freepage(struct sms_sc *sc, struct sms_page *pg)
+{
+
+	pg->class = SMS_NOCLASS;
+	Lck_Lock(&sc->mtx);
+	VTAILQ_INSERT_HEAD(&sc->free_pages, pg, list);
+	AN(sc->nused);
+	sc->nused--;
+	sc->stats->g_pages--;
+	sc->stats->g_space += SMS_PAGE;
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Move chunks between a stripe cache and the class, under the class
+ * lock.  The stripe lock is held by the caller.
+ */
+
+static void
+sms_refill(struct sms_sc *sc, unsigned c, struct sms_cache *ch)
+{
+	struct sms_class *cl;
+	struct sms_page *pg;
+	unsigned want;
+	void *p;
+
+	cl = &sc->class[c];
+	CHECK_OBJ(cl, SMS_CLASS_MAGIC);
+	want = (cl->ncache + 1) / 2;
+	Lck_Lock(&cl->mtx);
+	if (cl->stats == NULL) {
+		cl->stats = VSC_slabclass_New(NULL, &cl->vsc_seg, "%s.%zu",
+		    sc->ident, cl->size);
+		AN(cl->stats);
+	}
+	cl->stats->c_refill++;
+	while (ch->n < want) {
+		pg = VTAILQ_FIRST(&cl->partial);
+		if (pg == NULL) {
+			pg = sms_newpage(sc, c);
+			if (pg == NULL)
+				break;
+			VTAILQ_INSERT_HEAD(&cl->partial, pg, list);
+			cl->stats->g_pages++;
+			cl->stats->g_free += cl->nchunk;
+		}
+		assert(pg->class == c);
+		if (pg->freelist != NULL) {
+			p = pg->freelist;
+			pg->freelist = *(void **)p;
+		} else {
+			assert(pg->next < cl->nchunk);
+			p = sms_pageaddr(sc, pg) + (size_t)pg->next++ * cl->size;
+		}
+		AN(pg->nfree);
+		if (--pg->nfree == 0)
+			VTAILQ_REMOVE(&cl->partial, pg, list);
+		cl->stats->g_free--;
+		cl->stats->g_used++;
+		ch->chunk[ch->n++] = p;
+	}
+	Lck_Unlock(&cl->mtx);
+}
+
+static void
+sms_flush(struct sms_sc *sc, unsigned c, struct sms_cache *ch, unsigned n)
+{
+	struct sms_class *cl;
+	struct sms_page *pg;
+	void *p;
+
+	cl = &sc->class[c];
+	CHECK_OBJ(cl, SMS_CLASS_MAGIC);
+	assert(n <= ch->n);
+	Lck_Lock(&cl->mtx);
+	AN(cl->stats);
+	cl->stats->c_flush++;
+	while (n-- > 0) {
+		p = ch->chunk[--ch->n];
+		pg = sms_chunkpage(sc, p);
+		assert(pg->class == c);
+		*(void **)p = pg->freelist;
+		pg->freelist = p;
+		if (pg->nfree++ == 0)
+			VTAILQ_INSERT_TAIL(&cl->partial, pg, list);
+		cl->stats->g_used--;
+		cl->stats->g_free++;
+		if (pg->nfree == cl->nchunk) {
+			VTAILQ_REMOVE(&cl->partial, pg, list);
+			cl->stats->g_pages--;
+			cl->stats->g_free -= cl->nchunk;
+			sms_freepage(sc, pg);
+		}
+	}
+	Lck_Unlock(&cl->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Chunks from and to the stripe cache, under the stripe lock
+ */
+
+static void *
+sms_get(struct sms_sc *sc, struct sms_stripe *sp, unsigned c)
+{
+	struct sms_cache *ch;
+
+	ch = &sp->cache[c];
+	if (ch->n == 0)
+		sms_refill(sc, c, ch);
+	if (ch->n == 0)
+		return (NULL);
+	return (ch->chunk[--ch->n]);
+}
+
+static void
+sms_put(struct sms_sc *sc, struct sms_stripe *sp, void *p)
+{
+	struct sms_cache *ch;
+	unsigned c;
+
+	/* The page of a chunk in use cannot change class under us */
+	c = sms_chunkpage(sc, p)->class;
+	assert(c < SMS_NCLASS);
+	ch = &sp->cache[c];
+	if (ch->n == sc->class[c].ncache)
+		sms_flush(sc, c, ch, (ch->n + 1) / 2);
+	ch->chunk[ch->n++] = p;
+}
+
+static void
+sms_drain(struct sms_sc *sc, struct sms_stripe *sp)
+{
+	unsigned c;
+
+	for (c = 0; c < SMS_NCLASS; c++)
+		if (sp->cache[c].n > 0)
+			sms_flush(sc, c, &sp->cache[c], sp->cache[c].n);
+}
+
+/*
+ * Like the worker stats: try to summ right away, but only insist on it
+ * every SMS_SUMM operations.
+ */
+
+static void
+sms_summ(struct sms_sc *sc, struct sms_stripe *sp)
+{
+
+	if (++sp->nop < SMS_SUMM) {
+		if (Lck_Trylock(&sc->mtx))
+			return;
+	} else {
+		Lck_Lock(&sc->mtx);
+	}
+	sp->nop = 0;
+	VSC_slab_Summ_stripe(sc->stats, sp->stats);
+	Lck_Unlock(&sc->mtx);
+	memset(sp->stats, 0, sizeof sp->stats);
+}
+
+/*--------------------------------------------------------------------
+ * Huge allocations
+ */
+
+static void *
+sms_huge(struct sms_sc *sc, size_t size)
+{
+	void *p;
+	int ok;
+
+	/* Reserve the space, but do not malloc under the stevedore lock */
+	Lck_Lock(&sc->mtx);
+	ok = (size_t)sc->nused * SMS_PAGE + sc->huge + size <= sc->max;
+	if (ok)
+		sc->huge += size;
+	Lck_Unlock(&sc->mtx);
+	if (!ok)
+		return (NULL);
+	p = malloc(size);
+	Lck_Lock(&sc->mtx);
+	if (p == NULL) {
+		sc->huge -= size;
+	} else {
+		sc->stats->g_huge += size;
+		sc->stats->g_space -= size;
+	}
+	Lck_Unlock(&sc->mtx);
+	return (p);
+}
+
+static void
+sms_huge_free(struct sms_sc *sc, void *p, size_t size)
+{
+
+	free(p);
+	Lck_Lock(&sc->mtx);
+	assert(sc->huge >= size);
+	sc->huge -= size;
+	sc->stats->g_huge -= size;
+	sc->stats->g_space += size;
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct storage * v_matchproto_(sml_alloc_f)
+sms_alloc(const struct stevedore *st, size_t size)
+{
+	struct sms_sc *sc;
+	struct sms_stripe *sp;
+	struct sms *sms = NULL;
+	void *p = NULL;
+	unsigned c = SMS_NOCLASS, i;
+	size_t space = size;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMS_SC_MAGIC);
+	assert(size > 0);
+	if (size <= SMS_MAXCLASS) {
+		c = sms_classidx(size);
+		space = sc->class[c].size;
+	} else {
+		p = sms_huge(sc, size);
+	}
+
+	sp = &sc->stripe[STV_Shard(sc->nstripe)];
+	CHECK_OBJ_NOTNULL(sp, SMS_STRIPE_MAGIC);
+	Lck_Lock(&sp->mtx);
+	sp->stats->c_req++;
+	for (i = 0; sms == NULL && i < 2; i++) {
+		if (c == SMS_NOCLASS && p == NULL)
+			break;
+		/* Cached chunks of other classes may be keeping pages */
+		if (i > 0)
+			sms_drain(sc, sp);
+		sms = sms_get(sc, sp, sc->hdrclass);
+		if (sms == NULL || c == SMS_NOCLASS)
+			continue;
+		p = sms_get(sc, sp, c);
+		if (p == NULL) {
+			sms_put(sc, sp, sms);
+			sms = NULL;
+		}
+	}
+	if (sms != NULL) {
+		sp->stats->c_bytes += space;
+		sp->stats->g_alloc++;
+		sp->stats->g_bytes += space;
+	} else {
+		sp->stats->c_fail++;
+	}
+	sms_summ(sc, sp);
+	Lck_Unlock(&sp->mtx);
+
+	if (sms == NULL) {
+		if (c == SMS_NOCLASS && p != NULL)
+			sms_huge_free(sc, p, size);
+		return (NULL);
+	}
+	AN(p);
+	INIT_OBJ(sms, SMS_MAGIC);
+	sms->sc = sc;
+	sms->sz = space;
+	sms->s.magic = STORAGE_MAGIC;
+	sms->s.priv = sms;
+	sms->s.ptr = p;
+	sms->s.len = 0;
+	sms->s.space = space;
+	return (&sms->s);
+}
+
+static void v_matchproto_(sml_free_f)
+sms_free(struct storage *s)
+{
+	struct sms_sc *sc;
+	struct sms_stripe *sp;
+	struct sms *sms;
+	void *p;
+	size_t sz;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sms, s->priv, SMS_MAGIC);
+	sc = sms->sc;
+	CHECK_OBJ_NOTNULL(sc, SMS_SC_MAGIC);
+	assert(sms->sz == sms->s.space);
+	p = sms->s.ptr;
+	sz = sms->sz;
+	ZERO_OBJ(sms, sizeof *sms);
+
+	if (sz > SMS_MAXCLASS) {
+		sms_huge_free(sc, p, sz);
+		p = NULL;
+	}
+
+	sp = &sc->stripe[STV_Shard(sc->nstripe)];
+	CHECK_OBJ_NOTNULL(sp, SMS_STRIPE_MAGIC);
+	Lck_Lock(&sp->mtx);
+	if (p != NULL)
+		sms_put(sc, sp, p);
+	sms_put(sc, sp, sms);
+	sp->stats->c_freed += sz;
+	sp->stats->g_alloc--;
+	sp->stats->g_bytes -= sz;
+	sms_summ(sc, sp);
+	Lck_Unlock(&sp->mtx);
+}
+
+static VCL_BYTES v_matchproto_(stv_var_used_space)
+sms_used_space(const struct stevedore *st)
+{
+	struct sms_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMS_SC_MAGIC);
+	return ((size_t)sc->nused * SMS_PAGE + sc->huge);
+}
+
+static VCL_BYTES v_matchproto_(stv_var_free_space)
+sms_free_space(const struct stevedore *st)
+{
+	struct sms_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMS_SC_MAGIC);
+	return (sc->max - ((size_t)sc->nused * SMS_PAGE + sc->huge));
+}
+
+static void v_matchproto_(storage_init_f)
+sms_init(struct stevedore *parent, int ac, char * const *av)
+{
+	const char *e;
+	char *p;
+	uintmax_t u;
+	unsigned long ul;
+	struct sms_sc *sc;
+
+	ALLOC_OBJ(sc, SMS_SC_MAGIC);
+	AN(sc);
+	sc->nstripe = 8;
+	parent->priv = sc;
+
+	AZ(av[ac]);
+	if (ac > 2)
+		ARGV_ERR("(-s%s) too many arguments\n", parent->name);
+
+	if (ac == 0 || *av[0] == '\0')
+		ARGV_ERR("(-s%s) size is required\n", parent->name);
+
+	e = VNUM_2bytes(av[0], &u, 0);
+	if (e != NULL)
+		ARGV_ERR("(-s%s) size \"%s\": %s\n", parent->name, av[0], e);
+	if ((u != (uintmax_t)(size_t)u) || u / SMS_PAGE > UINT_MAX)
+		ARGV_ERR("(-s%s) size \"%s\": too big\n", parent->name, av[0]);
+	if (u < 4 * SMS_PAGE)
+		ARGV_ERR("(-s%s) size \"%s\": too small, "
+		    "did you forget to specify M or G?\n", parent->name,
+		    av[0]);
+	sc->npage = (unsigned)(u / SMS_PAGE);
+	sc->max = (size_t)sc->npage * SMS_PAGE;
+
+	if (ac > 1 && *av[1] != '\0') {
+		ul = strtoul(av[1], &p, 0);
+		if (*p != '\0' || ul < 1 || ul > 64)
+			ARGV_ERR("(-s%s) stripes \"%s\": must be 1 to 64\n",
+			    parent->name, av[1]);
+		sc->nstripe = (unsigned)ul;
+	}
+}
+
+static void v_matchproto_(storage_open_f)
+sms_open(struct stevedore *st)
+{
+	struct sms_sc *sc;
+	struct sms_class *cl;
+	struct sms_stripe *sp;
+	unsigned u, c;
+
+	ASSERT_CLI();
+	st->lru = LRU_Alloc(st->ident);
+	if (lck_sms == NULL)
+		lck_sms = Lck_CreateClass(NULL, "sms");
+	CAST_OBJ_NOTNULL(sc, st->priv, SMS_SC_MAGIC);
+	Lck_New(&sc->mtx, lck_sms);
+	sc->ident = st->ident;
+
+	/* Reserve the arena, pages only get backed when they are used */
+	sc->base = mmap(NULL, sc->max, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+	if (sc->base == MAP_FAILED)
+		ARGV_ERR("(-s%s) cannot reserve %zu bytes: %s\n",
+		    st->name, sc->max, VAS_errtxt(errno));
+
+	sc->page = calloc(sc->npage, sizeof *sc->page);
+	AN(sc->page);
+	VTAILQ_INIT(&sc->free_pages);
+	for (u = sc->npage; u > 0; u--) {
+		sc->page[u - 1].class = SMS_NOCLASS;
+		VTAILQ_INSERT_HEAD(&sc->free_pages, &sc->page[u - 1], list);
+	}
+
+	for (c = 0; c < SMS_NCLASS; c++) {
+		cl = &sc->class[c];
+		INIT_OBJ(cl, SMS_CLASS_MAGIC);
+		Lck_New(&cl->mtx, lck_sms);
+		cl->size = sms_classsize(c);
+		assert(cl->size % 16 == 0);
+		cl->nchunk = SMS_PAGE / cl->size;
+		cl->ncache = SMS_CACHE / cl->size;
+		if (cl->ncache < 2)
+			cl->ncache = 2;
+		VTAILQ_INIT(&cl->partial);
+	}
+	assert(sc->class[SMS_NCLASS - 1].size == SMS_MAXCLASS);
+	sc->hdrclass = sms_classidx(sizeof(struct sms));
+
+	sc->stripe = calloc(sc->nstripe, sizeof *sc->stripe);
+	AN(sc->stripe);
+	for (u = 0; u < sc->nstripe; u++) {
+		sp = &sc->stripe[u];
+		INIT_OBJ(sp, SMS_STRIPE_MAGIC);
+		Lck_New(&sp->mtx, lck_sms);
+		for (c = 0; c < SMS_NCLASS; c++) {
+			sp->cache[c].chunk = calloc(sc->class[c].ncache,
+			    sizeof *sp->cache[c].chunk);
+			AN(sp->cache[c].chunk);
+		}
+	}
+
+	sc->stats = VSC_slab_New(NULL, NULL, st->ident);
+	AN(sc->stats);
+	sc->stats->g_space = sc->max;
+}
+
+const struct stevedore sms_stevedore = {
+	.magic		=	STEVEDORE_MAGIC,
+	.name		=	"slab",
+	.init		=	sms_init,
+	.open		=	sms_open,
+	.sml_alloc	=	sms_alloc,
+	.sml_free	=	sms_free,
+	.allocobj	=	SML_allocobj,
+	.panic		=	SML_panic,
+	.methods	=	&SML_methods,
+	.var_free_space =	sms_free_space,
+	.var_used_space =	sms_used_space,
+	.allocbuf	=	SML_AllocBuf,
+	.freebuf	=	SML_FreeBuf,
+};
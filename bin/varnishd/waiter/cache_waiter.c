@@ -36,93 +36,190 @@
 
 #include <stdlib.h>
 
-#include "vbh.h"
-
 #include "waiter/waiter.h"
 #include "waiter/waiter_priv.h"
 #include "waiter/mgt_waiter.h"
+#include "vtim.h"
 
-static int v_matchproto_(vbh_cmp_t)
-waited_cmp(void *priv, const void *a, const void *b)
-{
-	const struct waiter *ww;
-	const struct waited *aa, *bb;
+/*
+ * Timeouts are kept on a coarse timing wheel.  Most waits end with an
+ * event long before their timeout, so inserting and removing must be
+ * cheap, and both are O(1) list operations here.
+ *
+ * Slot N holds the waits timing out during tick N, modulo the number
+ * of slots, and a slot is only looked at once its tick has passed, so
+ * timeouts fire up to one tick late.  Waits beyond the end of the wheel
+ * go to its last slot and are moved on when that slot comes up.
+ */
+
+#define WAIT_WHEEL_HZ		32
+#define WAIT_WHEEL_SLOTS	1024
+
+VTAILQ_HEAD(waitedhead, waited);
 
-	CAST_OBJ_NOTNULL(ww, priv, WAITER_MAGIC);
-	CAST_OBJ_NOTNULL(aa, a, WAITED_MAGIC);
-	CAST_OBJ_NOTNULL(bb, b, WAITED_MAGIC);
+struct wait_wheel {
+	unsigned		magic;
+#define WAIT_WHEEL_MAGIC	0x4bd5ac01
+	unsigned		n;
+	uint64_t		tick;
+	struct waitedhead	slot[WAIT_WHEEL_SLOTS];
+};
 
-	return (Wait_When(aa) < Wait_When(bb));
+static inline uint64_t
+wait_tick(double t)
+{
+
+	return ((uint64_t)(t * WAIT_WHEEL_HZ));
 }
 
-static void v_matchproto_(vbh_update_t)
-waited_update(void *priv, void *p, unsigned u)
+static void
+wait_file(struct wait_wheel *ww, struct waited *wp)
 {
-	struct waited *pp;
+	uint64_t t;
+	unsigned u;
+
+	t = wait_tick(Wait_When(wp));
+	if (t < ww->tick)
+		t = ww->tick;
+	else if (t >= ww->tick + WAIT_WHEEL_SLOTS)
+		t = ww->tick + WAIT_WHEEL_SLOTS - 1;
+	u = t % WAIT_WHEEL_SLOTS;
+	VTAILQ_INSERT_TAIL(&ww->slot[u], wp, list);
+	wp->idx = u + 1;
+}
+
+/*
+ * Refile everything relative to the current tick, for when the clock
+ * jumped further than the wheel reaches.
+ */
 
-	(void)priv;
-	CAST_OBJ_NOTNULL(pp, p, WAITED_MAGIC);
-	pp->idx = u;
+static void
+wait_refile(struct wait_wheel *ww, uint64_t t)
+{
+	struct waitedhead all;
+	struct waited *wp;
+	unsigned u;
+
+	VTAILQ_INIT(&all);
+	for (u = 0; u < WAIT_WHEEL_SLOTS; u++)
+		VTAILQ_CONCAT(&all, &ww->slot[u], list);
+	ww->tick = t;
+	while ((wp = VTAILQ_FIRST(&all)) != NULL) {
+		VTAILQ_REMOVE(&all, wp, list);
+		wait_file(ww, wp);
+	}
 }
 
-/**********************************************************************/
+struct wait_wheel *
+Wait_WheelNew(void)
+{
+	struct wait_wheel *ww;
+	unsigned u;
+
+	ALLOC_OBJ(ww, WAIT_WHEEL_MAGIC);
+	AN(ww);
+	for (u = 0; u < WAIT_WHEEL_SLOTS; u++)
+		VTAILQ_INIT(&ww->slot[u]);
+	ww->tick = wait_tick(VTIM_real());
+	return (ww);
+}
 
 void
-Wait_Call(const struct waiter *w, struct waited *wp,
-    enum wait_event ev, double now)
+Wait_WheelDestroy(struct wait_wheel **wwp)
 {
-	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
-	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
-	AN(wp->func);
-	assert(wp->idx == VBH_NOIDX);
-	wp->func(wp, ev, now);
-}
+	struct wait_wheel *ww;
 
-/**********************************************************************/
+	TAKE_OBJ_NOTNULL(ww, wwp, WAIT_WHEEL_MAGIC);
+	AZ(ww->n);
+	FREE_OBJ(ww);
+}
 
 void
-Wait_HeapInsert(const struct waiter *w, struct waited *wp)
+Wait_WheelInsert(struct wait_wheel *ww, struct waited *wp)
 {
-	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	CHECK_OBJ_NOTNULL(ww, WAIT_WHEEL_MAGIC);
 	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
-	assert(wp->idx == VBH_NOIDX);
-	VBH_insert(w->heap, wp);
+	assert(wp->idx == WAIT_NOIDX);
+	wait_file(ww, wp);
+	ww->n++;
 }
 
-/*
- * XXX: wp is const because otherwise FlexeLint complains.  However, *wp
- * XXX: will actually change as a result of calling this function, via
- * XXX: the pointer stored in the bin-heap.  I can see how this const
- * XXX: could maybe confuse a compilers optimizer, but I do not expect
- * XXX: any harm to come from it.  Caveat Emptor.
- */
-
 int
-Wait_HeapDelete(const struct waiter *w, const struct waited *wp)
+Wait_WheelDelete(struct wait_wheel *ww, struct waited *wp)
 {
-	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	CHECK_OBJ_NOTNULL(ww, WAIT_WHEEL_MAGIC);
 	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
-	if (wp->idx == VBH_NOIDX)
+	if (wp->idx == WAIT_NOIDX)
 		return (0);
-	VBH_delete(w->heap, wp->idx);
+	assert(wp->idx <= WAIT_WHEEL_SLOTS);
+	VTAILQ_REMOVE(&ww->slot[wp->idx - 1], wp, list);
+	wp->idx = WAIT_NOIDX;
+	AN(ww->n);
+	ww->n--;
 	return (1);
 }
 
+/*
+ * Return a wait which timed out by now, or if there is none, some wait
+ * and the time when the next one might.  Returns zero and no wait if
+ * the wheel is empty.
+ */
+
 double
-Wait_HeapDue(const struct waiter *w, struct waited **wpp)
+Wait_WheelDue(struct wait_wheel *ww, struct waited **wpp, double now)
 {
+	struct waitedhead *head;
 	struct waited *wp;
-
-	wp = VBH_root(w->heap);
-	CHECK_OBJ_ORNULL(wp, WAITED_MAGIC);
-	if (wp == NULL) {
+	uint64_t t;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(ww, WAIT_WHEEL_MAGIC);
+	t = wait_tick(now);
+	if (ww->n == 0) {
+		if (t > ww->tick)
+			ww->tick = t;
 		if (wpp != NULL)
 			*wpp = NULL;
 		return (0);
 	}
+	if (t > ww->tick + WAIT_WHEEL_SLOTS)
+		wait_refile(ww, t - WAIT_WHEEL_SLOTS);
+	for (; ww->tick < t; ww->tick++) {
+		head = &ww->slot[ww->tick % WAIT_WHEEL_SLOTS];
+		while ((wp = VTAILQ_FIRST(head)) != NULL) {
+			CHECK_OBJ(wp, WAITED_MAGIC);
+			if (Wait_When(wp) <= now) {
+				if (wpp != NULL)
+					*wpp = wp;
+				return (Wait_When(wp));
+			}
+			/* Beyond the end of the wheel when filed */
+			VTAILQ_REMOVE(head, wp, list);
+			wait_file(ww, wp);
+		}
+	}
+	for (u = 0; u < WAIT_WHEEL_SLOTS; u++) {
+		head = &ww->slot[(ww->tick + u) % WAIT_WHEEL_SLOTS];
+		if (!VTAILQ_EMPTY(head))
+			break;
+	}
+	assert(u < WAIT_WHEEL_SLOTS);
 	if (wpp != NULL)
-		*wpp = wp;
-	return (Wait_When(wp));
+		*wpp = VTAILQ_FIRST(head);
+	return ((double)(ww->tick + u + 1) / WAIT_WHEEL_HZ);
+}
+
+/**********************************************************************/
+
+void
+Wait_Call(const struct waiter *w, struct waited *wp,
+    enum wait_event ev, double now)
+{
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	AN(wp->func);
+	assert(wp->idx == WAIT_NOIDX);
+	wp->func(wp, ev, now);
 }
 
 /**********************************************************************/
@@ -135,7 +232,7 @@ Wait_Enter(const struct waiter *w, struct waited *wp)
 	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
 	assert(wp->fd > 0);			// stdin never comes here
 	AN(wp->func);
-	wp->idx = VBH_NOIDX;
+	wp->idx = WAIT_NOIDX;
 	return (w->impl->enter(w->priv, wp));
 }
 
@@ -168,7 +265,7 @@ Waiter_New(void)
 	w->priv = (void*)(w + 1);
 	w->impl = waiter;
 	VTAILQ_INIT(&w->waithead);
-	w->heap = VBH_new(w, waited_cmp, waited_update);
+	w->wheel = Wait_WheelNew();
 
 	waiter->init(w);
 
@@ -182,8 +279,8 @@ Waiter_Destroy(struct waiter **wp)
 
 	TAKE_OBJ_NOTNULL(w, wp, WAITER_MAGIC);
 
-	AZ(VBH_root(w->heap));
 	AN(w->impl->fini);
 	w->impl->fini(w);
+	Wait_WheelDestroy(&w->wheel);
 	FREE_OBJ(w);
 }
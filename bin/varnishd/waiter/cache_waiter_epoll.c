@@ -37,6 +37,7 @@
 #if defined(HAVE_EPOLL_CTL)
 
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <sys/epoll.h>
 
@@ -95,7 +96,7 @@ vwe_thread(void *priv)
 			 * XXX: We could avoid many syscalls here if we were
 			 * XXX: allowed to just close the fd's on timeout.
 			 */
-			then = Wait_HeapDue(w, &wp);
+			then = Wait_WheelDue(w->wheel, &wp, now);
 			if (wp == NULL) {
 				vwe->next = now + 100;
 				break;
@@ -106,7 +107,7 @@ vwe_thread(void *priv)
 			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
 			AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_DEL, wp->fd, NULL));
 			vwe->nwaited--;
-			AN(Wait_HeapDelete(w, wp));
+			AN(Wait_WheelDelete(w->wheel, wp));
 			Lck_Unlock(&vwe->mtx);
 			Wait_Call(w, wp, WAITER_TIMEOUT, now);
 		}
@@ -130,7 +131,7 @@ vwe_thread(void *priv)
 			}
 			CAST_OBJ_NOTNULL(wp, ep->data.ptr, WAITED_MAGIC);
 			Lck_Lock(&vwe->mtx);
-			active = Wait_HeapDelete(w, wp);
+			active = Wait_WheelDelete(w->wheel, wp);
 			Lck_Unlock(&vwe->mtx);
 			if (!active) {
 				VSL(SLT_Debug, NO_VXID,
@@ -171,7 +172,7 @@ vwe_enter(void *priv, struct waited *wp)
 	ee.data.ptr = wp;
 	Lck_Lock(&vwe->mtx);
 	vwe->nwaited++;
-	Wait_HeapInsert(vwe->waiter, wp);
+	Wait_WheelInsert(vwe->waiter->wheel, wp);
 	AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, wp->fd, &ee));
 	/* If the epoll isn't due before our timeout, poke it via the pipe */
 	if (Wait_When(wp) < vwe->next)
@@ -225,6 +226,267 @@ vwe_fini(struct waiter *w)
 	Lck_Delete(&vwe->mtx);
 }
 
+/*--------------------------------------------------------------------
+ * The epoll_batch waiter
+ *
+ * The waiter runs several threads, each with its own epoll instance and
+ * timeout wheel, and a file descriptor always goes to the same thread.  Nothing
+ * is shared between them.
+ *
+ * File descriptors stay registered when they fire: they are added with
+ * EPOLLONESHOT, which disarms them when the event is reported, and the
+ * next vwb_enter() rearms them with EPOLL_CTL_MOD.  The kernel drops
+ * the registration when the fd is closed.  Only timeouts still need an
+ * EPOLL_CTL_DEL.
+ *
+ * vwb_enter() does not touch the wheel, which belongs to the thread.
+ * It puts the waited on an inbox and arms the fd under the thread's
+ * lock, and the thread moves the whole inbox onto the wheel in one go
+ * after every epoll_wait(), before it looks at the events.  The lock is
+ * only shared by the thread and the sessions it waits on, and the
+ * thread takes it twice per round instead of for every event.
+ */
+
+#define VWB_MAX		64
+
+struct vwb {
+	unsigned		magic;
+#define VWB_MAGIC		0x2c1f7e0b
+	int			epfd;
+	int			pipe[2];
+	struct waiter		*waiter;
+	struct wait_wheel	*wheel;
+	VTAILQ_HEAD(, waited)	inbox;
+	double			next;
+	unsigned		nwaited;
+	int			die;
+	pthread_t		thread;
+	struct lock		mtx;
+};
+
+struct vwbs {
+	unsigned		magic;
+#define VWBS_MAGIC		0x57c1a0e4
+	unsigned		n;
+	struct vwb		*vwb;
+};
+
+static void
+vwb_inbox(struct vwb *vwb)
+{
+	VTAILQ_HEAD(, waited) inbox;
+	struct waited *wp;
+
+	VTAILQ_INIT(&inbox);
+	Lck_Lock(&vwb->mtx);
+	VTAILQ_CONCAT(&inbox, &vwb->inbox, list);
+	Lck_Unlock(&vwb->mtx);
+	while ((wp = VTAILQ_FIRST(&inbox)) != NULL) {
+		CHECK_OBJ(wp, WAITED_MAGIC);
+		VTAILQ_REMOVE(&inbox, wp, list);
+		Wait_WheelInsert(vwb->wheel, wp);
+		vwb->nwaited++;
+	}
+}
+
+static void
+vwb_call(struct vwb *vwb, struct waited *wp, enum wait_event ev,
+    vtim_real now)
+{
+
+	AN(Wait_WheelDelete(vwb->wheel, wp));
+	vwb->nwaited--;
+	Wait_Call(vwb->waiter, wp, ev, now);
+}
+
+static void *
+vwb_thread(void *priv)
+{
+	struct epoll_event *ev, *ep;
+	struct waited *wp;
+	struct vwb *vwb;
+	double now, then;
+	int i, n, tmo;
+	char c[16];
+
+	CAST_OBJ_NOTNULL(vwb, priv, VWB_MAGIC);
+	THR_SetName("cache-epoll");
+	THR_Init();
+	ev = malloc(sizeof(struct epoll_event) * NEEV);
+	AN(ev);
+
+	now = VTIM_real();
+	while (1) {
+		vwb_inbox(vwb);
+		while (1) {
+			then = Wait_WheelDue(vwb->wheel, &wp, now);
+			if (wp == NULL) {
+				then = now + 100;
+				break;
+			} else if (then > now)
+				break;
+			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+			AZ(epoll_ctl(vwb->epfd, EPOLL_CTL_DEL, wp->fd, NULL));
+			vwb_call(vwb, wp, WAITER_TIMEOUT, now);
+		}
+		Lck_Lock(&vwb->mtx);
+		if (!VTAILQ_EMPTY(&vwb->inbox)) {
+			tmo = 0;
+		} else if (vwb->nwaited == 0 && vwb->die) {
+			Lck_Unlock(&vwb->mtx);
+			break;
+		} else {
+			vwb->next = then;
+			tmo = (int)ceil(1e3 * (then - now));
+		}
+		Lck_Unlock(&vwb->mtx);
+		assert(tmo >= 0);
+		do {
+			/* Due to a linux kernel bug, epoll_wait can
+			   return EINTR when the process is subjected to
+			   ptrace or waking from OS suspend. */
+			n = epoll_wait(vwb->epfd, ev, NEEV, tmo);
+		} while (n < 0 && errno == EINTR);
+		assert(n >= 0);
+		assert(n <= NEEV);
+		now = VTIM_real();
+		vwb_inbox(vwb);
+		for (ep = ev, i = 0; i < n; i++, ep++) {
+			if (ep->data.ptr == vwb) {
+				assert(read(vwb->pipe[0], c, sizeof c) > 0);
+				continue;
+			}
+			CAST_OBJ_NOTNULL(wp, ep->data.ptr, WAITED_MAGIC);
+			if (wp->idx == WAIT_NOIDX) {
+				VSL(SLT_Debug, NO_VXID,
+				    "epoll: spurious event (%d)", wp->fd);
+				continue;
+			}
+			if (ep->events & EPOLLIN)
+				vwb_call(vwb, wp, WAITER_ACTION, now);
+			else
+				vwb_call(vwb, wp, WAITER_REMCLOSE, now);
+		}
+		if (n > 0) {
+			(void)__atomic_add_fetch(&VSC_C_main->waiter_wakeup,
+			    1, __ATOMIC_RELAXED);
+			(void)__atomic_add_fetch(&VSC_C_main->waiter_event,
+			    n, __ATOMIC_RELAXED);
+		}
+	}
+	free(ev);
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int v_matchproto_(waiter_enter_f)
+vwb_enter(void *priv, struct waited *wp)
+{
+	struct vwbs *vwbs;
+	struct vwb *vwb;
+	struct epoll_event ee;
+
+	CAST_OBJ_NOTNULL(vwbs, priv, VWBS_MAGIC);
+	assert(wp->fd >= 0);
+	vwb = &vwbs->vwb[(unsigned)wp->fd % vwbs->n];
+	CHECK_OBJ(vwb, VWB_MAGIC);
+
+	ee.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	ee.data.ptr = wp;
+	Lck_Lock(&vwb->mtx);
+	VTAILQ_INSERT_TAIL(&vwb->inbox, wp, list);
+	if (epoll_ctl(vwb->epfd, EPOLL_CTL_MOD, wp->fd, &ee)) {
+		assert(errno == ENOENT);
+		AZ(epoll_ctl(vwb->epfd, EPOLL_CTL_ADD, wp->fd, &ee));
+	}
+	/* If the epoll isn't due before our timeout, poke it via the pipe */
+	if (Wait_When(wp) < vwb->next) {
+		vwb->next = Wait_When(wp);
+		assert(write(vwb->pipe[1], "X", 1) == 1);
+	}
+	Lck_Unlock(&vwb->mtx);
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void v_matchproto_(waiter_init_f)
+vwb_init(struct waiter *w)
+{
+	struct vwbs *vwbs;
+	struct vwb *vwb;
+	struct epoll_event ee;
+	unsigned u;
+	long ncpu;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	vwbs = w->priv;
+	INIT_OBJ(vwbs, VWBS_MAGIC);
+
+	vwbs->n = cache_param->waiter_threads;
+	if (vwbs->n == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		if (ncpu > 0)
+			vwbs->n = (unsigned)ncpu / cache_param->wthread_pools;
+	}
+	vwbs->n = vmax_t(unsigned, vwbs->n, 1);
+	vwbs->n = vmin_t(unsigned, vwbs->n, VWB_MAX);
+	vwbs->vwb = calloc(vwbs->n, sizeof *vwbs->vwb);
+	AN(vwbs->vwb);
+
+	for (u = 0; u < vwbs->n; u++) {
+		vwb = &vwbs->vwb[u];
+		INIT_OBJ(vwb, VWB_MAGIC);
+		vwb->waiter = w;
+		vwb->wheel = Wait_WheelNew();
+		VTAILQ_INIT(&vwb->inbox);
+		vwb->next = VTIM_real() + 100;
+		Lck_New(&vwb->mtx, lck_waiter);
+		vwb->epfd = epoll_create(1);
+		assert(vwb->epfd >= 0);
+		AZ(pipe(vwb->pipe));
+		ee.events = EPOLLIN;
+		ee.data.ptr = vwb;
+		AZ(epoll_ctl(vwb->epfd, EPOLL_CTL_ADD, vwb->pipe[0], &ee));
+		PTOK(pthread_create(&vwb->thread, NULL, vwb_thread, vwb));
+	}
+}
+
+/*--------------------------------------------------------------------
+ * It is the callers responsibility to trigger all fd's waited on to
+ * fail somehow.
+ */
+
+static void v_matchproto_(waiter_fini_f)
+vwb_fini(struct waiter *w)
+{
+	struct vwbs *vwbs;
+	struct vwb *vwb;
+	unsigned u;
+	void *vp;
+
+	CAST_OBJ_NOTNULL(vwbs, w->priv, VWBS_MAGIC);
+	for (u = 0; u < vwbs->n; u++) {
+		vwb = &vwbs->vwb[u];
+		CHECK_OBJ(vwb, VWB_MAGIC);
+		Lck_Lock(&vwb->mtx);
+		vwb->die = 1;
+		assert(write(vwb->pipe[1], "Y", 1) == 1);
+		Lck_Unlock(&vwb->mtx);
+	}
+	for (u = 0; u < vwbs->n; u++) {
+		vwb = &vwbs->vwb[u];
+		PTOK(pthread_join(vwb->thread, &vp));
+		Wait_WheelDestroy(&vwb->wheel);
+		closefd(&vwb->pipe[0]);
+		closefd(&vwb->pipe[1]);
+		closefd(&vwb->epfd);
+		Lck_Delete(&vwb->mtx);
+	}
+	free(vwbs->vwb);
+}
+
 /*--------------------------------------------------------------------*/
 
 #include "waiter/mgt_waiter.h"
@@ -237,4 +499,12 @@ const struct waiter_impl waiter_epoll = {
 	.size =		sizeof(struct vwe),
 };
 
+const struct waiter_impl waiter_epoll_batch = {
+	.name =		"epoll_batch",
+	.init =		vwb_init,
+	.fini =		vwb_fini,
+	.enter =	vwb_enter,
+	.size =		sizeof(struct vwbs),
+};
+
 #endif /* defined(HAVE_EPOLL_CTL) */
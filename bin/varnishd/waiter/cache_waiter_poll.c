@@ -109,7 +109,7 @@ vwp_add(struct vwp *vwp, struct waited *wp)
 	vwp->pollfd[vwp->hpoll].events = POLLIN;
 	vwp->idx[vwp->hpoll] = wp;
 	vwp->hpoll++;
-	Wait_HeapInsert(vwp->waiter, wp);
+	Wait_WheelInsert(vwp->waiter->wheel, wp);
 }
 
 static void
@@ -168,11 +168,12 @@ vwp_main(void *priv)
 	w = vwp->waiter;
 
 	while (1) {
-		then = Wait_HeapDue(w, &wp);
+		now = VTIM_real();
+		then = Wait_WheelDue(w->wheel, &wp, now);
 		if (wp == NULL)
 			t = -1;
 		else
-			t = (int)floor(1e3 * (then - VTIM_real()));
+			t = (int)floor(1e3 * (then - now));
 		assert(vwp->hpoll > 0);
 		AN(vwp->pollfd);
 		v = poll(vwp->pollfd, vwp->hpoll, t);
@@ -185,19 +186,19 @@ vwp_main(void *priv)
 			wp = vwp->idx[z];
 			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
 
-			if (v == 0 && Wait_HeapDue(w, NULL) > now)
+			if (v == 0 && Wait_WheelDue(w->wheel, NULL, now) > now)
 				break;
 			if (vwp->pollfd[z].revents)
 				v--;
 			then = Wait_When(wp);
 			if (then <= now) {
-				AN(Wait_HeapDelete(w, wp));
+				AN(Wait_WheelDelete(w->wheel, wp));
 				Wait_Call(w, wp, WAITER_TIMEOUT, now);
 				vwp_del(vwp, z);
 			} else if (vwp->pollfd[z].revents & POLLIN) {
 				assert(wp->fd > 0);
 				assert(wp->fd == vwp->pollfd[z].fd);
-				AN(Wait_HeapDelete(w, wp));
+				AN(Wait_WheelDelete(w->wheel, wp));
 				Wait_Call(w, wp, WAITER_ACTION, now);
 				vwp_del(vwp, z);
 			} else {
@@ -34,23 +34,23 @@
  * There are several options for the enter method to add an fd for the waiter
  * thread to look after:
  *
- * - share the binheap (requiring a mutex) - implemented for epoll and kqueues
+ * - share the wheel (requiring a mutex) - implemented for epoll and kqueues
  *
- * - send events to be entered through the events interface and keep the binheap
+ * - send events to be entered through the events interface and keep the wheel
  *   private to the waiter thread - implemented here.
  *
  * - some other message passing / mailbox
  *
  * It has not yet been determined which option is best. In the best case, by
- * sharing the binheap, we can save two port syscalls - but not always:
+ * sharing the wheel, we can save two port syscalls - but not always:
  *
  * - if the waited event has a timeout earlier than the first element on the
- *   binheap, we need to kick the waiter thread anyway
+ *   wheel, we need to kick the waiter thread anyway
  *
  * - if the waiter thread is busy, it will get the passed waited event together
  *   with other events
  *
- * on the other end we need to sync on the mtx to protect the binheap.  Solaris
+ * on the other end we need to sync on the mtx to protect the wheel.  Solaris
  * uses userland adaptive mutexes: if the thread holding the lock is running,
  * spinlock, otherwise syscall.
  *
@@ -115,7 +115,7 @@ vws_port_ev(struct vws *vws, struct waiter *w, port_event_t *ev, double now)
 		CAST_OBJ_NOTNULL(wp, ev->portev_user, WAITED_MAGIC);
 		assert(wp->fd >= 0);
 		vws->nwaited++;
-		Wait_HeapInsert(vws->waiter, wp);
+		Wait_WheelInsert(vws->waiter->wheel, wp);
 		vws_add(vws, wp->fd, wp);
 	} else {
 		assert(ev->portev_source == PORT_SOURCE_FD);
@@ -129,7 +129,7 @@ vws_port_ev(struct vws *vws, struct waiter *w, port_event_t *ev, double now)
 		 *          threadID=129476&tstart=0
 		 */
 		vws_del(vws, wp->fd);
-		AN(Wait_HeapDelete(w, wp));
+		AN(Wait_WheelDelete(w->wheel, wp));
 		Wait_Call(w, wp, ev->portev_events & POLLERR ?
 		    WAITER_REMCLOSE : WAITER_ACTION,
 		    now);
@@ -159,7 +159,7 @@ vws_thread(void *priv)
 
 	while (!vws->die) {
 		while (1) {
-			then = Wait_HeapDue(w, &wp);
+			then = Wait_WheelDue(w->wheel, &wp, now);
 			if (wp == NULL) {
 				vws->next = now + max_t;
 				break;
@@ -169,7 +169,7 @@ vws_thread(void *priv)
 			}
 			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
 			vws_del(vws, wp->fd);
-			AN(Wait_HeapDelete(w, wp));
+			AN(Wait_WheelDelete(w->wheel, wp));
 			Wait_Call(w, wp, WAITER_TIMEOUT, now);
 		}
 		then = vws->next - now;
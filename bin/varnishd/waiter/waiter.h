@@ -66,6 +66,7 @@ struct waited {
 	waiter_handle_f		*func;
 	vtim_dur		tmo;
 	vtim_real		idle;
+	VTAILQ_ENTRY(waited)	list;
 };
 
 /* cache_waiter.c */
@@ -32,7 +32,7 @@
  */
 
 struct waited;
-struct vbh;
+struct wait_wheel;
 
 struct waiter {
 	unsigned			magic;
@@ -42,7 +42,7 @@ struct waiter {
 	VTAILQ_HEAD(,waited)		waithead;
 
 	void				*priv;
-	struct vbh			*heap;
+	struct wait_wheel		*wheel;
 };
 
 typedef void waiter_init_f(struct waiter *);
@@ -69,6 +69,10 @@ Wait_When(const struct waited *wp)
 
 void Wait_Call(const struct waiter *, struct waited *,
     enum wait_event ev, double now);
-void Wait_HeapInsert(const struct waiter *, struct waited *);
-int Wait_HeapDelete(const struct waiter *, const struct waited *);
-double Wait_HeapDue(const struct waiter *, struct waited **);
+
+#define WAIT_NOIDX	0
+struct wait_wheel *Wait_WheelNew(void);
+void Wait_WheelDestroy(struct wait_wheel **);
+void Wait_WheelInsert(struct wait_wheel *, struct waited *);
+int Wait_WheelDelete(struct wait_wheel *, struct waited *);
+double Wait_WheelDue(struct wait_wheel *, struct waited **, double now);
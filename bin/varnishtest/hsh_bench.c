@@ -0,0 +1,218 @@
+/*-
+ * Copyright (c) 2024 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Hammer a single URL on a running varnishd from many threads, each
+ * sending its requests over its own connection, and report the rate.
+ * If the URL contains "%u", it is replaced by a number unique to every
+ * request instead, so all of them are inserts into the hash.
+ * The response must have a Content-Length header.
+ * Used to measure lookup contention on one hot object, for instance
+ * with the lookup_lockless parameter on and off, or to compare the
+ * -h hash implementations while the cache warms up.  For the latter,
+ * a VCL which does not need a backend helps:
+ *
+ *	sub vcl_backend_fetch { return (error); }
+ *	sub vcl_backend_error { set beresp.ttl = 1h; return (deliver); }
+ *
+ * Usage: hsh_bench address [threads [requests [url]]]
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "vsb.h"
+#include "vtcp.h"
+#include "vtim.h"
+
+static const char *addr;
+static unsigned nreq = 10000;
+static char url[256];
+static const char *url_tail;
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int go;
+
+/* Read one response, return its length or -1 on errors */
+
+static ssize_t
+rxresp(int fd, char *buf, size_t len)
+{
+	ssize_t i, l = 0, body = 0;
+	char *p, *q;
+
+	while (1) {
+		i = read(fd, buf + l, len - l - 1);
+		if (i <= 0)
+			return (-1);
+		l += i;
+		buf[l] = '\0';
+		p = strstr(buf, "\r\n\r\n");
+		if (p != NULL)
+			break;
+		if (l == len - 1)
+			return (-1);
+	}
+	p += 4;
+	q = strcasestr(buf, "\r\nContent-Length:");
+	if (q != NULL && q < p)
+		body = strtol(q + 17, NULL, 10);
+	l -= p - buf;
+	while (l < body) {
+		i = read(fd, buf, vmin_t(size_t, len, (size_t)(body - l)));
+		if (i <= 0)
+			return (-1);
+		l += i;
+	}
+	return (l == body ? body : -1);
+}
+
+static int
+bench_open(void)
+{
+	const char *err;
+	int fd;
+
+	fd = VTCP_open(addr, NULL, 10., &err);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot connect to %s: %s\n", addr, err);
+		exit(1);
+	}
+	VTCP_blocking(fd);
+	return (fd);
+}
+
+static void
+bench_req(int fd, unsigned n)
+{
+	char buf[16384], req[512];
+	size_t l;
+
+	if (url_tail != NULL)
+		bprintf(req, "GET %s%u%s HTTP/1.1\r\nHost: hsh_bench\r\n\r\n",
+		    url, n, url_tail);
+	else
+		bprintf(req, "GET %s HTTP/1.1\r\nHost: hsh_bench\r\n\r\n",
+		    url);
+	l = strlen(req);
+	errno = 0;
+	if (write(fd, req, l) != (ssize_t)l ||
+	    rxresp(fd, buf, sizeof buf) < 0) {
+		fprintf(stderr, "Request %u failed: %s\n", n,
+		    errno ? VAS_errtxt(errno) : "Bad response");
+		exit(1);
+	}
+}
+
+static void *
+bench_thread(void *priv)
+{
+	unsigned u, base;
+	int fd;
+
+	base = *(unsigned *)priv * nreq;
+	fd = bench_open();
+
+	PTOK(pthread_mutex_lock(&mtx));
+	while (!go)
+		PTOK(pthread_cond_wait(&cond, &mtx));
+	PTOK(pthread_mutex_unlock(&mtx));
+
+	for (u = 0; u < nreq; u++)
+		bench_req(fd, base + u);
+	closefd(&fd);
+	return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned u, *id, nthr = 64;
+	pthread_t *thr;
+	char *p;
+	vtim_mono t0, t1;
+	int fd;
+
+	if (argc < 2 || argc > 5) {
+		fprintf(stderr,
+		    "Usage: hsh_bench address [threads [requests [url]]]\n");
+		exit(2);
+	}
+	addr = argv[1];
+	if (argc > 2)
+		nthr = (unsigned)strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		nreq = (unsigned)strtoul(argv[3], NULL, 0);
+	bprintf(url, "%s", argc > 4 ? argv[4] : "/");
+	p = strstr(url, "%u");
+	if (p != NULL) {
+		*p = '\0';
+		url_tail = p + 2;
+	}
+	assert(nthr > 0);
+
+	if (url_tail == NULL) {
+		/* Get the object into the cache, so we only measure hits */
+		fd = bench_open();
+		bench_req(fd, 0);
+		closefd(&fd);
+	}
+
+	thr = calloc(nthr, sizeof *thr);
+	AN(thr);
+	id = calloc(nthr, sizeof *id);
+	AN(id);
+	for (u = 0; u < nthr; u++) {
+		id[u] = u;
+		PTOK(pthread_create(&thr[u], NULL, bench_thread, &id[u]));
+	}
+
+	/* Give all threads a chance to connect before we start the clock */
+	(void)usleep(100000);
+	t0 = VTIM_mono();
+	PTOK(pthread_mutex_lock(&mtx));
+	go = 1;
+	PTOK(pthread_cond_broadcast(&cond));
+	PTOK(pthread_mutex_unlock(&mtx));
+	for (u = 0; u < nthr; u++)
+		PTOK(pthread_join(thr[u], NULL));
+	t1 = VTIM_mono();
+
+	printf("%u threads x %u requests in %.3f s, %.0f req/s\n",
+	    nthr, nreq, t1 - t0, (double)nthr * nreq / (t1 - t0));
+	free(thr);
+	free(id);
+	return (0);
+}
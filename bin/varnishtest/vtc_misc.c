@@ -501,6 +501,8 @@ abstract_uds_works(void)
  *        recognized as a macro.
  * persistent_storage
  *        Varnish was built with the deprecated persistent storage.
+ * sendfile
+ *        Varnish was built with sendfile(2) support for delivery.
  * coverage
  *        Varnish was built with code coverage enabled.
  * asan
@@ -576,6 +578,12 @@ static const unsigned with_persistent_storage = 1;
 static const unsigned with_persistent_storage = 0;
 #endif
 
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+static const unsigned with_sendfile = 1;
+#else
+static const unsigned with_sendfile = 0;
+#endif
+
 void v_matchproto_(cmd_f)
 cmd_feature(CMD_ARGS)
 {
@@ -622,6 +630,7 @@ cmd_feature(CMD_ARGS)
 		FEATURE("user_vcache", getpwnam("vcache") != NULL);
 		FEATURE("group_varnish", getgrnam("varnish") != NULL);
 		FEATURE("persistent_storage", with_persistent_storage);
+		FEATURE("sendfile", with_sendfile);
 		FEATURE("coverage", coverage);
 		FEATURE("asan", asan);
 		FEATURE("msan", msan);
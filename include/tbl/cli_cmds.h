@@ -70,6 +70,19 @@ CLI_CMD(BAN_LIST,
 	0, 0
 )
 
+CLI_CMD(TAG_PURGE,
+	"tag.purge",
+	"tag.purge [-s] <tag>...",
+	"Purge all objects carrying any of the tags.",
+
+	"  The tags are taken from the response header named by the"
+	" ``tag_header`` parameter when objects are inserted.  With ``-s``,"
+	" the objects are soft purged, keeping their grace and keep"
+	" periods.  The number of objects purged is output.",
+
+	1, -1
+)
+
 CLI_CMD(VCL_LOAD,
 	"vcl.load",
 	"vcl.load <configname> <filename> [auto|cold|warm]",
@@ -45,6 +45,7 @@ LOCK(pipestat)
 LOCK(probe)
 LOCK(sess)
 LOCK(conn_pool)
+LOCK(tag)
 LOCK(vbe)
 LOCK(vcapace)
 LOCK(vcl)
@@ -236,6 +236,71 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	ban_lurker_index,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"16",
+	/* units */	"bans",
+	/* descr */
+	"When the ban lurker tests objects against at least this many "
+	"bans, it indexes the bans first: \"==\" tests are looked up "
+	"by value and \"~\" tests are combined into one regular "
+	"expression per field, so each object is tested in one pass.\n"
+	"Zero disables the index.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	ban_lurker_threads,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"threads",
+	/* descr */
+	"Number of threads testing objects against bans.\n"
+	"The ban lurker thread and its helpers share the objects of "
+	"each ban between them, so testing many bans keeps up on "
+	"larger caches.  Each thread has LURKER.<n> counters.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
+PARAM_SIMPLE(
+	/* name */	expiry_threads,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"threads",
+	/* descr */
+	"Number of expiry threads.\n"
+	"Objects are distributed over the expiry threads by a hash of "
+	"their address, and each thread has its own inbox, lock and "
+	"binary heap. Increase this if the expiry thread cannot keep "
+	"up, as indicated by the MAIN.exp_mailed counter growing faster "
+	"than MAIN.exp_received.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
+PARAM_SIMPLE(
+	/* name */	expiry_wheel,
+	/* type */	duration,
+	/* min */	"0",
+	/* max */	"60",
+	/* def */	"0",
+	/* units */	"seconds",
+	/* descr */
+	"Resolution of the hierarchical timing wheel used by the expiry "
+	"threads, or zero to use a binary heap.\n"
+	"A timing wheel makes inserting and moving objects constant time "
+	"operations, which helps with many millions of objects, but "
+	"objects only expire at the end of the time slot they fall into, "
+	"up to this long after their time is up.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	first_byte_timeout,
 	/* type */	timeout,
@@ -351,7 +416,7 @@ PARAM_SIMPLE(
 	/* type */	bytes_u,
 	/* min */	"128b",
 	/* max */	"99999999b",
-	/* def */	"64k",
+	/* def */	"96k",
 	/* units */	"bytes",
 	/* descr */
 	"Maximum size of CLI response.  If the response exceeds this "
@@ -423,13 +488,14 @@ PARAM_SIMPLE(
 PARAM_SIMPLE(
 	/* name */	critbit_cooloff,
 	/* type */	duration,
-	/* min */	"60.000",
+	/* min */	"1.000",
 	/* max */	"254.000",
 	/* def */	"180.000",
 	/* units */	"seconds",
 	/* descr */
-	"How long the critbit hasher keeps deleted objheads on the cooloff "
-	"list.",
+	"How often the critbit hasher frees deleted objheads, once no "
+	"lockless lookup can still see them.  The cleaner runs earlier "
+	"when many objheads were deleted.",
 	/* flags */	WIZARD
 )
 
@@ -529,6 +595,24 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	file_shards,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"shards",
+	/* descr */
+	"Number of shards each file stevedore is split into.\n"
+	"Each shard covers a part of the file and has its own lock and "
+	"free space tree. Threads allocate from the shard of their "
+	"thread pool first, and only try the others when that is full. "
+	"Increasing this reduces contention on the file stevedore lock, "
+	"but an allocation can not span shards, so it also makes the "
+	"largest possible allocation smaller.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	gzip_buffer,
 	/* type */	bytes_u,
@@ -705,6 +789,84 @@ PARAM_SIMPLE(
 	/* flags */	MUST_RESTART
 )
 
+#if defined(HAVE_SO_REUSEPORT)
+#  define PLATFORM_FLAGS EXPERIMENTAL | MUST_RESTART
+#else
+#  define PLATFORM_FLAGS NOT_IMPLEMENTED
+#endif
+PARAM_SIMPLE(
+	/* name */	listen_reuseport,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Open one listen socket per thread pool for each TCP listen "
+	"address, all bound with SO_REUSEPORT, so the kernel spreads new "
+	"connections over the thread pools instead of all pools "
+	"accepting from the same socket.\n"
+	"The sockets are opened when the child starts, for the number of "
+	"thread_pools at that time. Pools added later share sockets, and "
+	"the sockets of pools which are removed are taken over by the "
+	"remaining pools.",
+	/* flags */	PLATFORM_DEPENDENT | PLATFORM_FLAGS
+)
+#undef PLATFORM_FLAGS
+
+PARAM_SIMPLE(
+	/* name */	lookup_lockless,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Let cache lookups take a reference on the most recently hit "
+	"object of an objhead without holding the objhead mutex, as long "
+	"as it is still a fresh and unbanned hit for the request.\n"
+	"Only implemented for the critbit hash.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	lru_admission,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Enable the frequency based admission filter for stevedores "
+	"using LRU.\n"
+	"Lookups are counted in a compact sketch, and while the "
+	"stevedore had to nuke objects within the last lru_interval, "
+	"new objects are only stored if they were requested more often "
+	"than the objects which would be nuked to make room for them, "
+	"all together, so large objects need to be more popular than "
+	"small ones. Rejected objects are stored on Transient as "
+	"shortlived objects.\n"
+	"This can be overridden with beresp.force_admit in VCL.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
+PARAM_SIMPLE(
+	/* name */	lru_clock,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Use CLOCK (second chance) eviction instead of LRU.\n"
+	"Hits no longer move objects on the LRU list, they only mark "
+	"them as referenced, without taking any lock. When space needs "
+	"to be made, referenced objects are unmarked and spared once.\n"
+	"Objects are only marked if they have been on the list for "
+	"longer than lru_interval.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	lru_interval,
 	/* type */	duration,
@@ -721,6 +883,24 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	lru_shards,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"lists",
+	/* descr */
+	"Number of LRU lists per stevedore.\n"
+	"Objects are distributed over the lists by a hash of their "
+	"address, and each list has its own lock. When space needs to "
+	"be made, the lists take turns, so the eviction order is only "
+	"approximately global.\n"
+	"Increasing this reduces contention on the LRU locks on systems "
+	"with many cores.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	max_esi_depth,
 	/* type */	uint,
@@ -754,6 +934,25 @@ PARAM_SIMPLE(
 	"Upper limit on how many times a backend fetch can retry."
 )
 
+PARAM_SIMPLE(
+	/* name */	mempool_magazine,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	"16",
+	/* def */	"4",
+	/* units */	"items",
+	/* descr */
+	"How many free items of each memory pool (sessions, requests and "
+	"busyobjs) a worker thread keeps for itself.\n"
+	"A worker takes and returns items in batches of half this many "
+	"under the memory pool lock, and in between allocates and frees "
+	"without taking the lock.\n"
+	"Items held by workers count towards the pool_* minimum and "
+	"maximum sizes, but do not time out.\n"
+	"Zero disables the magazines.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	nuke_limit,
 	/* type */	uint,
@@ -887,6 +1086,28 @@ PARAM_SIMPLE(
 	/* flags */	DELAYED_EFFECT
 )
 
+PARAM_SIMPLE(
+	/* name */	sendfile_threshold,
+	/* type */	bytes,
+	/* min */	"0b",
+	/* max */	NULL,
+	/* def */	"0b",
+	/* units */	"bytes",
+	/* descr */
+	"The minimum size of a body segment which HTTP/1 delivery sends "
+	"with sendfile() straight from the file of a file backed "
+	"stevedore, instead of writev() from its memory mapping.\n"
+	"Only bytes which pass the delivery processors unchanged are "
+	"eligible, so gunzip, ESI and objects which are freed as they are "
+	"delivered fall back to writev().\n"
+	"A zero value disables sendfile().\n\n"
+	"The kernel references the file until the data has been "
+	"acknowledged, so delivery waits for the socket to drain before "
+	"it releases the object, within send_timeout.  Otherwise the "
+	"connection is reset.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	shortlived,
 	/* type */	duration,
@@ -928,6 +1149,23 @@ PARAM_SIMPLE(
 #else
 #  define PLATFORM_FLAGS NOT_IMPLEMENTED
 #endif
+PARAM_SIMPLE(
+	/* name */	tag_header,
+	/* type */	header,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"",
+	/* units */	NULL,
+	/* descr */
+	"Name of the response header holding the tags of an object, "
+	"separated by white space or commas.  Objects are indexed by "
+	"their tags when they are inserted into the cache, so they can "
+	"be purged by tag with the tag.purge CLI command or "
+	"purge.tags() in VCL.\n"
+	"An empty value disables the index.",
+	/* flags */	MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	tcp_fastopen,
 	/* type */	boolean,
@@ -1056,6 +1294,21 @@ PARAM_SIMPLE(
 	"transit buffer per backend request."
 )
 
+PARAM_SIMPLE(
+	/* name */	vary_index_min,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"8",
+	/* units */	"variants",
+	/* descr */
+	"How many objects a lookup needs to examine on one hash entry "
+	"before the entry gets an index of its objects by their Vary "
+	"header values, so later lookups only examine the matching "
+	"variants.\n"
+	"Zero disables the index for new hash entries."
+)
+
 PARAM_SIMPLE(
 	/* name */	vary_notice,
 	/* type */	uint,
@@ -1137,6 +1390,21 @@ PARAM_SIMPLE(
 	/* dyn_min_reason */	"vsl_reclen + 12 bytes"
 )
 
+PARAM_SIMPLE(
+	/* name */	vsl_packed,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Log Timestamp, Length and the accounting records in a compact "
+	"binary form, which the log readers render to the usual text.  "
+	"This saves CPU time formatting them, and space in the shared "
+	"memory log.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	vsl_reclen,
 	/* type */	vsl_reclen,
@@ -1151,6 +1419,24 @@ PARAM_SIMPLE(
 	/* dyn_max_reason */	"vsl_buffer - 12 bytes"
 )
 
+PARAM_SIMPLE(
+	/* name */	vsl_rings,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"rings",
+	/* descr */
+	"Number of rings the VSL space is split into.\n"
+	"Each thread pool writes to the ring numbered by the pool "
+	"modulo this, under its own lock, and log readers merge the "
+	"rings in order.  Setting this to thread_pools removes the "
+	"contention between pools for writing the log, counted in "
+	"MAIN.shm_cont.  The number is reduced so that each ring "
+	"segment holds at least vsl_buffer bytes.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	vsl_space,
 	/* type */	bytes,
@@ -1166,6 +1452,23 @@ PARAM_SIMPLE(
 	/* flags */	MUST_RESTART
 )
 
+PARAM_SIMPLE(
+	/* name */	waiter_threads,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	"64",
+	/* def */	"0",
+	/* units */	"threads",
+	/* descr */
+	"Number of threads in each thread pool's waiter, for waiters "
+	"which can run more than one (currently only epoll_batch).\n"
+	"File descriptors are distributed over the threads by number, "
+	"and each thread has its own epoll instance, heap and lock.\n"
+	"Zero means the number of CPUs divided by thread_pools, but at "
+	"least one.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	workspace_backend,
 	/* type */	bytes_u,
@@ -1477,6 +1780,59 @@ PARAM_THREAD(
 	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
 )
 
+PARAM_THREAD(
+	/* name */	thread_pool_numa,
+	/* field */	pool_numa,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Place thread pools on NUMA nodes.\n"
+	"\n"
+	"When enabled, pool N is assigned to NUMA node N modulo the "
+	"number of nodes with CPUs. The threads of the pool are bound "
+	"to the CPUs of that node and prefer its memory, so worker "
+	"workspaces and memory pool items are allocated locally. "
+	"With listen_reuseport, each pool's listen socket is also "
+	"marked with a CPU of its node, which recent Linux kernels use "
+	"to steer connections arriving on that CPU to the pool.\n"
+	"\n"
+	"Only applies to pools created after the change, a restart is "
+	"required to place all pools.",
+	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
+)
+
+PARAM_THREAD(
+	/* name */	thread_pool_latency,
+	/* field */	latency,
+	/* type */	duration,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"seconds",
+	/* descr */
+	"Target for the 99th percentile of the time tasks wait in a "
+	"thread pool queue.\n"
+	"\n"
+	"When set, each pool is sized to meet this target instead of "
+	"creating threads whenever something is queued: Once a second "
+	"the pool herder sets the number of threads to what was busy "
+	"at the peak, plus what is queued, plus enough idle threads to "
+	"take the arrivals while creating a new one. If the target was "
+	"missed, it grows further. If the latency was below half the "
+	"target, excess idle threads are destroyed every "
+	"thread_pool_destroy_delay, without waiting for "
+	"thread_pool_timeout. A queued task older than the target "
+	"makes the pool grow right away, and thread_pool_add_delay is "
+	"not applied.\n"
+	"\n"
+	"The number of threads stays within thread_pool_min and "
+	"thread_pool_max. Zero disables the controller.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_THREAD(
 	/* name */	thread_pool_max,
 	/* field */	max,
@@ -1673,6 +2029,28 @@ PARAM_THREAD(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_THREAD(
+	/* name */	thread_pool_steal,
+	/* field */	steal,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"requests",
+	/* descr */
+	"Queue length at which other thread pools steal work.\n"
+	"\n"
+	"When a pool has queued at least this many tasks, an idle "
+	"thread in another pool is woken up, and threads with nothing "
+	"queued in their own pool take tasks from the queue of such a "
+	"pool. Threads only steal tasks which their own pool would "
+	"run with its current number of idle threads, see "
+	"thread_pool_reserve.\n"
+	"\n"
+	"Zero disables work stealing.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_THREAD(
 	/* name */	thread_pool_stack,
 	/* field */	stacksize,
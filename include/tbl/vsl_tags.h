@@ -703,6 +703,23 @@ SLTM(VdpAcct, 0, "Deliver filter accounting",
 )
 
 
+SLTM(PoolHerder, 0, "Thread pool sizing decision",
+	"Logged by the pool herder when sizing a pool for the queue"
+	" latency target, see parameter thread_pool_latency.\n\n"
+	"The format is::\n\n"
+	"\t%u %s %u %u %u %u %f %f\n"
+	"\t|  |  |  |  |  |  |  |\n"
+	"\t|  |  |  |  |  |  |  +- Time to create a thread\n"
+	"\t|  |  |  |  |  |  +---- Queue latency 99th percentile\n"
+	"\t|  |  |  |  |  +------- Tasks queued\n"
+	"\t|  |  |  |  +---------- Peak busy threads\n"
+	"\t|  |  |  +------------- Threads wanted\n"
+	"\t|  |  +---------------- Threads\n"
+	"\t|  +------------------- \"grow\", \"hold\" or \"shrink\"\n"
+	"\t+---------------------- Pool number\n"
+	"\n"
+)
+
 #undef NOSUP_NOTICE
 #undef NODEF_NOTICE
 #undef SLTM
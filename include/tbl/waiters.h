@@ -42,6 +42,7 @@
 
 #if defined(HAVE_EPOLL_CTL)
   WAITER(epoll)
+  WAITER(epoll_batch)
 #endif
 
 WAITER(poll)
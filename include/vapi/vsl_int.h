@@ -68,6 +68,20 @@
  * Logrecords are NUL-terminated so that string functions can be run
  * directly on the shmlog data.
  *
+ * Except packed logrecords (ver == VSL_VERSION_PACKED): varnishd logs
+ * some numeric records in binary, and the cursors of libvarnishapi
+ * render them back to the text they stand for.  Their content starts
+ * with a VSL_PACK_* byte saying what follows:
+ *
+ *   VSL_PACK_UINT	varints, rendered as "%ju %ju ..."
+ *   VSL_PACK_TS	a NUL-terminated event and three times, each as
+ *			a varint of seconds and one of microseconds,
+ *			rendered as "%s: %ju.%06ju %ju.%06ju %ju.%06ju"
+ *
+ * Varints are little-endian, seven bits to a byte, with the high bit
+ * set on all but the last byte.  The rendered text of a packed record
+ * never exceeds VSL_UNPACKED_MAX bytes, NUL included.
+ *
  * Notice that the constants in these macros cannot be changed without
  * changing corresponding magic numbers in varnishd/cache/cache_shmlog.c
  */
@@ -84,6 +98,7 @@
 #define VSL_OVERHEAD		3
 #define VSL_VERSION_2		0x0
 #define VSL_VERSION_3		0x1
+#define VSL_VERSION_PACKED	0x2
 #define VSL_WORDS(len)		(((len) + 3) / 4)
 #define VSL_BYTES(words)	((words) * 4)
 #define VSL_END(ptr, len)	((ptr) + VSL_OVERHEAD + VSL_WORDS(len))
@@ -100,6 +115,10 @@
 #define VSL_BATCHLEN(ptr)	((ptr)[1])
 #define VSL_BATCHID(ptr)	(VSL_ID((ptr) + VSL_OVERHEAD))
 
+#define VSL_PACK_UINT		'u'
+#define VSL_PACK_TS		't'
+#define VSL_UNPACKED_MAX	256
+
 #define VSL_ENDMARKER	(((uint32_t)SLT__Reserved << 24) | 0x454545) /* "EEE" */
 #define VSL_WRAPMARKER	(((uint32_t)SLT__Reserved << 24) | 0x575757) /* "WWW" */
 
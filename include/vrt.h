@@ -60,6 +60,8 @@
  * NEXT (2024-09-15)
  *	struct vrt_backend.backend_wait_timeout added
  *	struct vrt_backend.backend_wait_limit  added
+ *	VRT_purge_tags() added
+ *	[cache.h] (struct objcore).tags added
  * 19.1 (2024-05-27)
  *	[cache_varnishd.h] ObjWaitExtend() gained statep argument
  * 19.0 (2024-03-18)
@@ -704,6 +706,8 @@ VCL_BYTES VRT_CacheReqBody(VRT_CTX, VCL_BYTES maxsize);
 
 VCL_STRING VRT_ban_string(VRT_CTX, VCL_STRING);
 VCL_INT VRT_purge(VRT_CTX, VCL_DURATION, VCL_DURATION, VCL_DURATION);
+VCL_INT VRT_purge_tags(VRT_CTX, VCL_STRING, VCL_DURATION, VCL_DURATION,
+    VCL_DURATION);
 VCL_VOID VRT_synth(VRT_CTX, VCL_INT, VCL_STRING);
 VCL_VOID VRT_hit_for_pass(VRT_CTX, VCL_DURATION);
 
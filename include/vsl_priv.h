@@ -44,24 +44,45 @@
 /*
  * Shared memory log format
  *
- * The segments array has index values providing safe entry points into
- * the log, where each element N gives the index of the first log record
- * in the Nth segment of the log. An index value of -1 indicates that no
- * log records in this segment exists.
+ * The log is split into nring rings of VSL_SEGMENTS segments of
+ * segsize words each, and ring N starts at log[N * segsize *
+ * VSL_SEGMENTS].  Writers in different thread pools use different
+ * rings, so they do not contend for one lock.
  *
- * The segment_n member is incremented only, natively wrapping at
- * UINT_MAX. When taken modulo VSL_SEGMENTS, it gives the current index
- * into the offset array.
+ * The segments array of each ring has index values providing safe
+ * entry points into the ring, where each element N gives the index,
+ * relative to the start of the ring, of the first log record in the
+ * Nth segment of the ring. An index value of -1 indicates that no log
+ * records in this segment exists.
+ *
+ * The segment_n member of each ring is incremented only, natively
+ * wrapping at UINT_MAX. When taken modulo VSL_SEGMENTS, it gives the
+ * current index into the offset array.
+ *
+ * Batch records carry a sequence number, counting across all rings,
+ * in the third word.  A reader merges the rings by sequence number.
+ * Space reserved for a record which is not written yet is marked with
+ * VSL_PENDMARKER, followed by the sequence number it will have, so a
+ * reader can tell if an earlier record is still to come.
  *
  * The format of the actual log is in vapi/vsl_int.h
  *
  */
 
+#define VSL_RINGS_MAX		64U
+#define VSL_PENDMARKER	(((uint32_t)SLT__Reserved << 24) | 0x505050) /* "PPP" */
+#define VSL_SEQ(ptr)		((ptr)[2])
+
+struct VSL_ring {
+	unsigned		segment_n;
+	ssize_t			offset[VSL_SEGMENTS];
+};
+
 struct VSL_head {
-#define VSL_HEAD_MARKER		"VSLHEAD2"	/* Incr. as version# */
+#define VSL_HEAD_MARKER		"VSLHEAD3"	/* Incr. as version# */
 	char			marker[8];
 	ssize_t			segsize;
-	unsigned		segment_n;
-	ssize_t			offset[VSL_SEGMENTS];
+	unsigned		nring;
+	struct VSL_ring		ring[VSL_RINGS_MAX];
 	uint32_t		log[];
 };
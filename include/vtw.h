@@ -0,0 +1,92 @@
+/*-
+ * Copyright (c) 2024 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Hierarchical Timing Wheel API
+ *
+ * Items are kept in time slots of a fixed resolution, so inserting,
+ * moving and deleting an item are O(1) operations, at the price of
+ * items only becoming due at the end of their slot.
+ */
+
+/* Public Interface --------------------------------------------------*/
+
+struct vtw;
+
+typedef void vtw_update_t(void *priv, void *a, unsigned newidx);
+	/*
+	 * Update function
+	 * Called to notify the item of its index in the wheel, which
+	 * must be passed to VTW_reorder() and VTW_delete().
+	 */
+
+struct vtw *VTW_new(void *priv, vtw_update_t *, double resolution,
+    double now);
+	/*
+	 * Create timing wheel, with time slots of 'resolution' seconds,
+	 * starting at 'now'.
+	 * 'priv' is passed to the update function.
+	 */
+
+void VTW_destroy(struct vtw **);
+	/*
+	 * Destroy an empty timing wheel
+	 */
+
+void VTW_insert(struct vtw *, void *, double when);
+	/*
+	 * Insert an item, to become due at 'when'
+	 */
+
+void VTW_reorder(struct vtw *, unsigned idx, double when);
+	/*
+	 * Move an item to become due at 'when'
+	 */
+
+void VTW_delete(struct vtw *, unsigned idx);
+	/*
+	 * Delete an item
+	 */
+
+void *VTW_due(struct vtw *, double now);
+	/*
+	 * Advance the wheel to 'now' and return an item which is due,
+	 * or NULL if there is none.  The item stays in the wheel until
+	 * it is deleted or moved.
+	 */
+
+double VTW_next(const struct vtw *);
+	/*
+	 * Return the time the wheel should next be advanced, or NAN
+	 * if it is empty.
+	 */
+
+unsigned VTW_length(const struct vtw *);
+	/*
+	 * Return the number of items in the wheel
+	 */
+
+#define VTW_NOIDX	0
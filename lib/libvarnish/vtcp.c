@@ -418,8 +418,8 @@ VTCP_open(const char *addr, const char *def_port, vtim_dur timeout,
  * avoid conflicts between INADDR_ANY and IN6ADDR_ANY.
  */
 
-int
-VTCP_bind(const struct suckaddr *sa, const char **errp)
+static int
+vtcp_bind(const struct suckaddr *sa, int reuseport, const char **errp)
 {
 	int sd, val, e;
 	socklen_t sl;
@@ -445,6 +445,23 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 		errno = e;
 		return (-1);
 	}
+	if (reuseport) {
+#ifdef HAVE_SO_REUSEPORT
+		val = 1;
+		e = setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof val);
+#else
+		errno = ENOTSUP;
+		e = -1;
+#endif
+		if (e != 0) {
+			if (errp != NULL)
+				*errp = "setsockopt(SO_REUSEPORT, 1)";
+			e = errno;
+			closefd(&sd);
+			errno = e;
+			return (-1);
+		}
+	}
 #ifdef IPV6_V6ONLY
 	/* forcibly use separate sockets for IPv4 and IPv6 */
 	val = 1;
@@ -470,6 +487,25 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	return (sd);
 }
 
+int
+VTCP_bind(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 0, errp));
+}
+
+/*--------------------------------------------------------------------
+ * Like VTCP_bind(), but with SO_REUSEPORT set, so that several sockets
+ * can be bound to the same address and share the incoming connections.
+ */
+
+int
+VTCP_bind_reuseport(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 1, errp));
+}
+
 /*--------------------------------------------------------------------
  * Given a struct suckaddr, open a socket of the appropriate type, bind it
  * to the requested address, and start listening.
@@ -0,0 +1,486 @@
+/*-
+ * Copyright (c) 2024 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Implementation of a hierarchical timing wheel
+ *
+ * There are VTW_LEVELS levels of VTW_SLOTS slots each.  Level zero has
+ * one slot per tick, and each slot on level N covers all slots of level
+ * N-1.  When the wheel turns past a slot on a higher level, its items
+ * are cascaded down to where they belong now.
+ *
+ * Items live in a single array and are doubly linked into the slot
+ * lists by index, so the index is all the caller has to keep.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miniobj.h"
+#include "vdef.h"
+#include "vas.h"
+#include "vtw.h"
+
+/* Parameters --------------------------------------------------------*/
+
+#define VTW_BITS	8
+#define VTW_SLOTS	(1U << VTW_BITS)
+#define VTW_MASK	(VTW_SLOTS - 1)
+#define VTW_LEVELS	4
+
+/* Items on the due list have reached their tick */
+#define VTW_DUE		(VTW_LEVELS * VTW_SLOTS)
+#define VTW_LISTS	(VTW_DUE + 1)
+
+/* Items further in the future are parked in the last slot */
+#define VTW_SPAN	((uint64_t)1 << (VTW_BITS * VTW_LEVELS))
+
+/* Private definitions -----------------------------------------------*/
+
+struct vtw_item {
+	void			*p;
+	double			when;
+	unsigned		next;
+	unsigned		prev;
+	unsigned		list;
+};
+
+struct vtw {
+	unsigned		magic;
+#define VTW_MAGIC		0x1c8f3ae5
+	void			*priv;
+	vtw_update_t		*update;
+	double			res;
+	uint64_t		tick;
+	unsigned		length;
+	unsigned		nitem;
+	unsigned		hwm;
+	unsigned		free;
+	struct vtw_item		*item;
+	unsigned		nlevel[VTW_LEVELS];
+	unsigned		head[VTW_LISTS];
+};
+
+#define I(tw, idx)	(&(tw)->item[idx])
+
+/*--------------------------------------------------------------------*/
+
+static uint64_t
+vtw_tick(const struct vtw *tw, double t, int roundup)
+{
+	double d;
+
+	d = t / tw->res;
+	if (!(d > 0.))
+		return (0);
+	if (d > 0x1p62)
+		d = 0x1p62;
+	return ((uint64_t)(roundup ? ceil(d) : floor(d)));
+}
+
+static void
+vtw_link(struct vtw *tw, unsigned idx, unsigned list)
+{
+	struct vtw_item *it;
+
+	assert(list < VTW_LISTS);
+	if (list < VTW_DUE)
+		tw->nlevel[list / VTW_SLOTS]++;
+	it = I(tw, idx);
+	it->list = list;
+	it->prev = VTW_NOIDX;
+	it->next = tw->head[list];
+	if (it->next != VTW_NOIDX)
+		I(tw, it->next)->prev = idx;
+	tw->head[list] = idx;
+}
+
+static void
+vtw_unlink(struct vtw *tw, unsigned idx)
+{
+	struct vtw_item *it;
+
+	it = I(tw, idx);
+	assert(it->list < VTW_LISTS);
+	if (it->list < VTW_DUE) {
+		AN(tw->nlevel[it->list / VTW_SLOTS]);
+		tw->nlevel[it->list / VTW_SLOTS]--;
+	}
+	if (it->prev != VTW_NOIDX)
+		I(tw, it->prev)->next = it->next;
+	else
+		tw->head[it->list] = it->next;
+	if (it->next != VTW_NOIDX)
+		I(tw, it->next)->prev = it->prev;
+	it->next = it->prev = VTW_NOIDX;
+	it->list = VTW_LISTS;
+}
+
+/*--------------------------------------------------------------------
+ * Items are rounded up to the next tick, so they never become due
+ * before their time.  An item belongs on the lowest level which covers
+ * the distance to its tick.
+ */
+
+static void
+vtw_place(struct vtw *tw, unsigned idx)
+{
+	uint64_t t, d;
+	unsigned l;
+
+	t = vtw_tick(tw, I(tw, idx)->when, 1);
+	if (t <= tw->tick) {
+		vtw_link(tw, idx, VTW_DUE);
+		return;
+	}
+	d = t - tw->tick;
+	if (d >= VTW_SPAN) {
+		t = tw->tick + VTW_SPAN - 1;
+		d = VTW_SPAN - 1;
+	}
+	for (l = 0; d >> (VTW_BITS * (l + 1)); l++)
+		continue;
+	assert(l < VTW_LEVELS);
+	vtw_link(tw, idx,
+	    l * VTW_SLOTS + (unsigned)((t >> (VTW_BITS * l)) & VTW_MASK));
+}
+
+static void
+vtw_cascade(struct vtw *tw, unsigned list)
+{
+	unsigned idx;
+
+	while ((idx = tw->head[list]) != VTW_NOIDX) {
+		vtw_unlink(tw, idx);
+		vtw_place(tw, idx);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Turn the wheel one tick at a time, but skip straight to the next
+ * cascade when all lower levels are empty, so sparse wheels and long
+ * sleeps are cheap.
+ */
+
+static void
+vtw_advance(struct vtw *tw, double now)
+{
+	uint64_t target, next;
+	unsigned l;
+
+	target = vtw_tick(tw, now, 0);
+	while (tw->tick < target && tw->head[VTW_DUE] == VTW_NOIDX) {
+		for (l = 0; l < VTW_LEVELS; l++)
+			if (tw->nlevel[l] > 0)
+				break;
+		if (l == VTW_LEVELS) {
+			tw->tick = target;
+			break;
+		}
+		next = (tw->tick | ((1ULL << (VTW_BITS * l)) - 1)) + 1;
+		if (next > target) {
+			tw->tick = target;
+			break;
+		}
+		tw->tick = next;
+		for (l = 1; l < VTW_LEVELS; l++)
+			if (tw->tick & ((1ULL << (VTW_BITS * l)) - 1))
+				break;
+		while (--l > 0)
+			vtw_cascade(tw, l * VTW_SLOTS +
+			    (unsigned)((tw->tick >> (VTW_BITS * l)) & VTW_MASK));
+		vtw_cascade(tw, (unsigned)(tw->tick & VTW_MASK));
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+struct vtw *
+VTW_new(void *priv, vtw_update_t *update_f, double resolution, double now)
+{
+	struct vtw *tw;
+
+	AN(update_f);
+	assert(resolution > 0.);
+	ALLOC_OBJ(tw, VTW_MAGIC);
+	AN(tw);
+	tw->priv = priv;
+	tw->update = update_f;
+	tw->res = resolution;
+	tw->tick = vtw_tick(tw, now, 0);
+	tw->nitem = 1024;
+	tw->item = calloc(tw->nitem, sizeof *tw->item);
+	AN(tw->item);
+	tw->hwm = 1;		/* Index zero is VTW_NOIDX */
+	return (tw);
+}
+
+void
+VTW_destroy(struct vtw **twp)
+{
+	struct vtw *tw;
+
+	TAKE_OBJ_NOTNULL(tw, twp, VTW_MAGIC);
+	AZ(tw->length);
+	free(tw->item);
+	FREE_OBJ(tw);
+}
+
+void
+VTW_insert(struct vtw *tw, void *p, double when)
+{
+	struct vtw_item *it;
+	unsigned idx;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	AN(p);
+	if (tw->free != VTW_NOIDX) {
+		idx = tw->free;
+		tw->free = I(tw, idx)->next;
+	} else {
+		if (tw->hwm == tw->nitem) {
+			assert(tw->nitem < UINT_MAX / 2);
+			tw->nitem *= 2;
+			tw->item = realloc(tw->item,
+			    tw->nitem * sizeof *tw->item);
+			AN(tw->item);
+		}
+		idx = tw->hwm++;
+	}
+	it = I(tw, idx);
+	memset(it, 0, sizeof *it);
+	it->p = p;
+	it->when = when;
+	vtw_place(tw, idx);
+	tw->length++;
+	tw->update(tw->priv, p, idx);
+}
+
+void
+VTW_reorder(struct vtw *tw, unsigned idx, double when)
+{
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	assert(idx != VTW_NOIDX && idx < tw->hwm);
+	AN(I(tw, idx)->p);
+	vtw_unlink(tw, idx);
+	I(tw, idx)->when = when;
+	vtw_place(tw, idx);
+}
+
+void
+VTW_delete(struct vtw *tw, unsigned idx)
+{
+	struct vtw_item *it;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	assert(idx != VTW_NOIDX && idx < tw->hwm);
+	it = I(tw, idx);
+	AN(it->p);
+	vtw_unlink(tw, idx);
+	tw->update(tw->priv, it->p, VTW_NOIDX);
+	it->p = NULL;
+	it->next = tw->free;
+	tw->free = idx;
+	AN(tw->length);
+	tw->length--;
+}
+
+void *
+VTW_due(struct vtw *tw, double now)
+{
+	unsigned idx;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	vtw_advance(tw, now);
+	idx = tw->head[VTW_DUE];
+	if (idx == VTW_NOIDX)
+		return (NULL);
+	return (I(tw, idx)->p);
+}
+
+double
+VTW_next(const struct vtw *tw)
+{
+	uint64_t next;
+	unsigned l;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	if (tw->length == 0)
+		return (NAN);
+	if (tw->head[VTW_DUE] != VTW_NOIDX)
+		return (tw->tick * tw->res);
+	for (l = 0; l < VTW_LEVELS - 1; l++)
+		if (tw->nlevel[l] > 0)
+			break;
+	next = (tw->tick | ((1ULL << (VTW_BITS * l)) - 1)) + 1;
+	return (next * tw->res);
+}
+
+unsigned
+VTW_length(const struct vtw *tw)
+{
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	return (tw->length);
+}
+
+#ifdef TEST_DRIVER
+
+#include <stdio.h>
+
+#include "vrnd.h"
+
+/* Test driver -------------------------------------------------------*/
+
+struct foo {
+	unsigned	magic;
+#define FOO_MAGIC	0x5e1a7c02
+	unsigned	idx;
+	double		when;
+};
+
+#define M 500083	/* Number of operations */
+#define N 131101	/* Number of items */
+#define RES 0.1		/* Resolution */
+#define SPAN 100000.	/* Time span of items */
+
+static struct foo ff[N];
+
+static void v_matchproto_(vtw_update_t)
+update(void *priv, void *a, unsigned u)
+{
+	struct foo *fa;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	fa->idx = u;
+}
+
+static void
+vrnd_lock(void)
+{
+}
+
+static double
+rnd_when(double now)
+{
+	unsigned r = VRND_RandomTestable();
+
+	/* Mix in some items in the past and far in the future */
+	if (r % 101 == 0)
+		return (now - 10.);
+	if (r % 103 == 0)
+		return (now + 1e10);
+	return (now + (r % 1000000) * SPAN / 1000000.);
+}
+
+/* Expire everything due at 'now', optionally check nothing due is left */
+static unsigned
+expire(struct vtw *tw, double now, int check)
+{
+	struct foo *fp;
+	unsigned u, n = 0;
+
+	while ((fp = VTW_due(tw, now)) != NULL) {
+		CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+		assert(fp->when <= now);
+		VTW_delete(tw, fp->idx);
+		assert(fp->idx == VTW_NOIDX);
+		n++;
+	}
+	for (u = 0; check && u < N; u++)
+		if (ff[u].idx != VTW_NOIDX)
+			assert(ff[u].when > floor(now / RES) * RES);
+	return (n);
+}
+
+int
+main(void)
+{
+	struct vtw *tw;
+	struct foo *fp;
+	unsigned u, v, n;
+	double now = 1e9;
+
+	VRND_SeedAll();
+	VRND_SeedTestable(1);
+	VRND_Lock = vrnd_lock;
+	VRND_Unlock = vrnd_lock;
+
+	tw = VTW_new(NULL, update, RES, now);
+	for (u = 0; u < N; u++) {
+		fp = &ff[u];
+		INIT_OBJ(fp, FOO_MAGIC);
+		fp->when = rnd_when(now);
+		VTW_insert(tw, fp, fp->when);
+		AN(fp->idx);
+	}
+	assert(VTW_length(tw) == N);
+	fprintf(stderr, "%d inserts OK\n", N);
+
+	for (u = 0; u < M; u++) {
+		v = VRND_RandomTestable() % N;
+		fp = &ff[v];
+		if (fp->idx == VTW_NOIDX) {
+			fp->when = rnd_when(now);
+			VTW_insert(tw, fp, fp->when);
+			AN(fp->idx);
+		} else if (u & 1) {
+			VTW_delete(tw, fp->idx);
+			assert(fp->idx == VTW_NOIDX);
+		} else {
+			fp->when = rnd_when(now);
+			VTW_reorder(tw, fp->idx, fp->when);
+		}
+		if (u % 1000 == 0) {
+			now += (VRND_RandomTestable() % 1000) * SPAN / 1e5;
+			(void)expire(tw, now, 1);
+		}
+	}
+	fprintf(stderr, "%d updates OK\n", M);
+
+	n = 0;
+	while (VTW_length(tw) > 0) {
+		now = VTW_next(tw);
+		assert(!isnan(now));
+		if (VTW_length(tw) < 1000)
+			now += 1e9;
+		n += expire(tw, now, 0);
+	}
+	assert(isnan(VTW_next(tw)));
+	fprintf(stderr, "%u expires OK\n", n);
+
+	VTW_destroy(&tw);
+	AZ(tw);
+	return (0);
+}
+#endif
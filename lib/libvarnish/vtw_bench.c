@@ -0,0 +1,205 @@
+/*-
+ * Copyright (c) 2024 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Compare the binary heap and the timing wheel on an expiry-like load:
+ * insert N items, move each of them once, then expire them all in order.
+ *
+ * Usage: vtw_bench [resolution [N ...]]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miniobj.h"
+#include "vdef.h"
+#include "vas.h"
+#include "vbh.h"
+#include "vrnd.h"
+#include "vtim.h"
+#include "vtw.h"
+
+struct item {
+	unsigned	magic;
+#define ITEM_MAGIC	0x4b7e31d9
+	unsigned	idx;
+	double		when;
+};
+
+#define T0	1e9		/* Start time */
+#define SPAN	86400.		/* Spread of expiry times */
+
+static double res = 1.0;
+
+static int v_matchproto_(vbh_cmp_t)
+cmp(void *priv, const void *a, const void *b)
+{
+	const struct item *ia, *ib;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(ia, a, ITEM_MAGIC);
+	CAST_OBJ_NOTNULL(ib, b, ITEM_MAGIC);
+	return (ia->when < ib->when);
+}
+
+static void
+update(void *priv, void *a, unsigned u)
+{
+	struct item *ia;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(ia, a, ITEM_MAGIC);
+	ia->idx = u;
+}
+
+static double
+rnd_when(void)
+{
+	return (T0 + (VRND_RandomTestable() % 1000000) * SPAN / 1e6);
+}
+
+static void
+report(const char *what, const char *op, unsigned n, double t)
+{
+	printf("%-5s %-8s %10u items %8.3f s %8.1f ns/op\n",
+	    what, op, n, t, t * 1e9 / n);
+}
+
+static void
+bench_vbh(struct item *it, unsigned n)
+{
+	struct vbh *bh;
+	struct item *ip;
+	unsigned u;
+	double t;
+
+	VRND_SeedTestable(1);
+	bh = VBH_new(NULL, cmp, update);
+	t = VTIM_mono();
+	for (u = 0; u < n; u++) {
+		INIT_OBJ(&it[u], ITEM_MAGIC);
+		it[u].when = rnd_when();
+		VBH_insert(bh, &it[u]);
+	}
+	report("vbh", "insert", n, VTIM_mono() - t);
+
+	t = VTIM_mono();
+	for (u = 0; u < n; u++) {
+		it[u].when = rnd_when();
+		VBH_reorder(bh, it[u].idx);
+	}
+	report("vbh", "reorder", n, VTIM_mono() - t);
+
+	t = VTIM_mono();
+	for (u = 0; u < n; u++) {
+		ip = VBH_root(bh);
+		CHECK_OBJ_NOTNULL(ip, ITEM_MAGIC);
+		VBH_delete(bh, ip->idx);
+	}
+	report("vbh", "expire", n, VTIM_mono() - t);
+	AZ(VBH_root(bh));
+	VBH_destroy(&bh);
+}
+
+static void
+bench_vtw(struct item *it, unsigned n)
+{
+	struct vtw *tw;
+	struct item *ip;
+	unsigned u;
+	double t, now;
+
+	VRND_SeedTestable(1);
+	tw = VTW_new(NULL, update, res, T0);
+	t = VTIM_mono();
+	for (u = 0; u < n; u++) {
+		INIT_OBJ(&it[u], ITEM_MAGIC);
+		it[u].when = rnd_when();
+		VTW_insert(tw, &it[u], it[u].when);
+	}
+	report("vtw", "insert", n, VTIM_mono() - t);
+
+	t = VTIM_mono();
+	for (u = 0; u < n; u++) {
+		it[u].when = rnd_when();
+		VTW_reorder(tw, it[u].idx, it[u].when);
+	}
+	report("vtw", "reorder", n, VTIM_mono() - t);
+
+	t = VTIM_mono();
+	now = T0;
+	for (u = 0; u < n; u++) {
+		while ((ip = VTW_due(tw, now)) == NULL)
+			now = VTW_next(tw);
+		CHECK_OBJ_NOTNULL(ip, ITEM_MAGIC);
+		VTW_delete(tw, ip->idx);
+	}
+	report("vtw", "expire", n, VTIM_mono() - t);
+	AZ(VTW_length(tw));
+	VTW_destroy(&tw);
+}
+
+static void
+vrnd_lock(void)
+{
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned dflt[] = { 10000000, 100000000 };
+	struct item *it;
+	unsigned n;
+	int i;
+
+	VRND_Lock = vrnd_lock;
+	VRND_Unlock = vrnd_lock;
+
+	if (argc > 1)
+		res = strtod(argv[1], NULL);
+	assert(res > 0.);
+	printf("vtw resolution %g s, expiry span %g s\n", res, SPAN);
+
+	for (i = 0; i < (argc > 2 ? argc - 2 : 2); i++) {
+		if (argc > 2)
+			n = (unsigned)strtoul(argv[i + 2], NULL, 0);
+		else
+			n = dflt[i];
+		assert(n > 0);
+		it = calloc(n, sizeof *it);
+		if (it == NULL) {
+			fprintf(stderr, "Cannot allocate %u items\n", n);
+			return (1);
+		}
+		bench_vbh(it, n);
+		bench_vtw(it, n);
+		free(it);
+	}
+	return (0);
+}
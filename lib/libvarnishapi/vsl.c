@@ -35,6 +35,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "vdef.h"
 #include "vas.h"
@@ -157,6 +158,96 @@ VSL_ResetError(struct VSL_data *vsl)
 	VSB_destroy(&vsl->diag);
 }
 
+/*--------------------------------------------------------------------
+ * Render a packed record into buf as the text record varnishd would
+ * have logged.  Anything else is returned as is.
+ */
+
+static const uint8_t *
+vsl_unpack_uint(const uint8_t *p, const uint8_t *e, uintmax_t *u)
+{
+	unsigned s;
+
+	if (p == NULL)
+		return (NULL);
+	*u = 0;
+	for (s = 0; p < e && s < 64; s += 7) {
+		*u |= (uintmax_t)(*p & 0x7f) << s;
+		if (!(*p++ & 0x80))
+			return (p);
+	}
+	return (NULL);
+}
+
+const uint32_t *
+vsl_unpack(const uint32_t *ptr, uint32_t *buf)
+{
+	struct vsb vsb[1];
+	const uint8_t *p, *e;
+	const char *sep = "";
+	uintmax_t u, f;
+	unsigned i;
+	size_t l;
+
+	AN(ptr);
+	AN(buf);
+	if (VSL_VER(ptr) != VSL_VERSION_PACKED)
+		return (ptr);
+
+	p = (const void *)VSL_CDATA(ptr);
+	e = p + VSL_LEN(ptr);
+	AN(VSB_init(vsb, VSL_DATA(buf), VSL_UNPACKED_MAX));
+	switch (p < e ? *p++ : 0) {
+	case VSL_PACK_UINT:
+		while (p < e) {
+			p = vsl_unpack_uint(p, e, &u);
+			if (p == NULL)
+				break;
+			VSB_printf(vsb, "%s%ju", sep, u);
+			sep = " ";
+		}
+		break;
+	case VSL_PACK_TS:
+		l = strnlen((const char *)p, e - p);
+		if (l == (size_t)(e - p)) {
+			p = NULL;
+			break;
+		}
+		VSB_bcat(vsb, p, l);
+		VSB_cat(vsb, ": ");
+		p += l + 1;
+		for (i = 0; i < 3; i++) {
+			p = vsl_unpack_uint(p, e, &u);
+			p = vsl_unpack_uint(p, e, &f);
+			if (p == NULL)
+				break;
+			VSB_printf(vsb, "%s%ju.%06ju", sep, u, f);
+			sep = " ";
+		}
+		break;
+	default:
+		p = NULL;
+		break;
+	}
+	/* Garbage renders as an empty record */
+	if (p == NULL)
+		VSB_clear(vsb);
+	if (VSB_finish(vsb)) {
+		VSB_clear(vsb);
+		AZ(VSB_finish(vsb));
+	}
+	l = VSB_len(vsb) + 1;
+	VSB_fini(vsb);
+
+	buf[0] = (ptr[0] & ~(VSL_LENMASK | (VSL_VERMASK << VSL_VERSHIFT))) |
+	    (VSL_VERSION_3 << VSL_VERSHIFT) | l;
+	buf[1] = ptr[1];
+	buf[2] = ptr[2];
+	return (buf);
+}
+
+/*--------------------------------------------------------------------*/
+
 static int
 vsl_match_IX(struct VSL_data *vsl, const vslf_list *list,
     const struct VSL_cursor *c)
@@ -35,10 +35,15 @@ extern const char			vsl_file_id[4];
 
 #define VSL_FILE_ID			(vsl_file_id)
 
+/* Room for the text of a packed record */
+#define VSL_UNPACKED_WORDS		\
+	(VSL_OVERHEAD + VSL_WORDS(VSL_UNPACKED_MAX))
+
 /*lint -esym(534, vsl_diag) */
 int vsl_diag(struct VSL_data *vsl, const char *fmt, ...) v_printflike_(2, 3);
 void vsl_vbm_bitset(int bit, void *priv);
 void vsl_vbm_bitclr(int bit, void *priv);
+const uint32_t *vsl_unpack(const uint32_t *ptr, uint32_t *buf);
 
 typedef void vslc_delete_f(const struct VSL_cursor *);
 typedef enum vsl_status vslc_next_f(const struct VSL_cursor *);
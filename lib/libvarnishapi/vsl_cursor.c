@@ -58,6 +58,13 @@
 
 #include "vsl_api.h"
 
+struct vslc_ring {
+	const struct VSL_ring		*head;
+	const uint32_t			*log;
+	const uint32_t			*end;
+	struct VSLC_ptr			next;
+};
+
 struct vslc_vsm {
 	unsigned			magic;
 #define VSLC_VSM_MAGIC			0x4D3903A6
@@ -71,9 +78,22 @@ struct vslc_vsm {
 
 	const struct VSL_head		*head;
 	const uint32_t			*end;
-	struct VSLC_ptr			next;
+	ssize_t				ringsize;
+	unsigned			nring;
+	struct vslc_ring		ring[VSL_RINGS_MAX];
+
+	/* The ring and end of the batch we are returning records from */
+	struct vslc_ring		*cur;
+	const uint32_t			*bend;
+
+	/* The packed record we rendered into unpacked */
+	struct VSLC_ptr			packed;
+	uint32_t			unpacked[VSL_UNPACKED_WORDS];
 };
 
+/* Sequence numbers wrap */
+#define VSLC_SEQ_BEFORE(a, b)		((int32_t)((a) - (b)) < 0)
+
 static void
 vslc_vsm_delete(const struct VSL_cursor *cursor)
 {
@@ -100,6 +120,7 @@ static enum vsl_check v_matchproto_(vslc_check_f)
 vslc_vsm_check(const struct VSL_cursor *cursor, const struct VSLC_ptr *ptr)
 {
 	const struct vslc_vsm *c;
+	const struct vslc_ring *vr;
 	unsigned dist;
 
 	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_VSM_MAGIC);
@@ -108,7 +129,18 @@ vslc_vsm_check(const struct VSL_cursor *cursor, const struct VSLC_ptr *ptr)
 	if (ptr->ptr == NULL)
 		return (vsl_check_e_inval);
 
-	dist = c->head->segment_n - ptr->priv;
+	if (ptr->ptr == c->unpacked) {
+		/* The rendering is overwritten by the next record */
+		if (vslc_vsm_check(cursor, &c->packed) == vsl_check_e_inval)
+			return (vsl_check_e_inval);
+		return (vsl_check_warn);
+	}
+
+	assert(ptr->ptr >= c->head->log);
+	assert(ptr->ptr < c->end);
+	vr = &c->ring[(ptr->ptr - c->head->log) / c->ringsize];
+
+	dist = vr->head->segment_n - ptr->priv;
 
 	if (dist >= VSL_SEGMENTS - 2)
 		/* Too close to continue */
@@ -120,70 +152,183 @@ vslc_vsm_check(const struct VSL_cursor *cursor, const struct VSLC_ptr *ptr)
 	return (vsl_check_valid);
 }
 
-static enum vsl_status v_matchproto_(vslc_next_f)
-vslc_vsm_next(const struct VSL_cursor *cursor)
+static enum vsl_status
+vslc_vsm_overrun(const struct vslc_vsm *c)
 {
-	struct vslc_vsm *c;
-	enum vsl_check i;
-	uint32_t t;
 
-	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_VSM_MAGIC);
-	assert(&c->cursor == cursor);
+	if (VSM_StillValid(c->vsm, &c->vf) != VSM_valid)
+		return (vsl_e_abandon);
+	return (vsl_e_overrun);
+}
+
+static void
+vslc_vsm_segment(const struct vslc_vsm *c, struct vslc_ring *vr)
+{
+
+	while ((vr->next.ptr - vr->log) / c->head->segsize >
+	    vr->next.priv % VSL_SEGMENTS)
+		vr->next.priv++;
+
+	assert(vr->next.ptr >= vr->log);
+	assert(vr->next.ptr < vr->end);
+}
+
+/*
+ * Look at the next record of a ring: vsl_more if there is one, with
+ * its sequence number, vsl_end if there is none, and then pend tells
+ * if one is being written.
+ */
+
+static enum vsl_status
+vslc_vsm_peek(const struct vslc_vsm *c, struct vslc_ring *vr, int *pend,
+    uint32_t *seq)
+{
+	uint32_t t;
 
+	*pend = 0;
 	while (1) {
-		i = vslc_vsm_check(&c->cursor, &c->next);
-		if (i < vsl_check_warn) {
-			if (VSM_StillValid(c->vsm, &c->vf) != VSM_valid)
-				return (vsl_e_abandon);
-			else
-				return (vsl_e_overrun);
-		}
+		if (vslc_vsm_check(&c->cursor, &vr->next) < vsl_check_warn)
+			return (vslc_vsm_overrun(c));
 
-		t = *(volatile const uint32_t *)c->next.ptr;
+		t = *(volatile const uint32_t *)vr->next.ptr;
 		AN(t);
 
-		if (t == VSL_ENDMARKER) {
-			if (VSM_StillValid(c->vsm, &c->vf) != VSM_valid)
-				return (vsl_e_abandon);
-			if (c->options & VSL_COPT_TAILSTOP)
-				return (vsl_e_eof);
-			/* No new records available */
+		if (t == VSL_ENDMARKER)
 			return (vsl_end);
-		}
 
 		/* New data observed. Ensure load ordering with the log
 		 * writer. */
 		VRMB();
 
+		if (t == VSL_PENDMARKER) {
+			*seq = VSL_SEQ(vr->next.ptr);
+			VRMB();
+			if (*(volatile const uint32_t *)vr->next.ptr != t)
+				/* Written while we looked */
+				continue;
+			*pend = 1;
+			return (vsl_end);
+		}
+
 		if (t == VSL_WRAPMARKER) {
 			/* Wrap around not possible at front */
-			assert(c->next.ptr != c->head->log);
-			c->next.ptr = c->head->log;
-			while (c->next.priv % VSL_SEGMENTS)
-				c->next.priv++;
+			assert(vr->next.ptr != vr->log);
+			vr->next.ptr = vr->log;
+			while (vr->next.priv % VSL_SEGMENTS)
+				vr->next.priv++;
 			continue;
 		}
 
-		c->cursor.rec = c->next;
-		c->next.ptr = VSL_NEXT(c->next.ptr);
+		*seq = VSL_SEQ(vr->next.ptr);
+		return (vsl_more);
+	}
+}
 
-		if (VSL_TAG(c->cursor.rec.ptr) == SLT__Batch) {
-			if (!(c->options & VSL_COPT_BATCH))
-				/* Skip the batch record */
+/*
+ * Find the ring with the earliest record.  A record in a ring we found
+ * empty may have been written before the earliest one we found, so
+ * those are looked at again, and we wait for records still being
+ * written with earlier sequence numbers.
+ */
+
+static enum vsl_status
+vslc_vsm_pick(struct vslc_vsm *c, struct vslc_ring **pvr)
+{
+	enum vsl_status st[VSL_RINGS_MAX];
+	uint32_t seq[VSL_RINGS_MAX], bseq = 0;
+	int pend[VSL_RINGS_MAX];
+	struct vslc_ring *best = NULL;
+	unsigned u, pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (u = 0; u < c->nring; u++) {
+			if (pass > 0 && (st[u] != vsl_end || pend[u]))
 				continue;
+			st[u] = vslc_vsm_peek(c, &c->ring[u],
+			    &pend[u], &seq[u]);
+			if (st[u] < vsl_end)
+				return (st[u]);
+			if (st[u] == vsl_more && (best == NULL ||
+			    VSLC_SEQ_BEFORE(seq[u], bseq))) {
+				best = &c->ring[u];
+				bseq = seq[u];
+			}
+		}
+		if (best == NULL || c->nring == 1)
+			break;
+	}
+
+	if (best == NULL) {
+		if (VSM_StillValid(c->vsm, &c->vf) != VSM_valid)
+			return (vsl_e_abandon);
+		for (u = 0; u < c->nring; u++)
+			if (pend[u])
+				return (vsl_end);
+		if (c->options & VSL_COPT_TAILSTOP)
+			return (vsl_e_eof);
+		/* No new records available */
+		return (vsl_end);
+	}
+
+	for (u = 0; c->nring > 1 && u < c->nring; u++)
+		if (pend[u] && VSLC_SEQ_BEFORE(seq[u], bseq))
+			return (vsl_end);
+
+	*pvr = best;
+	return (vsl_more);
+}
+
+static enum vsl_status v_matchproto_(vslc_next_f)
+vslc_vsm_next(const struct VSL_cursor *cursor)
+{
+	struct vslc_vsm *c;
+	struct vslc_ring *vr;
+	enum vsl_status r;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_VSM_MAGIC);
+	assert(&c->cursor == cursor);
+
+	while (1) {
+		vr = c->cur;
+		if (vr != NULL && vr->next.ptr == c->bend) {
+			/* Done with the batch */
+			c->cur = vr = NULL;
+		}
+		if (vr != NULL) {
+			/* The records of a batch are all written */
+			if (vslc_vsm_check(&c->cursor, &vr->next) <
+			    vsl_check_warn)
+				return (vslc_vsm_overrun(c));
+		} else {
+			r = vslc_vsm_pick(c, &vr);
+			if (r != vsl_more)
+				return (r);
+			AN(vr);
+		}
+
+		c->cursor.rec = vr->next;
+		vr->next.ptr = VSL_NEXT(vr->next.ptr);
+
+		if (c->cur == NULL &&
+		    VSL_TAG(c->cursor.rec.ptr) == SLT__Batch) {
+			if (!(c->options & VSL_COPT_BATCH)) {
+				/* Skip the batch record, and return its
+				   records before looking at other rings */
+				c->cur = vr;
+				c->bend = vr->next.ptr +
+				    VSL_WORDS(VSL_BATCHLEN(c->cursor.rec.ptr));
+				vslc_vsm_segment(c, vr);
+				continue;
+			}
 			/* Next call will point to the first record past
 			   the batch */
-			c->next.ptr +=
+			vr->next.ptr +=
 			    VSL_WORDS(VSL_BATCHLEN(c->cursor.rec.ptr));
 		}
 
-		while ((c->next.ptr - c->head->log) / c->head->segsize >
-		    c->next.priv % VSL_SEGMENTS)
-			c->next.priv++;
-
-		assert(c->next.ptr >= c->head->log);
-		assert(c->next.ptr < c->end);
-
+		vslc_vsm_segment(c, vr);
+		c->packed = c->cursor.rec;
+		c->cursor.rec.ptr = vsl_unpack(c->packed.ptr, c->unpacked);
 		return (vsl_more);
 	}
 }
@@ -192,53 +337,72 @@ static enum vsl_status v_matchproto_(vslc_reset_f)
 vslc_vsm_reset(const struct VSL_cursor *cursor)
 {
 	struct vslc_vsm *c;
-	unsigned u, segment_n;
+	struct vslc_ring *vr;
+	const uint32_t *p;
+	unsigned u, n, segment_n;
 	enum vsl_status r;
+	uint32_t seq;
+	int pend;
 
 	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_VSM_MAGIC);
 	assert(&c->cursor == cursor);
 	c->cursor.rec.ptr = NULL;
+	c->cur = NULL;
 
-	segment_n = c->head->segment_n;
-	/* Make sure offset table is not stale compared to segment_n */
-	VRMB();
-
-	if (c->options & VSL_COPT_TAIL) {
-		/* Start in the same segment varnishd currently is in and
-		   run forward until we see the end */
-		u = c->next.priv = segment_n;
-		assert(c->head->offset[c->next.priv % VSL_SEGMENTS] >= 0);
-		c->next.ptr = c->head->log +
-		    c->head->offset[c->next.priv % VSL_SEGMENTS];
-		do {
-			if (c->head->segment_n - u > 1) {
-				/* Give up if varnishd is moving faster
-				   than us */
-				return (vsl_e_overrun);
+	for (n = 0; n < c->nring; n++) {
+		vr = &c->ring[n];
+		segment_n = vr->head->segment_n;
+		/* Make sure offset table is not stale compared to
+		   segment_n */
+		VRMB();
+
+		if (c->options & VSL_COPT_TAIL) {
+			/* Start in the same segment varnishd currently is
+			   in and run forward until we see the end */
+			u = vr->next.priv = segment_n;
+			assert(vr->head->offset[u % VSL_SEGMENTS] >= 0);
+			vr->next.ptr = vr->log +
+			    vr->head->offset[u % VSL_SEGMENTS];
+			while (1) {
+				if (vr->head->segment_n - u > 1) {
+					/* Give up if varnishd is moving
+					   faster than us */
+					return (vsl_e_overrun);
+				}
+				r = vslc_vsm_peek(c, vr, &pend, &seq);
+				if (r != vsl_more)
+					break;
+				p = VSL_NEXT(vr->next.ptr);
+				if (VSL_TAG(vr->next.ptr) == SLT__Batch)
+					p += VSL_WORDS(
+					    VSL_BATCHLEN(vr->next.ptr));
+				vr->next.ptr = p;
+				vslc_vsm_segment(c, vr);
+			}
+			if (r != vsl_end)
+				return (r);
+		} else {
+			/* Starting (VSL_SEGMENTS - 3) behind varnishd. This
+			 * way even if varnishd advances segment_n
+			 * immediately, we'll still have a full segment
+			 * worth of log before the general constraint of at
+			 * least 2 segments apart will be broken.
+			 */
+			vr->next.priv = segment_n - (VSL_SEGMENTS - 3);
+			while (vr->head->offset[
+			    vr->next.priv % VSL_SEGMENTS] < 0) {
+				/* seg 0 must be initialized */
+				assert(vr->next.priv % VSL_SEGMENTS != 0);
+				vr->next.priv++;
 			}
-			r = vslc_vsm_next(&c->cursor);
-		} while (r == vsl_more);
-		if (r != vsl_end)
-			return (r);
-	} else {
-		/* Starting (VSL_SEGMENTS - 3) behind varnishd. This way
-		 * even if varnishd advances segment_n immediately, we'll
-		 * still have a full segment worth of log before the
-		 * general constraint of at least 2 segments apart will be
-		 * broken.
-		 */
-		c->next.priv = segment_n - (VSL_SEGMENTS - 3);
-		while (c->head->offset[c->next.priv % VSL_SEGMENTS] < 0) {
-			/* seg 0 must be initialized */
-			assert(c->next.priv % VSL_SEGMENTS != 0);
-			c->next.priv++;
+			assert(vr->head->offset[
+			    vr->next.priv % VSL_SEGMENTS] >= 0);
+			vr->next.ptr = vr->log +
+			    vr->head->offset[vr->next.priv % VSL_SEGMENTS];
 		}
-		assert(c->head->offset[c->next.priv % VSL_SEGMENTS] >= 0);
-		c->next.ptr = c->head->log +
-		    c->head->offset[c->next.priv % VSL_SEGMENTS];
+		assert(vr->next.ptr >= vr->log);
+		assert(vr->next.ptr < vr->end);
 	}
-	assert(c->next.ptr >= c->head->log);
-	assert(c->next.ptr < c->end);
 	return (vsl_end);
 }
 
@@ -257,6 +421,7 @@ VSL_CursorVSM(struct VSL_data *vsl, struct vsm *vsm, unsigned options)
 	struct vsm_fantom vf;
 	struct VSL_head *head;
 	enum vsl_status r;
+	unsigned u;
 
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 
@@ -291,8 +456,17 @@ VSL_CursorVSM(struct VSL_data *vsl, struct vsm *vsm, unsigned options)
 	c->vsm = vsm;
 	c->vf = vf;
 	c->head = head;
-	c->end = c->head->log + c->head->segsize * VSL_SEGMENTS;
+	c->nring = head->nring;
+	assert(c->nring > 0);
+	assert(c->nring <= VSL_RINGS_MAX);
+	c->ringsize = head->segsize * VSL_SEGMENTS;
+	c->end = head->log + c->ringsize * c->nring;
 	assert(c->end <= (const uint32_t *)vf.e);
+	for (u = 0; u < c->nring; u++) {
+		c->ring[u].head = &head->ring[u];
+		c->ring[u].log = head->log + c->ringsize * u;
+		c->ring[u].end = c->ring[u].log + c->ringsize;
+	}
 
 	r = vslc_vsm_reset(&c->cursor);
 	if (r != vsl_end) {
@@ -313,6 +487,7 @@ struct vslc_file {
 	int				close_fd;
 	ssize_t				buflen;
 	uint32_t			*buf;
+	uint32_t			unpacked[VSL_UNPACKED_WORDS];
 
 	struct VSL_cursor		cursor;
 
@@ -386,6 +561,7 @@ vslc_file_next(const struct VSL_cursor *cursor)
 		}
 		c->cursor.rec.ptr = c->buf;
 	} while (VSL_TAG(c->cursor.rec.ptr) == SLT__Batch);
+	c->cursor.rec.ptr = vsl_unpack(c->buf, c->unpacked);
 	return (vsl_more);
 }
 
@@ -414,6 +590,7 @@ struct vslc_mmap {
 	char				*e;
 	struct VSL_cursor		cursor;
 	struct VSLC_ptr			next;
+	uint32_t			unpacked[VSL_UNPACKED_WORDS];
 };
 
 static void
@@ -446,6 +623,7 @@ vslc_mmap_next(const struct VSL_cursor *cursor)
 	t = TRUST_ME(c->next.ptr);
 	if (t > c->e)
 		return (vsl_e_io);
+	c->cursor.rec.ptr = vsl_unpack(c->cursor.rec.ptr, c->unpacked);
 	return (vsl_more);
 }
 
@@ -468,6 +646,8 @@ vslc_mmap_check(const struct VSL_cursor *cursor, const struct VSLC_ptr *ptr)
 	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_MMAP_MAGIC);
 	assert(&c->cursor == cursor);
 	AN(ptr->ptr);
+	if (ptr->ptr == c->unpacked)
+		return (vsl_check_warn);
 	t = TRUST_ME(ptr->ptr);
 	assert(t > c->b);
 	assert(t <= c->e);
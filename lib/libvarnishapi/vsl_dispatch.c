@@ -85,6 +85,7 @@ struct vslc_raw {
 	struct VSL_cursor	cursor;
 
 	const uint32_t		*ptr;
+	uint32_t		unpacked[VSL_UNPACKED_WORDS];
 };
 
 struct synth {
@@ -246,7 +247,7 @@ vslc_raw_next(const struct VSL_cursor *cursor)
 
 	AN(c->ptr);
 	if (c->cursor.rec.ptr == NULL) {
-		c->cursor.rec.ptr = c->ptr;
+		c->cursor.rec.ptr = vsl_unpack(c->ptr, c->unpacked);
 		return (vsl_more);
 	} else {
 		c->cursor.rec.ptr = NULL;
@@ -435,12 +436,64 @@ chunk_shm_to_buf(struct VSLQ *vslq, struct chunk *chunk)
 	VTAILQ_INSERT_HEAD(&vtx->shmchunks_free, chunk, list);
 }
 
+/* Buffer a set of records at the tail of a vtx structure */
+static void
+vtx_appendbuf(struct vtx *vtx, const uint32_t *ptr, size_t len)
+{
+	struct chunk *chunk;
+
+	chunk = VTAILQ_LAST(&vtx->chunks, chunkhead);
+	CHECK_OBJ_ORNULL(chunk, CHUNK_MAGIC);
+	if (chunk != NULL && chunk->type == chunk_t_buf) {
+		/* Tail is a buf chunk, append to that */
+		chunk_appendbuf(chunk, ptr, len);
+	} else {
+		/* Append new buf chunk */
+		chunk = chunk_newbuf(vtx, ptr, len);
+		AN(chunk);
+		VTAILQ_INSERT_TAIL(&vtx->chunks, chunk, list);
+	}
+	vtx->len += len;
+}
+
+/* Find the first packed record in a set of records */
+static const uint32_t *
+vtx_packed(const uint32_t *ptr, const uint32_t *end)
+{
+
+	while (ptr < end && VSL_VER(ptr) != VSL_VERSION_PACKED)
+		ptr = VSL_NEXT(ptr);
+	return (ptr < end ? ptr : NULL);
+}
+
+/* Buffer a set of records, rendering the packed ones to text. The
+   transaction is handed out as a whole, so the text must stay put */
+static void
+vtx_appendunpacked(struct vtx *vtx, const uint32_t *ptr, const uint32_t *end,
+    const uint32_t *packed)
+{
+	uint32_t buf[VSL_UNPACKED_WORDS];
+	const uint32_t *rec;
+
+	while (packed != NULL) {
+		if (packed > ptr)
+			vtx_appendbuf(vtx, ptr, packed - ptr);
+		rec = vsl_unpack(packed, buf);
+		vtx_appendbuf(vtx, rec, VSL_NEXT(rec) - rec);
+		ptr = VSL_NEXT(packed);
+		packed = vtx_packed(ptr, end);
+	}
+	if (end > ptr)
+		vtx_appendbuf(vtx, ptr, end - ptr);
+}
+
 /* Append a set of records to a vtx structure */
 static enum vsl_status
 vtx_append(struct VSLQ *vslq, struct vtx *vtx, const struct VSLC_ptr *start,
     size_t len)
 {
 	struct chunk *chunk;
+	const uint32_t *packed;
 	enum vsl_check i;
 
 	AN(vtx);
@@ -451,7 +504,11 @@ vtx_append(struct VSLQ *vslq, struct vtx *vtx, const struct VSLC_ptr *start,
 	if (i == vsl_check_e_inval)
 		return (vsl_e_overrun);
 
-	if (i == vsl_check_valid && !VTAILQ_EMPTY(&vtx->shmchunks_free)) {
+	packed = vtx_packed(start->ptr, start->ptr + len);
+	if (packed != NULL) {
+		vtx_appendunpacked(vtx, start->ptr, start->ptr + len, packed);
+	} else if (i == vsl_check_valid &&
+	    !VTAILQ_EMPTY(&vtx->shmchunks_free)) {
 		/* Shmref it */
 		chunk = VTAILQ_FIRST(&vtx->shmchunks_free);
 		CHECK_OBJ_NOTNULL(chunk, CHUNK_MAGIC);
@@ -464,21 +521,11 @@ vtx_append(struct VSLQ *vslq, struct vtx *vtx, const struct VSLC_ptr *start,
 
 		/* Append to shmref list */
 		VTAILQ_INSERT_TAIL(&vslq->shmrefs, chunk, shm.shmref);
+		vtx->len += len;
 	} else {
 		/* Buffer it */
-		chunk = VTAILQ_LAST(&vtx->chunks, chunkhead);
-		CHECK_OBJ_ORNULL(chunk, CHUNK_MAGIC);
-		if (chunk != NULL && chunk->type == chunk_t_buf) {
-			/* Tail is a buf chunk, append to that */
-			chunk_appendbuf(chunk, start->ptr, len);
-		} else {
-			/* Append new buf chunk */
-			chunk = chunk_newbuf(vtx, start->ptr, len);
-			AN(chunk);
-			VTAILQ_INSERT_TAIL(&vtx->chunks, chunk, list);
-		}
+		vtx_appendbuf(vtx, start->ptr, len);
 	}
-	vtx->len += len;
 	return (vsl_more);
 }
 